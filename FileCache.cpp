@@ -0,0 +1,322 @@
+//
+// FileCache.cpp
+//
+
+#include "FileCache.h"
+
+#include <clang/Basic/FileManager.h>
+#include <clang/Basic/FileSystemStatCache.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Lex/PPCallbacks.h>
+#include <clang/Lex/Preprocessor.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace clang;
+using namespace std;
+
+// relative lookups depend on the working directory, which ClangTool
+// changes to that of each compile command
+static string getKey(llvm::StringRef path)
+{
+  llvm::SmallString<256> absolute(path);
+  llvm::sys::fs::make_absolute(absolute);
+  return absolute.str();
+}
+
+// the file a path names, whatever its spelling: the same header may be
+// reached as "a.h" and as "sub/../a.h", or through a symlink, and is
+// written back under its real path; a file that does not exist yet is
+// named by the real path of its directory
+static string getRealKey(llvm::StringRef path)
+{
+  string absolute = getKey(path);
+  char resolved[PATH_MAX];
+  if (realpath(absolute.c_str(), resolved)) {
+    return resolved;
+  }
+  llvm::StringRef parent = llvm::sys::path::parent_path(absolute);
+  if (!parent.empty() && realpath(parent.str().c_str(), resolved)) {
+    llvm::SmallString<256> result(resolved);
+    llvm::sys::path::append(result, llvm::sys::path::filename(absolute));
+    return result.str();
+  }
+  return absolute;
+}
+
+namespace {
+
+// a FileManager owns its stat caches, so each one gets a forwarder of its
+// own to the run-wide table
+class SharedStatCache : public FileSystemStatCache {
+public:
+  SharedStatCache(FileCache &cache) : cache(cache) {}
+
+protected:
+  virtual LookupResult getStat(const char *path, struct stat &statBuf,
+                               int *fileDescriptor)
+  {
+    bool exists;
+    if (cache.lookupStat(path, exists, statBuf)) {
+      // FileManager opens the file itself if it gets no descriptor
+      return exists ? CacheExists : CacheMissing;
+    }
+
+    LookupResult R = statChained(path, statBuf, fileDescriptor);
+    cache.insertStat(path, R == CacheExists, statBuf);
+    return R;
+  }
+
+private:
+  FileCache &cache;
+};
+
+// the preprocessor reads an included file right after this callback, so
+// its cached buffer, if any, is handed over just in time; a translation
+// unit only pays for the files it opens
+class IncludeOverrider : public PPCallbacks {
+public:
+  IncludeOverrider(FileCache &cache, SourceManager &SM)
+    : cache(cache), SM(SM) {}
+
+  void enter(const FileEntry *file)
+  {
+    // a buffer already read must not be swapped under the lexer
+    if (file && seen.insert(file)) {
+      cache.overrideIn(SM, file);
+    }
+  }
+
+  virtual void InclusionDirective(SourceLocation hashLoc,
+                                  const Token &includeTok,
+                                  llvm::StringRef fileName, bool isAngled,
+                                  CharSourceRange fileNameRange,
+                                  const FileEntry *file,
+                                  llvm::StringRef searchPath,
+                                  llvm::StringRef relativePath,
+                                  const Module *imported)
+  {
+    enter(file);
+  }
+
+private:
+  FileCache &cache;
+  SourceManager &SM;
+  llvm::SmallPtrSet<const FileEntry *, 64> seen;
+};
+
+}
+
+// whether two stats describe the same version of the same file
+static bool sameFile(const struct stat &a, const struct stat &b)
+{
+#ifdef __APPLE__
+  bool sameNsec = a.st_mtimespec.tv_nsec == b.st_mtimespec.tv_nsec;
+#else
+  bool sameNsec = a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+#endif
+  return a.st_dev == b.st_dev && a.st_ino == b.st_ino &&
+         a.st_size == b.st_size && a.st_mtime == b.st_mtime && sameNsec;
+}
+
+FileCache &FileCache::get()
+{
+  static FileCache instance;
+  return instance;
+}
+
+FileCache::~FileCache()
+{
+  for (auto I = contents.begin(), E = contents.end(); I != E; ++I) {
+    delete I->getValue().buffer;
+  }
+}
+
+void FileCache::setEnabled(bool E)
+{
+  enabled = E;
+}
+
+void FileCache::attach(FileManager &files)
+{
+  if (enabled) {
+    files.addStatCache(new SharedStatCache(*this));
+  }
+}
+
+void FileCache::overrideOnDemand(CompilerInstance &CI)
+{
+  if (!enabled) {
+    return;
+  }
+
+  SourceManager &SM = CI.getSourceManager();
+  IncludeOverrider *overrider = new IncludeOverrider(*this, SM);
+  overrider->enter(SM.getFileEntryForID(SM.getMainFileID()));
+  CI.getPreprocessor().addPPCallbacks(overrider);
+}
+
+void FileCache::overrideIn(SourceManager &SM, const FileEntry *entry)
+{
+  // files rewritten in memory by an earlier section are already mapped
+  if (!enabled || SM.isFileOverridden(entry)) {
+    return;
+  }
+
+  string key = getKey(entry->getName());
+  string realKey = getRealKey(entry->getName());
+  const llvm::MemoryBuffer *buffer;
+  {
+    llvm::sys::ScopedLock L(lock);
+    auto I = contents.find(realKey);
+    if (I == contents.end()) {
+      return;
+    }
+
+    // the FileManager's view of the file comes from the stat cache, which
+    // keeps the nanoseconds that FileEntry drops
+    const struct stat &atRead = I->getValue().buf;
+    auto S = stats.find(key);
+    bool fresh;
+    if (S != stats.end() && S->getValue().exists) {
+      fresh = sameFile(S->getValue().buf, atRead);
+    }
+    else {
+      fresh = entry->getSize() == atRead.st_size &&
+              entry->getModificationTime() == atRead.st_mtime &&
+              entry->getInode() == atRead.st_ino &&
+              entry->getDevice() == atRead.st_dev;
+    }
+    if (!fresh) {
+      return;
+    }
+    buffer = I->getValue().buffer;
+  }
+  SM.overrideFileContents(entry, buffer, true);
+}
+
+void FileCache::collect(SourceManager &SM)
+{
+  if (!enabled) {
+    return;
+  }
+
+  // the files the translation unit actually entered, not every one that
+  // was looked up
+  llvm::SmallPtrSet<const FileEntry *, 64> seen;
+  vector<string> unread;
+  unsigned hits = 0;
+  for (unsigned i = 0, e = SM.local_sloc_entry_size(); i != e; ++i) {
+    const SrcMgr::SLocEntry &S = SM.getLocalSLocEntry(i);
+    if (!S.isFile()) {
+      continue;
+    }
+    const FileEntry *entry = S.getFile().getContentCache()->OrigEntry;
+    if (!entry || !seen.insert(entry)) {
+      continue;
+    }
+    if (SM.isFileOverridden(entry)) {
+      hits++;
+    }
+    else {
+      unread.push_back(getRealKey(entry->getName()));
+    }
+  }
+
+  llvm::sys::ScopedLock L(lock);
+  bufferHits += hits;
+  for (auto I = unread.begin(), E = unread.end(); I != E; ++I) {
+    if (contents.count(*I)) {
+      continue;
+    }
+    // the file must not change while it is read
+    struct stat before, after;
+    llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+    if (::stat(I->c_str(), &before) ||
+        llvm::MemoryBuffer::getFile(*I, buffer) ||
+        ::stat(I->c_str(), &after) || !sameFile(before, after)) {
+      continue;
+    }
+    ContentEntry &C = contents[*I];
+    C.buffer = buffer.take();
+    C.buf = before;
+    bufferReads++;
+  }
+}
+
+void FileCache::invalidate(llvm::StringRef path)
+{
+  string key = getKey(path);
+  string realKey = getRealKey(path);
+  llvm::sys::ScopedLock L(lock);
+  stats.erase(key);
+  stats.erase(realKey);
+  auto A = spellings.find(realKey);
+  if (A != spellings.end()) {
+    const vector<string> &aliases = A->getValue();
+    for (auto SI = aliases.begin(), SE = aliases.end(); SI != SE; ++SI) {
+      stats.erase(*SI);
+    }
+    spellings.erase(A);
+  }
+  auto I = contents.find(realKey);
+  if (I != contents.end()) {
+    // unmapped before the file is truncated
+    delete I->getValue().buffer;
+    contents.erase(I);
+  }
+}
+
+bool FileCache::lookupStat(const char *path, bool &outExists,
+                           struct stat &outBuf)
+{
+  string key = getKey(path);
+  llvm::sys::ScopedLock L(lock);
+  auto I = stats.find(key);
+  if (I == stats.end()) {
+    statMisses++;
+    return false;
+  }
+
+  statHits++;
+  outExists = I->getValue().exists;
+  if (outExists) {
+    outBuf = I->getValue().buf;
+  }
+  return true;
+}
+
+void FileCache::insertStat(const char *path, bool exists,
+                           const struct stat &buf)
+{
+  // only a miss pays for resolving the path; lookups stay by spelling
+  string key = getKey(path);
+  string realKey = getRealKey(path);
+  llvm::sys::ScopedLock L(lock);
+  StatEntry &S = stats[key];
+  S.exists = exists;
+  S.buf = buf;
+  if (realKey != key) {
+    spellings[realKey].push_back(key);
+  }
+}
+
+void FileCache::printStats(llvm::raw_ostream &OS)
+{
+  llvm::sys::ScopedLock L(lock);
+  if (!enabled || (!statHits && !statMisses)) {
+    return;
+  }
+  OS << "FileCache: " << statHits << " of " << statHits + statMisses
+     << " file lookups and " << bufferHits << " of "
+     << bufferHits + bufferReads << " file reads served from memory\n";
+}
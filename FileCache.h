@@ -0,0 +1,96 @@
+//
+// FileCache.h: run-wide cache of file system lookups and file contents
+//
+
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Mutex.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace clang {
+  class CompilerInstance;
+  class FileEntry;
+  class FileManager;
+  class SourceManager;
+}
+
+namespace llvm {
+  class MemoryBuffer;
+}
+
+// Every ClangTool has its own FileManager, and every translation unit its
+// own SourceManager, so the same headers are looked up in the same search
+// directories and read again for each transform, section and translation
+// unit. This cache outlives them all:
+//
+// - attach() gives a FileManager a stat cache that remembers the outcome of
+//   every lookup, including the failed ones of header search. ClangTool
+//   drops the stat caches after every translation unit, so it is called for
+//   each one, from the action's BeginInvocation.
+// - collect() memory-maps the files a translation unit read, and
+//   overrideOnDemand() hands those buffers to the translation units that
+//   follow, as they enter the main file and each included file. A buffer
+//   is only used while the file has the size, modification time and inode
+//   it had when it was read.
+//
+// The files are not expected to change during a run except through
+// refactorial itself, which calls invalidate() before writing one. Stats
+// are looked up by the absolute spelling of a path, and contents by its
+// real path, so invalidate() also drops the stats of every other spelling
+// of the file it is given.
+class FileCache {
+public:
+  static FileCache &get();
+
+  void setEnabled(bool enabled);
+
+  void attach(clang::FileManager &files);
+  // called once the preprocessor exists, before the main file is entered
+  void overrideOnDemand(clang::CompilerInstance &CI);
+  void overrideIn(clang::SourceManager &SM, const clang::FileEntry *entry);
+  void collect(clang::SourceManager &SM);
+  void invalidate(llvm::StringRef path);
+
+  // used by the stat caches given out by attach()
+  bool lookupStat(const char *path, bool &outExists, struct stat &outBuf);
+  void insertStat(const char *path, bool exists, const struct stat &buf);
+
+  void printStats(llvm::raw_ostream &OS);
+
+private:
+  FileCache()
+    : enabled(true), statHits(0), statMisses(0), bufferHits(0),
+      bufferReads(0) {}
+  ~FileCache();
+
+  struct StatEntry {
+    bool exists;
+    struct stat buf;
+  };
+
+  struct ContentEntry {
+    llvm::MemoryBuffer *buffer;
+    // the file as it was when buffer was read
+    struct stat buf;
+  };
+
+  bool enabled;
+  llvm::StringMap<StatEntry> stats;
+  // the spellings in stats of each real path, when they differ from it
+  llvm::StringMap<std::vector<std::string> > spellings;
+  llvm::StringMap<ContentEntry> contents;
+  unsigned statHits;
+  unsigned statMisses;
+  unsigned bufferHits;
+  unsigned bufferReads;
+  llvm::sys::Mutex lock;
+};
+
+#endif
@@ -0,0 +1,296 @@
+//
+// IdentifierScanner.cpp
+//
+
+#include "IdentifierScanner.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+static bool isIdentifierChar(char c)
+{
+  return isalnum((unsigned char)c) || c == '_' || c == '$';
+}
+
+static const char *findCandidateScalar(
+  const IdentifierScanner::Prefixes &X, const char *P, const char *end)
+{
+  for (; P < end; ++P) {
+    for (unsigned k = 0; k < X.count; ++k) {
+      if ((unsigned char)P[0] == X.first[k] &&
+          (!X.hasSecond[k] ||
+           (P + 1 < end && (unsigned char)P[1] == X.second[k]))) {
+        return P;
+      }
+    }
+  }
+  return end;
+}
+
+#ifdef __SSE2__
+static const char *findCandidateSSE2(const IdentifierScanner::Prefixes &X,
+                                     const char *P, const char *end)
+{
+  __m128i first[IdentifierScanner::MaxVectorPrefixes];
+  __m128i second[IdentifierScanner::MaxVectorPrefixes];
+  for (unsigned k = 0; k < X.count; ++k) {
+    first[k] = _mm_set1_epi8((char)X.first[k]);
+    second[k] = _mm_set1_epi8((char)X.second[k]);
+  }
+
+  // the second load reads one byte past the block
+  while (end - P > 16) {
+    __m128i B0 = _mm_loadu_si128((const __m128i *)P);
+    __m128i B1 = _mm_loadu_si128((const __m128i *)(P + 1));
+    unsigned mask = 0;
+    for (unsigned k = 0; k < X.count; ++k) {
+      __m128i eq = _mm_cmpeq_epi8(B0, first[k]);
+      if (X.hasSecond[k]) {
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi8(B1, second[k]));
+      }
+      mask |= _mm_movemask_epi8(eq);
+    }
+    if (mask) {
+      return P + __builtin_ctz(mask);
+    }
+    P += 16;
+  }
+
+  return findCandidateScalar(X, P, end);
+}
+#endif
+
+#ifdef __x86_64__
+static void cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4])
+{
+  __asm__ volatile("cpuid"
+                   : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]),
+                     "=d"(regs[3])
+                   : "a"(leaf), "c"(subleaf));
+}
+
+static bool hasAVX2()
+{
+  unsigned regs[4];
+  cpuid(0, 0, regs);
+  if (regs[0] < 7) {
+    return false;
+  }
+
+  // the OS must save the YMM registers (OSXSAVE, AVX, XCR0 bits 1 and 2)
+  cpuid(1, 0, regs);
+  if (!(regs[2] & (1 << 27)) || !(regs[2] & (1 << 28))) {
+    return false;
+  }
+  unsigned xcr0, xcr0High;
+  __asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(xcr0High) : "c"(0));
+  if ((xcr0 & 6) != 6) {
+    return false;
+  }
+
+  cpuid(7, 0, regs);
+  return regs[1] & (1 << 5);
+}
+#endif
+
+IdentifierScanner::Kernel IdentifierScanner::getBestKernel()
+{
+#ifdef __x86_64__
+  static bool avx2 = hasAVX2();
+  if (avx2) {
+    return AVX2Kernel;
+  }
+#endif
+#ifdef __SSE2__
+  return SSE2Kernel;
+#else
+  return ScalarKernel;
+#endif
+}
+
+static IdentifierScanner::Kernel activeKernel =
+  IdentifierScanner::getBestKernel();
+
+IdentifierScanner::Kernel IdentifierScanner::getKernel()
+{
+  return activeKernel;
+}
+
+void IdentifierScanner::setKernel(Kernel K)
+{
+  if (K <= getBestKernel()) {
+    activeKernel = K;
+  }
+}
+
+const char *IdentifierScanner::getKernelName(Kernel K)
+{
+  switch (K) {
+  case AVX2Kernel:
+    return "AVX2";
+  case SSE2Kernel:
+    return "SSE2";
+  default:
+    return "scalar";
+  }
+}
+
+static IdentifierScannerKernelFn getKernelFn(IdentifierScanner::Kernel K)
+{
+  switch (K) {
+#ifdef __x86_64__
+  case IdentifierScanner::AVX2Kernel:
+    return findCandidateAVX2;
+#endif
+#ifdef __SSE2__
+  case IdentifierScanner::SSE2Kernel:
+    return findCandidateSSE2;
+#endif
+  default:
+    return 0;
+  }
+}
+
+IdentifierScanner::IdentifierScanner(const vector<string> &L, MatchMode M)
+  : literals(L), mode(M), vectorizable(true)
+{
+  memset(isFirstByte, 0, sizeof(isFirstByte));
+  prefixes.count = 0;
+
+  for (unsigned i = 0, e = literals.size(); i != e; ++i) {
+    const string &S = literals[i];
+    if (S.empty()) {
+      continue;
+    }
+
+    unsigned char first = S[0];
+    byFirstByte[first].push_back(i);
+    isFirstByte[first] = true;
+
+    bool hasSecond = S.size() > 1;
+    unsigned char second = hasSecond ? S[1] : 0;
+    bool known = false;
+    for (unsigned k = 0; k < prefixes.count; ++k) {
+      if (prefixes.first[k] == first &&
+          (!prefixes.hasSecond[k] ||
+           (hasSecond && prefixes.second[k] == second))) {
+        known = true;
+        break;
+      }
+    }
+    if (known) {
+      continue;
+    }
+
+    if (prefixes.count == MaxVectorPrefixes) {
+      vectorizable = false;
+      continue;
+    }
+    prefixes.first[prefixes.count] = first;
+    prefixes.second[prefixes.count] = second;
+    prefixes.hasSecond[prefixes.count] = hasSecond;
+    prefixes.count++;
+  }
+}
+
+bool IdentifierScanner::matchesAt(unsigned literal, const char *begin,
+                                  const char *P, const char *end) const
+{
+  const string &S = literals[literal];
+  if ((size_t)(end - P) < S.size() || memcmp(P, S.data(), S.size())) {
+    return false;
+  }
+
+  if (mode == WholeIdentifier) {
+    if (P > begin && isIdentifierChar(P[-1])) {
+      return false;
+    }
+    if (P + S.size() < end && isIdentifierChar(P[S.size()])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const char *IdentifierScanner::findFirst(const char *begin, const char *from,
+                                         const char *end,
+                                         unsigned *outLiteral) const
+{
+  // the scalar kernel is no faster than a table lookup per byte
+  IdentifierScannerKernelFn kernel = vectorizable ? getKernelFn(activeKernel)
+                                                  : 0;
+
+  for (const char *P = from; P < end; ++P) {
+    if (kernel) {
+      P = kernel(prefixes, P, end);
+    }
+    else {
+      while (P < end && !isFirstByte[(unsigned char)*P]) {
+        ++P;
+      }
+    }
+    if (P == end) {
+      break;
+    }
+
+    const vector<unsigned> &candidates = byFirstByte[(unsigned char)*P];
+    for (auto I = candidates.begin(), E = candidates.end(); I != E; ++I) {
+      if (matchesAt(*I, begin, P, end)) {
+        if (outLiteral) {
+          *outLiteral = *I;
+        }
+        return P;
+      }
+    }
+  }
+
+  return end;
+}
+
+unsigned IdentifierScanner::scan(const char *begin, const char *end,
+                                 vector<bool> &outFound) const
+{
+  outFound.assign(literals.size(), false);
+
+  unsigned wanted = 0;
+  for (unsigned i = 0, e = literals.size(); i != e; ++i) {
+    if (!literals[i].empty()) {
+      wanted++;
+    }
+  }
+
+  unsigned found = 0;
+  // the scalar kernel is no faster than a table lookup per byte
+  IdentifierScannerKernelFn kernel = vectorizable ? getKernelFn(activeKernel)
+                                                  : 0;
+
+  for (const char *P = begin; found < wanted && P < end; ++P) {
+    if (kernel) {
+      P = kernel(prefixes, P, end);
+    }
+    else {
+      while (P < end && !isFirstByte[(unsigned char)*P]) {
+        ++P;
+      }
+    }
+    if (P == end) {
+      break;
+    }
+
+    const vector<unsigned> &candidates = byFirstByte[(unsigned char)*P];
+    for (auto I = candidates.begin(), E = candidates.end(); I != E; ++I) {
+      if (!outFound[*I] && matchesAt(*I, begin, P, end)) {
+        outFound[*I] = true;
+        found++;
+      }
+    }
+  }
+
+  return found;
+}
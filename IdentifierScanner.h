@@ -0,0 +1,92 @@
+//
+// IdentifierScanner.h: search raw source text for many literals at once
+//
+
+#ifndef IDENTIFIER_SCANNER_H
+#define IDENTIFIER_SCANNER_H
+
+#include <string>
+#include <vector>
+
+// Finds a fixed set of literals (identifiers or identifier fragments) in a
+// buffer in a single pass. Candidate positions are located with a SIMD
+// kernel comparing the first two bytes of every literal against a whole
+// block at a time; only those positions are compared in full. The kernel is
+// chosen at runtime: AVX2 where the CPU and OS support it, SSE2 on other
+// x86-64 machines and a scalar loop elsewhere.
+//
+// SIMD candidate search handles up to MaxVectorPrefixes distinct two-byte
+// prefixes; larger literal sets use the scalar kernel.
+class IdentifierScanner {
+public:
+  enum MatchMode {
+    // the literal may be part of a longer identifier ("sqlite3_" in
+    // "sqlite3_open")
+    Substring,
+    // the literal must not be preceded or followed by an identifier
+    // character
+    WholeIdentifier
+  };
+
+  enum Kernel {
+    ScalarKernel,
+    SSE2Kernel,
+    AVX2Kernel
+  };
+
+  IdentifierScanner(const std::vector<std::string> &literals,
+                    MatchMode mode = WholeIdentifier);
+
+  // sets outFound[i] if literals[i] occurs in [begin, end); returns the
+  // number of distinct literals found. Stops early once all are found.
+  unsigned scan(const char *begin, const char *end,
+                std::vector<bool> &outFound) const;
+
+  // the first occurrence of any literal at or after from, or end
+  const char *findFirst(const char *begin, const char *from, const char *end,
+                        unsigned *outLiteral = 0) const;
+
+  // the best kernel this machine supports, and the one in use
+  static Kernel getBestKernel();
+  static Kernel getKernel();
+  static const char *getKernelName(Kernel K);
+
+  // for benchmarks and tests; a kernel the machine cannot run is ignored
+  static void setKernel(Kernel K);
+
+  static const unsigned MaxVectorPrefixes = 8;
+
+  // the candidate positions the kernels look for
+  struct Prefixes {
+    unsigned count;
+    unsigned char first[MaxVectorPrefixes];
+    unsigned char second[MaxVectorPrefixes];
+    // one-byte literals only constrain the first byte
+    bool hasSecond[MaxVectorPrefixes];
+  };
+
+private:
+  bool matchesAt(unsigned literal, const char *begin, const char *P,
+                 const char *end) const;
+
+  std::vector<std::string> literals;
+  MatchMode mode;
+
+  // literals by their first byte
+  std::vector<unsigned> byFirstByte[256];
+  bool isFirstByte[256];
+
+  Prefixes prefixes;
+  bool vectorizable;
+};
+
+// a candidate kernel returns the first position in [P, end) at which one of
+// the prefixes starts, or end if there is none
+typedef const char *(*IdentifierScannerKernelFn)(
+  const IdentifierScanner::Prefixes &prefixes, const char *P,
+  const char *end);
+
+const char *findCandidateAVX2(const IdentifierScanner::Prefixes &prefixes,
+                              const char *P, const char *end);
+
+#endif
@@ -0,0 +1,54 @@
+//
+// IdentifierScannerAVX2.cpp: the AVX2 candidate kernel
+//
+// Compiled with -mavx2 on x86-64; only called after IdentifierScanner has
+// checked that the CPU and OS support AVX2.
+//
+
+#include "IdentifierScanner.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+const char *findCandidateAVX2(const IdentifierScanner::Prefixes &X,
+                              const char *P, const char *end)
+{
+#ifdef __AVX2__
+  __m256i first[IdentifierScanner::MaxVectorPrefixes];
+  __m256i second[IdentifierScanner::MaxVectorPrefixes];
+  for (unsigned k = 0; k < X.count; ++k) {
+    first[k] = _mm256_set1_epi8((char)X.first[k]);
+    second[k] = _mm256_set1_epi8((char)X.second[k]);
+  }
+
+  // the second load reads one byte past the block
+  while (end - P > 32) {
+    __m256i B0 = _mm256_loadu_si256((const __m256i *)P);
+    __m256i B1 = _mm256_loadu_si256((const __m256i *)(P + 1));
+    unsigned mask = 0;
+    for (unsigned k = 0; k < X.count; ++k) {
+      __m256i eq = _mm256_cmpeq_epi8(B0, first[k]);
+      if (X.hasSecond[k]) {
+        eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(B1, second[k]));
+      }
+      mask |= (unsigned)_mm256_movemask_epi8(eq);
+    }
+    if (mask) {
+      return P + __builtin_ctz(mask);
+    }
+    P += 32;
+  }
+#endif
+
+  for (; P < end; ++P) {
+    for (unsigned k = 0; k < X.count; ++k) {
+      if ((unsigned char)P[0] == X.first[k] &&
+          (!X.hasSecond[k] ||
+           (P + 1 < end && (unsigned char)P[1] == X.second[k]))) {
+        return P;
+      }
+    }
+  }
+  return end;
+}
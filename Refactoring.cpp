@@ -14,13 +14,38 @@
 #include "clang/Basic/FileManager.h"
 #include "clang/Basic/SourceManager.h"
 #include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendActions.h"
 #include "clang/Frontend/TextDiagnosticPrinter.h"
 #include "clang/Lex/Lexer.h"
 #include "clang/Rewrite/Core/Rewriter.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_os_ostream.h"
 #include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <iterator>
+#include <limits.h>
+#include <set>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "Refactoring.h"
+#include "FileCache.h"
+#include "IdentifierScanner.h"
+#include "hash-util.h"
 
 static const char * const InvalidLocation = "";
 
@@ -28,12 +53,14 @@ using namespace clang;
 using namespace clang::tooling;
 
 Replacement::Replacement()
-  : FilePath(InvalidLocation), Offset(0), Length(0) {}
+  : FilePath(InvalidLocation), Offset(0), Length(0),
+    HasOriginalText(false), OriginalTextHash(0) {}
 
 Replacement::Replacement(llvm::StringRef FilePath, unsigned Offset,
                          unsigned Length, llvm::StringRef ReplacementText)
   : FilePath(FilePath), Offset(Offset),
-    Length(Length), ReplacementText(ReplacementText) {}
+    Length(Length), ReplacementText(ReplacementText),
+    HasOriginalText(false), OriginalTextHash(0) {}
 
 Replacement::Replacement(SourceManager &Sources, SourceLocation Start,
                          unsigned Length, llvm::StringRef ReplacementText) {
@@ -49,19 +76,23 @@ bool Replacement::isApplicable() const {
   return FilePath != InvalidLocation;
 }
 
+// FIXME: Use SM.translateFile directly.
+static FileID getFileIDForEntry(SourceManager &SM, const FileEntry *Entry) {
+  SourceLocation Location = SM.translateFileLineCol(Entry, 1, 1);
+  return Location.isValid() ?
+    SM.getFileID(Location) :
+    SM.createFileID(Entry, SourceLocation(), SrcMgr::C_User);
+}
+
 bool Replacement::apply(Rewriter &Rewrite) const {
   SourceManager &SM = Rewrite.getSourceMgr();
   const FileEntry *Entry = SM.getFileManager().getFile(FilePath);
   if (Entry == NULL)
     return false;
-  FileID ID;
-  // FIXME: Use SM.translateFile directly.
-  SourceLocation Location = SM.translateFileLineCol(Entry, 1, 1);
-  ID = Location.isValid() ?
-    SM.getFileID(Location) :
-    SM.createFileID(Entry, SourceLocation(), SrcMgr::C_User);
-  // FIXME: We cannot check whether Offset + Length is in the file, as
-  // the remapping API is not public in the RewriteBuffer.
+  FileID ID = getFileIDForEntry(SM, Entry);
+  // Whether Offset + Length is in the file has been checked against the
+  // file's buffer by applyAllReplacements; the remapping API is not public
+  // in the RewriteBuffer.
   const SourceLocation Start =
     SM.getLocForStartOfFile(ID).
     getLocWithOffset(Offset);
@@ -73,6 +104,13 @@ bool Replacement::apply(Rewriter &Rewrite) const {
   return RewriteSucceeded;
 }
 
+bool Replacement::matchesOriginalText(llvm::StringRef FileContents) const {
+  if (Offset > FileContents.size() || Length > FileContents.size() - Offset)
+    return false;
+  return !HasOriginalText ||
+    hashString(FileContents.substr(Offset, Length)) == OriginalTextHash;
+}
+
 std::string Replacement::toString() const {
   std::string result;
   llvm::raw_string_ostream stream(result);
@@ -81,6 +119,62 @@ std::string Replacement::toString() const {
   return result;
 }
 
+/// \brief Escapes the characters that separate the fields and records of
+/// serialized replacements and checkpoint logs.
+static void escape(llvm::StringRef S, std::string &Result) {
+  for (llvm::StringRef::iterator I = S.begin(), E = S.end(); I != E; ++I) {
+    switch (*I) {
+    case '\\': Result += "\\\\"; break;
+    case '\t': Result += "\\t"; break;
+    case '\n': Result += "\\n"; break;
+    case '\r': Result += "\\r"; break;
+    default: Result += *I;
+    }
+  }
+}
+
+static std::string unescape(llvm::StringRef S) {
+  std::string Result;
+  for (size_t I = 0, E = S.size(); I != E; ++I) {
+    if (S[I] != '\\' || I + 1 == E) {
+      Result += S[I];
+      continue;
+    }
+    switch (S[++I]) {
+    case 't': Result += '\t'; break;
+    case 'n': Result += '\n'; break;
+    case 'r': Result += '\r'; break;
+    default: Result += S[I];
+    }
+  }
+  return Result;
+}
+
+std::string Replacement::serialize() const {
+  std::string Result = llvm::utostr(Offset) + "\t" + llvm::utostr(Length) +
+    "\t" + (HasOriginalText ? llvm::utohexstr(OriginalTextHash) : "-") + "\t";
+  escape(FilePath, Result);
+  Result += "\t";
+  escape(ReplacementText, Result);
+  return Result;
+}
+
+bool Replacement::deserialize(llvm::StringRef Line, Replacement &Result) {
+  llvm::SmallVector<llvm::StringRef, 5> Fields;
+  Line.split(Fields, "\t");
+  if (Fields.size() != 5 || Fields[0].getAsInteger(10, Result.Offset) ||
+      Fields[1].getAsInteger(10, Result.Length))
+    return false;
+  Result.HasOriginalText = Fields[2] != "-";
+  Result.OriginalTextHash = 0;
+  if (Result.HasOriginalText &&
+      Fields[2].getAsInteger(16, Result.OriginalTextHash))
+    return false;
+  Result.FilePath = unescape(Fields[3]);
+  Result.ReplacementText = unescape(Fields[4]);
+  return true;
+}
+
 bool Replacement::Equal::operator()(const Replacement &R1,
                                    const Replacement &R2) const {
   return R1.FilePath == R2.FilePath
@@ -99,6 +193,16 @@ void Replacement::setFromSourceLocation(SourceManager &Sources,
   this->Offset = DecomposedLocation.second;
   this->Length = Length;
   this->ReplacementText = ReplacementText;
+
+  // remember what is being replaced, so that the replacement is not applied
+  // to a file that changed in the meantime
+  bool Invalid = false;
+  llvm::StringRef Buffer =
+    Sources.getBufferData(DecomposedLocation.first, &Invalid);
+  this->HasOriginalText = !Invalid && Offset <= Buffer.size() &&
+                          Length <= Buffer.size() - Offset;
+  this->OriginalTextHash = HasOriginalText ?
+    hashString(Buffer.substr(Offset, Length)) : 0;
 }
 
 // FIXME: This should go into the Lexer, but we need to figure out how
@@ -123,19 +227,141 @@ void Replacement::setFromSourceRange(SourceManager &Sources,
                         getRangeSize(Sources, Range), ReplacementText);
 }
 
-bool applyAllReplacements(Replacements &Replaces, Rewriter &Rewrite) {
-  bool Result = true;
-  for(Replacements::iterator B = Replaces.begin(),
-                             I = B,
-                             E = Replaces.end();
-      I != E; ++I) {
-    Replacements::iterator S = std::search(I+1,E,I,I+1,Replacement::Equal());
-    if (S != E)
-    {
-      I = Replaces.erase(I)-1;
-      E = Replaces.end();
+static std::string getRealPath(llvm::StringRef Path) {
+  char Resolved[PATH_MAX];
+  std::string P = Path;
+  return realpath(P.c_str(), Resolved) ? std::string(Resolved) : P;
+}
+
+/// \brief Names the file of every replacement by its real path.
+///
+/// A header included as "a.h" from one translation unit and as "../x/a.h"
+/// from another gets replacements under both spellings. Grouped by the
+/// spelling, the second group written would discard the first one's edits.
+static void resolveFilePaths(Replacements &Replaces) {
+  llvm::StringMap<std::string> RealPaths;
+  for (Replacements::iterator I = Replaces.begin(), E = Replaces.end();
+       I != E; ++I) {
+    if (!I->isApplicable())
+      continue;
+    llvm::StringMapEntry<std::string> &Entry =
+      RealPaths.GetOrCreateValue(I->getFilePath());
+    if (Entry.getValue().empty())
+      Entry.setValue(getRealPath(I->getFilePath()));
+    I->setFilePath(Entry.getValue());
+  }
+}
+
+namespace {
+class ReplacementLess {
+public:
+  bool operator()(const Replacement *R1, const Replacement *R2) const {
+    int Compare = R1->getFilePath().compare(R2->getFilePath());
+    if (Compare != 0)
+      return Compare < 0;
+    return R1->getOffset() < R2->getOffset();
+  }
+};
+}
+
+/// \brief Drops the replacements whose range no longer holds the text they
+/// were created for.
+///
+/// The replacements are checked file by file in offset order, so every
+/// file's buffer is read once, front to back. Only the stale replacements
+/// are dropped; the others of the same file still apply. Returns false if
+/// any replacement was dropped.
+static bool removeStaleReplacements(Replacements &Replaces,
+                                    SourceManager &SM) {
+  std::vector<const Replacement *> Sorted;
+  for (Replacements::const_iterator I = Replaces.begin(), E = Replaces.end();
+       I != E; ++I) {
+    if (I->isApplicable())
+      Sorted.push_back(&*I);
+  }
+  std::sort(Sorted.begin(), Sorted.end(), ReplacementLess());
+
+  std::set<const Replacement *> Stale;
+  for (size_t I = 0, E = Sorted.size(); I != E; ) {
+    llvm::StringRef Path = Sorted[I]->getFilePath();
+    size_t End = I;
+    while (End != E && Sorted[End]->getFilePath() == Path)
+      ++End;
+
+    const FileEntry *Entry = SM.getFileManager().getFile(Path);
+    if (Entry != NULL) {
+      bool Invalid = false;
+      llvm::StringRef Contents =
+        SM.getBufferData(getFileIDForEntry(SM, Entry), &Invalid);
+      unsigned FileStale = 0;
+      for (size_t J = I; J != End; ++J) {
+        if (Invalid || !Sorted[J]->matchesOriginalText(Contents)) {
+          if (FileStale == 0)
+            llvm::errs() << "Stale replacement " << Sorted[J]->toString()
+                         << "\n";
+          Stale.insert(Sorted[J]);
+          ++FileStale;
+        }
+      }
+      if (FileStale != 0)
+        llvm::errs() << Path << " changed since it was parsed; skipping "
+                     << FileStale << " of its " << End - I
+                     << " replacements\n";
     }
+    I = End;
+  }
+
+  if (Stale.empty())
+    return true;
+
+  Replacements Kept;
+  for (Replacements::const_iterator I = Replaces.begin(), E = Replaces.end();
+       I != E; ++I) {
+    if (!Stale.count(&*I))
+      Kept.push_back(*I);
+  }
+  Replaces.swap(Kept);
+  return false;
+}
+
+namespace {
+class ReplacementPositionLess {
+public:
+  bool operator()(const Replacement &R1, const Replacement &R2) const {
+    return ReplacementLess()(&R1, &R2);
+  }
+};
+}
+
+/// \brief Removes duplicate replacements, e.g. from a header seen by
+/// several translation units.
+///
+/// Replacements at the same position keep their relative order, which
+/// matters for insertions.
+static void removeDuplicateReplacements(Replacements &Replaces) {
+  std::stable_sort(Replaces.begin(), Replaces.end(),
+                   ReplacementPositionLess());
+  Replacements Unique;
+  Unique.reserve(Replaces.size());
+  size_t GroupStart = 0;
+  for (size_t I = 0, E = Replaces.size(); I != E; ++I) {
+    if (Unique.size() == GroupStart ||
+        ReplacementPositionLess()(Unique[GroupStart], Replaces[I]))
+      GroupStart = Unique.size();
+
+    bool Duplicate = false;
+    for (size_t J = GroupStart, F = Unique.size(); J != F && !Duplicate; ++J)
+      Duplicate = Replacement::Equal()(Unique[J], Replaces[I]);
+    if (!Duplicate)
+      Unique.push_back(Replaces[I]);
   }
+  Replaces.swap(Unique);
+}
+
+bool applyAllReplacements(Replacements &Replaces, Rewriter &Rewrite) {
+  resolveFilePaths(Replaces);
+  bool Result = removeStaleReplacements(Replaces, Rewrite.getSourceMgr());
+  removeDuplicateReplacements(Replaces);
   for (Replacements::const_iterator I = Replaces.begin(),
                                     E = Replaces.end();
        I != E; ++I) {
@@ -148,38 +374,1421 @@ bool applyAllReplacements(Replacements &Replaces, Rewriter &Rewrite) {
   return Result;
 }
 
+bool applySortedReplacements(llvm::StringRef Contents,
+                             Replacements::const_iterator Begin,
+                             Replacements::const_iterator End,
+                             std::string &Result) {
+  size_t Size = Contents.size();
+  size_t Last = 0;
+  for (Replacements::const_iterator I = Begin; I != End; ++I) {
+    if (I->getOffset() < Last || I->getOffset() > Contents.size() ||
+        I->getLength() > Contents.size() - I->getOffset())
+      return false;
+    Last = I->getOffset() + I->getLength();
+    Size += I->getReplacementText().size();
+    Size -= I->getLength();
+  }
+
+  std::string Output;
+  Output.reserve(Size);
+  size_t Position = 0;
+  for (Replacements::const_iterator I = Begin; I != End; ++I) {
+    Output.append(Contents.data() + Position, I->getOffset() - Position);
+    Output.append(I->getReplacementText().data(),
+                  I->getReplacementText().size());
+    Position = I->getOffset() + I->getLength();
+  }
+  Output.append(Contents.data() + Position, Contents.size() - Position);
+  Result.swap(Output);
+  return true;
+}
+
+/// \brief Writes Text to Path, reporting any failure to open or write it.
+static bool writeFile(const std::string &Path, llvm::StringRef Text) {
+  std::string ErrorInfo;
+  llvm::raw_fd_ostream Stream(Path.c_str(), ErrorInfo,
+                              llvm::raw_fd_ostream::F_Binary);
+  if (!ErrorInfo.empty()) {
+    llvm::errs() << "Could not save " << Path << ": " << ErrorInfo << "\n";
+    return false;
+  }
+  Stream << Text;
+  Stream.close();
+  if (Stream.has_error()) {
+    Stream.clear_error();
+    llvm::errs() << "Could not save " << Path << ": write failed\n";
+    return false;
+  }
+  return true;
+}
+
+/// \brief Writes Original to Path.orig, then Contents to Path.
+///
+/// Path is left alone unless its backup was written.
+static bool saveFile(llvm::StringRef Path, llvm::StringRef Original,
+                     llvm::StringRef Contents) {
+  std::string Backup = Path.str() + ".orig";
+  FileCache::get().invalidate(Path);
+  FileCache::get().invalidate(Backup);
+  return writeFile(Backup, Original) && writeFile(Path.str(), Contents);
+}
+
 bool saveRewrittenFiles(Rewriter &Rewrite) {
+  bool Result = true;
   for (Rewriter::buffer_iterator I = Rewrite.buffer_begin(),
                                  E = Rewrite.buffer_end();
        I != E; ++I) {
-    // FIXME: This code is copied from the FixItRewriter.cpp - I think it should
-    // go into directly into Rewriter (there we also have the Diagnostics to
-    // handle the error cases better).
     const FileEntry *Entry =
         Rewrite.getSourceMgr().getFileEntryForID(I->first);
-    std::string ErrorInfo;
-    llvm::raw_fd_ostream FileStream(
-        Entry->getName(), ErrorInfo, llvm::raw_fd_ostream::F_Binary);
-    llvm::raw_fd_ostream BackupStream(
-	    (std::string(Entry->getName()) + ".orig").c_str(), ErrorInfo, llvm::raw_fd_ostream::F_Binary);
-    if (!ErrorInfo.empty())
+    std::string Contents;
+    llvm::raw_string_ostream Stream(Contents);
+    I->second.write(Stream);
+    Stream.flush();
+    if (!saveFile(Entry->getName(),
+                  Rewrite.getSourceMgr().getBufferData(I->first), Contents))
+      Result = false;
+  }
+  return Result;
+}
+
+std::string FileOverlay::getKey(llvm::StringRef Path) {
+  return getRealPath(Path);
+}
+
+const std::string *FileOverlay::lookup(llvm::StringRef Path) const {
+  if (Contents.empty())
+    return NULL;
+  std::map<std::string, std::string>::const_iterator I =
+    Contents.find(getKey(Path));
+  return I != Contents.end() ? &I->second : NULL;
+}
+
+void FileOverlay::mapInto(ClangTool &Tool) const {
+  for (std::map<std::string, std::string>::const_iterator
+         I = Contents.begin(), E = Contents.end(); I != E; ++I)
+    Tool.mapVirtualFile(I->first, I->second);
+}
+
+void FileOverlay::overrideIn(SourceManager &SM) const {
+  for (std::map<std::string, std::string>::const_iterator
+         I = Contents.begin(), E = Contents.end(); I != E; ++I) {
+    const FileEntry *Entry =
+      SM.getFileManager().getVirtualFile(I->first, I->second.size(), 0);
+    // a copy, as store() replaces the contents while SM is still alive
+    SM.overrideFileContents(Entry,
+      llvm::MemoryBuffer::getMemBufferCopy(I->second, I->first));
+  }
+}
+
+void FileOverlay::store(Rewriter &Rewrite) {
+  SourceManager &SM = Rewrite.getSourceMgr();
+  for (Rewriter::buffer_iterator I = Rewrite.buffer_begin(),
+                                 E = Rewrite.buffer_end();
+       I != E; ++I) {
+    std::string Text;
+    llvm::raw_string_ostream Stream(Text);
+    I->second.write(Stream);
+    Stream.flush();
+    store(SM.getFileEntryForID(I->first)->getName(),
+          SM.getBufferData(I->first), Text);
+  }
+}
+
+void FileOverlay::store(llvm::StringRef Path, llvm::StringRef Original,
+                        std::string &Rewritten) {
+  std::string Key = getKey(Path);
+  if (!Contents.count(Key))
+    Originals[Key] = Original;
+  Contents[Key].swap(Rewritten);
+  Rewritten.clear();
+}
+
+bool FileOverlay::save() const {
+  bool Result = true;
+  for (std::map<std::string, std::string>::const_iterator
+         I = Contents.begin(), E = Contents.end(); I != E; ++I) {
+    std::map<std::string, std::string>::const_iterator O =
+      Originals.find(I->first);
+    if (!saveFile(I->first, O != Originals.end() ? O->second : "", I->second))
+      Result = false;
+  }
+  return Result;
+}
+
+static const char * const CheckpointMagic = "refactorial-checkpoint";
+
+CheckpointLog::CheckpointLog()
+  : FD(-1), Worker(false), Handler(NULL), ReadOffset(0), Section(0) {}
+
+CheckpointLog::~CheckpointLog() {
+  if (FD != -1)
+    close(FD);
+}
+
+bool CheckpointLog::open(llvm::StringRef Path, uint64_t ConfigHash,
+                         bool Resume) {
+  this->Path = Path;
+  std::string Header = std::string(CheckpointMagic) + " " +
+    llvm::utohexstr(ConfigHash) + "\n";
+  ReadOffset = Header.size();
+
+  if (Resume) {
+    llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+    if (!llvm::MemoryBuffer::getFile(Path, Buffer) &&
+        Buffer->getBuffer().startswith(Header)) {
+      FD = ::open(this->Path.c_str(), O_WRONLY | O_APPEND);
+      if (FD == -1)
+        return false;
+      update();
+      // their timings were taken when the translation units completed
+      Timings.clear();
+      return true;
+    }
+    llvm::errs() << "Checkpoint: " << Path << " is missing or was written "
+                 << "for a different config; starting over\n";
+  }
+
+  FD = ::open(this->Path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+              0644);
+  return FD != -1 && append(Header);
+}
+
+void CheckpointLog::setStep(unsigned Section, llvm::StringRef Transform) {
+  this->Section = Section;
+  Step = Transform;
+}
+
+std::string CheckpointLog::getStepKey() const {
+  return llvm::utostr(Section) + "\t" + Step;
+}
+
+bool CheckpointLog::getCompleted(llvm::StringRef SourcePath,
+                                 Replacements &Result) const {
+  std::map<std::string, std::map<std::string, Replacements> >::const_iterator
+    S = Completed.find(getStepKey());
+  if (S == Completed.end())
+    return false;
+  std::map<std::string, Replacements>::const_iterator I =
+    S->second.find(SourcePath);
+  if (I == S->second.end())
+    return false;
+  Result.insert(Result.end(), I->second.begin(), I->second.end());
+  return true;
+}
+
+bool CheckpointLog::complete(llvm::StringRef SourcePath,
+                             Replacements::const_iterator Begin,
+                             Replacements::const_iterator End) {
+  std::string Key = getStepKey();
+  std::string Text;
+  for (Replacements::const_iterator I = Begin; I != End; ++I)
+    Text += "R\t" + Key + "\t" + I->serialize() + "\n";
+  // the state the translation unit produced is only taken over along with
+  // its replacements
+  Text += UnwrittenState;
+  UnwrittenState.clear();
+  Text += "T\t" + Key + "\t";
+  escape(SourcePath, Text);
+  Text += "\n";
+  return append(Text);
+}
+
+void CheckpointLog::fail(llvm::StringRef SourcePath, llvm::StringRef Reason) {
+  std::string Text = "F\t" + getStepKey() + "\t";
+  escape(SourcePath, Text);
+  Text += "\t";
+  escape(Reason, Text);
+  append(Text + "\n");
+
+  Failure F;
+  F.Section = Section;
+  F.Transform = Step;
+  F.SourcePath = SourcePath;
+  F.Reason = Reason;
+  Failures.push_back(F);
+}
+
+uint64_t CheckpointLog::getSize() const {
+  struct stat Stat;
+  return stat(Path.c_str(), &Stat) ? 0 : Stat.st_size;
+}
+
+void CheckpointLog::addTiming(llvm::StringRef SourcePath, double Parse,
+                              double Transform) {
+  if (!Worker || FD == -1)
+    return;
+  std::string Text;
+  llvm::raw_string_ostream Stream(Text);
+  Stream << "P\t" << getStepKey() << "\t" << llvm::format("%f", Parse)
+         << "\t" << llvm::format("%f", Transform) << "\t";
+  Stream.flush();
+  escape(SourcePath, Text);
+  append(Text + "\n");
+}
+
+void CheckpointLog::addState(llvm::StringRef Kind, llvm::StringRef Value) {
+  if (!Worker || FD == -1)
+    return;
+  // written by complete(), so that a worker dying on the translation unit
+  // leaves none of it behind
+  UnwrittenState += "S\t" + getStepKey() + "\t";
+  escape(Kind, UnwrittenState);
+  UnwrittenState += "\t";
+  escape(Value, UnwrittenState);
+  UnwrittenState += "\n";
+}
+
+std::vector<std::pair<std::string, std::pair<double, double> > >
+CheckpointLog::takeTimings() {
+  std::vector<std::pair<std::string, std::pair<double, double> > > Result;
+  Result.swap(Timings);
+  return Result;
+}
+
+void CheckpointLog::markApplied(unsigned Section) {
+  Applied.insert(Section);
+  append("A\t" + llvm::utostr(Section) + "\n");
+}
+
+bool CheckpointLog::isApplied(unsigned Section) const {
+  return Applied.count(Section);
+}
+
+/// \brief Writes all of Text to FD, which is opened with O_APPEND, so that
+/// other processes appending to the same file do not interleave with it.
+static bool writeAll(int FD, llvm::StringRef Text) {
+  const char *Data = Text.data();
+  size_t Size = Text.size();
+  while (Size) {
+    ssize_t Written = write(FD, Data, Size);
+    if (Written == -1) {
+      if (errno == EINTR)
+        continue;
       return false;
-    BackupStream << Rewrite.getSourceMgr().getBufferData(I->first);
-    BackupStream.flush();
-    I->second.write(FileStream);
-    FileStream.flush();
+    }
+    Data += Written;
+    Size -= Written;
   }
   return true;
 }
 
+bool CheckpointLog::append(llvm::StringRef Text) {
+  return writeAll(FD, Text);
+}
+
+void CheckpointLog::update() {
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  if (llvm::MemoryBuffer::getFile(Path, Buffer) ||
+      Buffer->getBufferSize() <= ReadOffset)
+    return;
+
+  // a line without its newline is still being written
+  llvm::StringRef Text = Buffer->getBuffer().substr(ReadOffset);
+  Text = Text.substr(0, Text.rfind('\n') + 1);
+  ReadOffset += Text.size();
+  while (!Text.empty()) {
+    std::pair<llvm::StringRef, llvm::StringRef> Line = Text.split('\n');
+    parse(Line.first);
+    Text = Line.second;
+  }
+}
+
+void CheckpointLog::parse(llvm::StringRef Line) {
+  std::pair<llvm::StringRef, llvm::StringRef> Type = Line.split('\t');
+  if (Type.first == "A") {
+    unsigned AppliedSection;
+    if (!Type.second.getAsInteger(10, AppliedSection))
+      Applied.insert(AppliedSection);
+    return;
+  }
+
+  std::pair<llvm::StringRef, llvm::StringRef> StepSection =
+    Type.second.split('\t');
+  std::pair<llvm::StringRef, llvm::StringRef> StepTransform =
+    StepSection.second.split('\t');
+  std::string Key = StepSection.first.str() + "\t" + StepTransform.first.str();
+  llvm::StringRef Rest = StepTransform.second;
+
+  if (Type.first == "R") {
+    Replacement R;
+    if (Replacement::deserialize(Rest, R))
+      Pending.push_back(R);
+  } else if (Type.first == "T") {
+    Completed[Key][unescape(Rest)].swap(Pending);
+    Pending.clear();
+    for (size_t I = 0, E = PendingState.size(); I != E; ++I)
+      if (Handler)
+        Handler(PendingState[I].first, PendingState[I].second);
+    PendingState.clear();
+  } else if (Type.first == "F") {
+    Pending.clear();
+    PendingState.clear();
+  } else if (Type.first == "S") {
+    std::pair<llvm::StringRef, llvm::StringRef> KindValue = Rest.split('\t');
+    PendingState.push_back(std::make_pair(unescape(KindValue.first),
+                                          unescape(KindValue.second)));
+  } else if (Type.first == "P") {
+    llvm::SmallVector<llvm::StringRef, 3> Fields;
+    Rest.split(Fields, "\t");
+    if (Fields.size() == 3)
+      Timings.push_back(std::make_pair(unescape(Fields[2]),
+        std::make_pair(strtod(Fields[0].str().c_str(), NULL),
+                       strtod(Fields[1].str().c_str(), NULL))));
+  }
+}
+
+static const char * const UndoMagic = "refactorial-undo\n";
+
+UndoLog::UndoLog() : FD(-1) {}
+
+UndoLog::~UndoLog() {
+  if (FD != -1)
+    close(FD);
+}
+
+bool UndoLog::open(llvm::StringRef Path, bool Append) {
+  std::string P = Path;
+  if (Append) {
+    llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+    if (!llvm::MemoryBuffer::getFile(Path, Buffer) &&
+        Buffer->getBuffer().startswith(UndoMagic)) {
+      FD = ::open(P.c_str(), O_WRONLY | O_APPEND);
+      return FD != -1;
+    }
+  }
+  // the previous run's log is kept until this run has something to log
+  this->Path = P;
+  return true;
+}
+
+bool UndoLog::record(llvm::StringRef Path, llvm::StringRef Original,
+                     llvm::StringRef Rewritten,
+                     Replacements::const_iterator Begin,
+                     Replacements::const_iterator End) {
+  // each replacement moves the ones after it by the difference in length
+  Replacements Reverse;
+  long Delta = 0;
+  for (Replacements::const_iterator I = Begin; I != End; ++I) {
+    Reverse.push_back(Replacement(Path, I->getOffset() + Delta,
+                                  I->getReplacementText().size(),
+                                  Original.substr(I->getOffset(),
+                                                  I->getLength())));
+    Delta += (long)I->getReplacementText().size() - (long)I->getLength();
+  }
+  return append(Path, Original, Rewritten, Reverse);
+}
+
+bool UndoLog::record(llvm::StringRef Path, llvm::StringRef Original,
+                     llvm::StringRef Rewritten) {
+  size_t Prefix = 0;
+  size_t Shorter = std::min(Original.size(), Rewritten.size());
+  while (Prefix < Shorter && Original[Prefix] == Rewritten[Prefix])
+    ++Prefix;
+  size_t Suffix = 0;
+  while (Suffix < Shorter - Prefix &&
+         Original[Original.size() - Suffix - 1] ==
+         Rewritten[Rewritten.size() - Suffix - 1])
+    ++Suffix;
+
+  Replacements Reverse;
+  Reverse.push_back(Replacement(Path, Prefix,
+                                Rewritten.size() - Prefix - Suffix,
+                                Original.slice(Prefix,
+                                               Original.size() - Suffix)));
+  return append(Path, Original, Rewritten, Reverse);
+}
+
+/// \brief Moves the earlier Edits of a file to where they are after the
+/// edits undone by Reverse, merging the edits that overlap or touch.
+///
+/// Both lists are compared in the coordinates of the file between the two
+/// steps, where an earlier edit covers the text it inserted and a new one
+/// the text it replaced. A run of edits overlapping there becomes a single
+/// edit, whose text is that of the file between the steps with the earlier
+/// edits undone: the text of the earlier edits, and between them the text
+/// the new edits replaced.
+static void mergeEdits(Replacements &Edits, const Replacements &Reverse) {
+  // where each new edit starts in the file between the steps
+  std::vector<unsigned> Between;
+  Between.reserve(Reverse.size());
+  long Delta = 0;
+  for (size_t R = 0, RE = Reverse.size(); R != RE; ++R) {
+    Between.push_back(Reverse[R].getOffset() - Delta);
+    Delta += (long)Reverse[R].getLength() -
+             (long)Reverse[R].getReplacementText().size();
+  }
+
+  Replacements Merged;
+  Merged.reserve(Edits.size() + Reverse.size());
+  size_t I = 0, IE = Edits.size(), R = 0, RE = Reverse.size();
+  long Shift = 0;
+  while (I != IE || R != RE) {
+    unsigned Start = R == RE || (I != IE && Edits[I].getOffset() < Between[R])
+      ? Edits[I].getOffset() : Between[R];
+    unsigned End = Start;
+    long Growth = 0;
+    size_t LastI = I, LastR = R;
+    while (true) {
+      if (LastI != IE && Edits[LastI].getOffset() <= End) {
+        End = std::max(End, Edits[LastI].getOffset() +
+                            Edits[LastI].getLength());
+        ++LastI;
+      } else if (LastR != RE && Between[LastR] <= End) {
+        const Replacement &New = Reverse[LastR];
+        End = std::max(End, Between[LastR] +
+                            (unsigned)New.getReplacementText().size());
+        Growth += (long)New.getLength() - (long)New.getReplacementText().size();
+        ++LastR;
+      } else {
+        break;
+      }
+    }
+
+    if (LastI == I + 1 && LastR == R) {
+      // an earlier edit no new one touches only moves
+      const Replacement &Old = Edits[I];
+      Merged.push_back(Replacement(Old.getFilePath(), Old.getOffset() + Shift,
+                                   Old.getLength(),
+                                   Old.getReplacementText()));
+    } else if (LastI == I) {
+      Merged.insert(Merged.end(), Reverse.begin() + R,
+                    Reverse.begin() + LastR);
+    } else {
+      std::string Text;
+      unsigned Position = Start;
+      size_t NextI = I, NextR = R;
+      while (true) {
+        if (NextI != LastI && Edits[NextI].getOffset() == Position) {
+          Text += Edits[NextI].getReplacementText();
+          Position += Edits[NextI].getLength();
+          ++NextI;
+          continue;
+        }
+        if (Position >= End)
+          break;
+        while (NextR != LastR &&
+               Between[NextR] + Reverse[NextR].getReplacementText().size() <=
+               Position)
+          ++NextR;
+        if (NextR == LastR || Between[NextR] > Position)
+          break;
+        llvm::StringRef Replaced = Reverse[NextR].getReplacementText();
+        unsigned Stop = std::min(Between[NextR] + (unsigned)Replaced.size(),
+                                 NextI != LastI ? Edits[NextI].getOffset()
+                                                : End);
+        Text += Replaced.substr(Position - Between[NextR], Stop - Position);
+        Position = Stop;
+      }
+      Merged.push_back(Replacement(Edits[I].getFilePath(), Start + Shift,
+                                   End - Start + Growth, Text));
+    }
+    Shift += Growth;
+    I = LastI;
+    R = LastR;
+  }
+  Edits.swap(Merged);
+}
+
+bool UndoLog::append(llvm::StringRef Path, llvm::StringRef Original,
+                     llvm::StringRef Rewritten, const Replacements &Reverse) {
+  std::string RealPath = getRealPath(Path);
+  mergeEdits(Edits[RealPath], Reverse);
+  if (FD == -1 && !this->Path.empty()) {
+    FD = ::open(this->Path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+                0644);
+    if (FD == -1)
+      return false;
+    if (!writeAll(FD, UndoMagic)) {
+      close(FD);
+      FD = -1;
+      return false;
+    }
+    this->Path.clear();
+  }
+  if (FD == -1)
+    return true;
+  // "F <hash before> <hash after> <path>", then one "E <offset> <length>
+  // <replaced text>" line per edit, in the coordinates of the edited file
+  std::string Text = "F\t" + llvm::utohexstr(hashString(Original)) + "\t" +
+    llvm::utohexstr(hashString(Rewritten)) + "\t";
+  escape(RealPath, Text);
+  Text += "\n";
+  for (Replacements::const_iterator I = Reverse.begin(), E = Reverse.end();
+       I != E; ++I) {
+    Text += "E\t" + llvm::utostr(I->getOffset()) + "\t" +
+      llvm::utostr(I->getLength()) + "\t";
+    escape(I->getReplacementText(), Text);
+    Text += "\n";
+  }
+  return writeAll(FD, Text);
+}
+
+bool UndoLog::isEdited(llvm::StringRef Path) const {
+  return Edits.count(getRealPath(Path));
+}
+
+namespace {
+/// \brief One file as rewritten by one section of a logged run.
+struct UndoRecord {
+  std::string Path;
+  uint64_t Before;
+  uint64_t After;
+  Replacements Reverse;
+};
+}
+
+bool UndoLog::undo(llvm::StringRef Path) {
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  if (llvm::MemoryBuffer::getFile(Path, Buffer) ||
+      !Buffer->getBuffer().startswith(UndoMagic)) {
+    llvm::errs() << "Undo: " << Path << " is not an undo log\n";
+    return false;
+  }
+
+  std::vector<UndoRecord> Records;
+  llvm::StringRef Text = Buffer->getBuffer().substr(strlen(UndoMagic));
+  while (!Text.empty()) {
+    std::pair<llvm::StringRef, llvm::StringRef> Line = Text.split('\n');
+    Text = Line.second;
+    llvm::SmallVector<llvm::StringRef, 4> Fields;
+    Line.first.split(Fields, "\t", 3);
+    bool Valid = Fields.size() == 4;
+    if (Valid && Fields[0] == "F") {
+      Records.push_back(UndoRecord());
+      UndoRecord &R = Records.back();
+      R.Path = unescape(Fields[3]);
+      Valid = !Fields[1].getAsInteger(16, R.Before) &&
+              !Fields[2].getAsInteger(16, R.After);
+    } else if (Valid && Fields[0] == "E" && !Records.empty()) {
+      unsigned Offset, Length;
+      Valid = !Fields[1].getAsInteger(10, Offset) &&
+              !Fields[2].getAsInteger(10, Length);
+      Records.back().Reverse.push_back(
+        Replacement(Records.back().Path, Offset, Length, unescape(Fields[3])));
+    } else {
+      Valid = false;
+    }
+    if (!Valid) {
+      llvm::errs() << "Undo: " << Path << " is damaged; nothing restored\n";
+      return false;
+    }
+  }
+
+  // the records of a file are undone newest first, each on the contents the
+  // one after it restored; everything is checked before any file is written
+  std::map<std::string, std::string> Restored;
+  bool Stale = false;
+  for (std::vector<UndoRecord>::reverse_iterator I = Records.rbegin(),
+                                                 E = Records.rend();
+       I != E; ++I) {
+    std::map<std::string, std::string>::iterator Contents =
+      Restored.find(I->Path);
+    if (Contents == Restored.end()) {
+      llvm::OwningPtr<llvm::MemoryBuffer> File;
+      if (llvm::MemoryBuffer::getFile(I->Path, File)) {
+        llvm::errs() << "Undo: cannot read " << I->Path << "\n";
+        Stale = true;
+        continue;
+      }
+      Contents = Restored.insert(
+        std::make_pair(I->Path, File->getBuffer().str())).first;
+    }
+
+    std::string Result;
+    if (hashString(Contents->second) != I->After) {
+      llvm::errs() << "Undo: " << I->Path << " was changed after " << Path
+                   << " was written\n";
+      Stale = true;
+    } else if (!applySortedReplacements(Contents->second, I->Reverse.begin(),
+                                        I->Reverse.end(), Result) ||
+               hashString(Result) != I->Before) {
+      llvm::errs() << "Undo: " << Path << " does not restore " << I->Path
+                   << "\n";
+      Stale = true;
+    } else {
+      Contents->second.swap(Result);
+    }
+  }
+  if (Stale) {
+    llvm::errs() << "Undo: " << Path << " is stale; nothing restored\n";
+    return false;
+  }
+
+  bool Saved = true;
+  for (std::map<std::string, std::string>::const_iterator
+         I = Restored.begin(), E = Restored.end(); I != E; ++I) {
+    std::string ErrorInfo;
+    llvm::raw_fd_ostream FileStream(I->first.c_str(), ErrorInfo,
+                                    llvm::raw_fd_ostream::F_Binary);
+    if (!ErrorInfo.empty()) {
+      llvm::errs() << "Undo: could not write " << I->first << "\n";
+      Saved = false;
+      continue;
+    }
+    FileStream << I->second;
+  }
+  llvm::errs() << "Undo: restored " << Restored.size() << " files from "
+               << Records.size() << " records\n";
+  return Saved;
+}
+
 RefactoringTool::RefactoringTool(const CompilationDatabase &Compilations,
                                  ArrayRef<std::string> SourcePaths)
-  : Tool(Compilations, SourcePaths) {}
+  : Compilations(Compilations),
+    SourcePaths(SourcePaths.begin(), SourcePaths.end()), Overlay(NULL),
+    Checkpoint(NULL), TimeBudget(0), MemoryBudget(0), Undo(NULL) {}
 
 Replacements &RefactoringTool::getReplacements() { return Replace; }
 
+void RefactoringTool::setOverlay(FileOverlay *Overlay) {
+  this->Overlay = Overlay;
+}
+
 int RefactoringTool::run(FrontendActionFactory *ActionFactory) {
-  int Result = Tool.run(ActionFactory);
+  return run(ActionFactory, SourcePaths);
+}
+
+void RefactoringTool::setIncludes(llvm::StringRef SourcePath,
+                                  const std::vector<std::string> &Files) {
+  Includes[SourcePath.str()] = Files;
+}
+
+std::vector<std::string>
+RefactoringTool::schedule(ArrayRef<std::string> SourcePaths) const {
+  unsigned N = SourcePaths.size();
+  if ((Includes.empty() && Costs.empty()) || N < 2)
+    return SourcePaths.vec();
+
+  // The translation units including each file, and the files of each
+  // translation unit, by file id.
+  llvm::StringMap<unsigned> FileIds;
+  std::vector<std::vector<unsigned> > FileUnits;
+  std::vector<std::vector<unsigned> > UnitFiles(N);
+  for (unsigned U = 0; U != N; ++U) {
+    std::map<std::string, std::vector<std::string> >::const_iterator I =
+      Includes.find(SourcePaths[U]);
+    if (I == Includes.end())
+      continue;
+    for (std::vector<std::string>::const_iterator F = I->second.begin(),
+                                                  FE = I->second.end();
+         F != FE; ++F) {
+      unsigned Id = FileIds.GetOrCreateValue(*F, FileUnits.size()).getValue();
+      if (Id == FileUnits.size())
+        FileUnits.push_back(std::vector<unsigned>());
+      FileUnits[Id].push_back(U);
+      UnitFiles[U].push_back(Id);
+    }
+  }
+
+  // Greedily follow each translation unit with the unvisited one that
+  // shares most of its files. Files included by most translation units stay
+  // warm in any order and are not counted. A translation unit sharing
+  // nothing with the previous one starts a new group.
+  std::vector<std::vector<unsigned> > Groups;
+  unsigned Visits = 0;
+  std::vector<bool> Visited(N, false);
+  std::vector<unsigned> Shared(N, 0);
+  std::vector<unsigned> Touched;
+  unsigned Current = N, Next = 0;
+  while (Visits != N) {
+    unsigned Best = N;
+    if (Current != N) {
+      for (std::vector<unsigned>::const_iterator F = UnitFiles[Current].begin(),
+                                                 FE = UnitFiles[Current].end();
+           F != FE; ++F) {
+        const std::vector<unsigned> &Units = FileUnits[*F];
+        if (Units.size() * 2 > N)
+          continue;
+        for (std::vector<unsigned>::const_iterator U = Units.begin(),
+                                                   UE = Units.end();
+             U != UE; ++U) {
+          if (!Visited[*U] && !Shared[*U]++)
+            Touched.push_back(*U);
+        }
+      }
+      for (std::vector<unsigned>::const_iterator U = Touched.begin(),
+                                                 UE = Touched.end();
+           U != UE; ++U) {
+        if (Best == N || Shared[*U] > Shared[Best] ||
+            (Shared[*U] == Shared[Best] && *U < Best))
+          Best = *U;
+      }
+      for (std::vector<unsigned>::const_iterator U = Touched.begin(),
+                                                 UE = Touched.end();
+           U != UE; ++U)
+        Shared[*U] = 0;
+      Touched.clear();
+    }
+    if (Best == N) {
+      while (Visited[Next])
+        ++Next;
+      Best = Next;
+      Groups.push_back(std::vector<unsigned>());
+    }
+    Visited[Best] = true;
+    Visits++;
+    Groups.back().push_back(Best);
+    Current = Best;
+  }
+
+  // The most expensive groups go first, so that a giant translation unit
+  // does not turn up at the very end of the run. Translation units without
+  // a recorded cost are assumed to be average.
+  std::vector<std::pair<double, unsigned> > GroupCosts;
+  double Known = 0;
+  unsigned KnownCount = 0;
+  for (std::map<std::string, double>::const_iterator I = Costs.begin(),
+                                                     E = Costs.end();
+       I != E; ++I) {
+    Known += I->second;
+    KnownCount++;
+  }
+  double Average = KnownCount ? Known / KnownCount : 0;
+  for (unsigned G = 0, GE = Groups.size(); G != GE; ++G) {
+    double Cost = 0;
+    for (std::vector<unsigned>::const_iterator U = Groups[G].begin(),
+                                               UE = Groups[G].end();
+         U != UE; ++U) {
+      std::map<std::string, double>::const_iterator C =
+        Costs.find(SourcePaths[*U]);
+      Cost += C != Costs.end() ? C->second : Average;
+    }
+    // negated, so that a stable sort keeps the order of equal groups
+    GroupCosts.push_back(std::make_pair(-Cost, G));
+  }
+  std::stable_sort(GroupCosts.begin(), GroupCosts.end());
+
+  std::vector<std::string> Result;
+  for (std::vector<std::pair<double, unsigned> >::const_iterator
+         G = GroupCosts.begin(), GE = GroupCosts.end(); G != GE; ++G) {
+    const std::vector<unsigned> &Group = Groups[G->second];
+    for (std::vector<unsigned>::const_iterator U = Group.begin(),
+                                               UE = Group.end();
+         U != UE; ++U)
+      Result.push_back(SourcePaths[*U]);
+  }
+  return Result;
+}
+
+void RefactoringTool::setCost(llvm::StringRef SourcePath, double Seconds) {
+  Costs[SourcePath.str()] = Seconds;
+}
+
+void RefactoringTool::clearCosts() { Costs.clear(); }
+
+void RefactoringTool::setCheckpoint(CheckpointLog *Checkpoint) {
+  this->Checkpoint = Checkpoint;
+}
+
+void RefactoringTool::setBudgets(double Seconds, uint64_t Bytes) {
+  TimeBudget = Seconds;
+  MemoryBudget = Bytes;
+}
+
+void RefactoringTool::setUndoLog(UndoLog *Undo) {
+  this->Undo = Undo;
+}
+
+static double getTime() {
+  struct timeval TV;
+  gettimeofday(&TV, NULL);
+  return TV.tv_sec + TV.tv_usec / 1e6;
+}
+
+/// \brief Returns the resident set size of a process in bytes, or 0 if it
+/// cannot be read.
+static uint64_t getResidentBytes(pid_t Pid) {
+  std::string Path = "/proc/" + llvm::utostr(Pid) + "/statm";
+  FILE *File = fopen(Path.c_str(), "r");
+  if (!File)
+    return 0;
+  unsigned long Size = 0, Resident = 0;
+  int Fields = fscanf(File, "%lu %lu", &Size, &Resident);
+  fclose(File);
+  return Fields == 2 ? (uint64_t)Resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+std::string RefactoringTool::watchWorker(int Pid, int &Status) {
+  if (!TimeBudget && !MemoryBudget) {
+    while (waitpid(Pid, &Status, 0) == -1 && errno == EINTR)
+      ;
+    return std::string();
+  }
+
+  // Each translation unit the worker completes grows the log, which starts
+  // the clock for the next one. Memory is measured the same way, from what
+  // the worker held then, so the budget applies to each translation unit
+  // rather than to all those the worker went through.
+  uint64_t LogSize = Checkpoint->getSize();
+  double Started = getTime();
+  uint64_t Baseline = MemoryBudget ? getResidentBytes(Pid) : 0;
+  while (true) {
+    pid_t Exited = waitpid(Pid, &Status, WNOHANG);
+    if (Exited == Pid || (Exited == -1 && errno != EINTR))
+      return std::string();
+    usleep(50000);
+
+    uint64_t Size = Checkpoint->getSize();
+    if (Size != LogSize) {
+      LogSize = Size;
+      Started = getTime();
+      if (MemoryBudget)
+        Baseline = getResidentBytes(Pid);
+    }
+
+    uint64_t Resident = MemoryBudget ? getResidentBytes(Pid) : 0;
+
+    std::string Reason;
+    llvm::raw_string_ostream Stream(Reason);
+    if (TimeBudget && getTime() - Started > TimeBudget)
+      Stream << "over the time budget of " << llvm::format("%g", TimeBudget)
+             << " s";
+    else if (MemoryBudget && Resident > Baseline &&
+             Resident - Baseline > MemoryBudget)
+      Stream << "over the memory budget of " << (MemoryBudget >> 20)
+             << " MB";
+    Stream.flush();
+    if (!Reason.empty()) {
+      kill(Pid, SIGKILL);
+      while (waitpid(Pid, &Status, 0) == -1 && errno == EINTR)
+        ;
+      return Reason;
+    }
+  }
+}
+
+int RefactoringTool::run(FrontendActionFactory *ActionFactory,
+                         ArrayRef<std::string> SourcePaths) {
+  if (SourcePaths.empty())
+    return 0;
+  if (Checkpoint)
+    return runInWorkers(ActionFactory, schedule(SourcePaths));
+  ClangTool Tool(Compilations, schedule(SourcePaths));
+  if (Overlay)
+    Overlay->mapInto(Tool);
+  return Tool.run(ActionFactory);
+}
+
+int RefactoringTool::runInWorkers(FrontendActionFactory *ActionFactory,
+                                  const std::vector<std::string> &SourcePaths) {
+  std::vector<std::string> Pending;
+  for (std::vector<std::string>::const_iterator I = SourcePaths.begin(),
+                                                E = SourcePaths.end();
+       I != E; ++I) {
+    if (!Checkpoint->getCompleted(*I, Replace))
+      Pending.push_back(*I);
+  }
+  if (Pending.size() != SourcePaths.size())
+    llvm::errs() << "Checkpoint: " << SourcePaths.size() - Pending.size()
+                 << " of " << SourcePaths.size()
+                 << " translation units completed by an earlier run\n";
+
+  // A worker takes the translation units in order and records each one as
+  // it completes, so the first one missing from the log after the worker
+  // exits is the one it died on.
+  int Result = 0;
+  size_t Next = 0;
+  while (Next < Pending.size()) {
+    pid_t Pid = fork();
+    if (Pid == -1) {
+      llvm::errs() << "Could not start a worker process\n";
+      return 1;
+    }
+    if (Pid == 0) {
+      runWorker(ActionFactory, Pending, Next);
+      _exit(0);
+    }
+
+    int Status = 0;
+    std::string Reason = watchWorker(Pid, Status);
+    Checkpoint->update();
+    while (Next < Pending.size() &&
+           Checkpoint->getCompleted(Pending[Next], Replace))
+      ++Next;
+    if (Next == Pending.size())
+      break;
+
+    if (Reason.empty())
+      Reason = WIFSIGNALED(Status)
+        ? "signal " + llvm::utostr(WTERMSIG(Status))
+        : "exit status " + llvm::utostr(WEXITSTATUS(Status));
+    llvm::errs() << "Worker failed on " << Pending[Next] << " (" << Reason
+                 << "); skipping it\n";
+    Checkpoint->fail(Pending[Next], Reason);
+    Result = 1;
+    ++Next;
+  }
+  return Result;
+}
+
+void RefactoringTool::runWorker(FrontendActionFactory *ActionFactory,
+                                const std::vector<std::string> &SourcePaths,
+                                size_t Next) {
+  Checkpoint->setWorker(true);
+  for (size_t I = Next, E = SourcePaths.size(); I != E; ++I) {
+    size_t Before = Replace.size();
+    // one tool per translation unit, so that each one is completed on its
+    // own; the file cache still shares the headers between them
+    ClangTool Tool(Compilations, SourcePaths[I]);
+    if (Overlay)
+      Overlay->mapInto(Tool);
+    Tool.run(ActionFactory);
+    if (!Checkpoint->complete(SourcePaths[I], Replace.begin() + Before,
+                              Replace.end())) {
+      llvm::errs() << "Could not write the checkpoint log\n";
+      _exit(1);
+    }
+  }
+}
+
+namespace {
+/// \brief Appends the errors of a translation unit to a log, as
+/// "E <source path> <file> <offset> <line> <column> <message>" records.
+class ErrorRecorder : public DiagnosticConsumer {
+public:
+  ErrorRecorder(int FD, llvm::StringRef SourcePath)
+    : FD(FD), SourcePath(SourcePath) {}
+
+  virtual void HandleDiagnostic(DiagnosticsEngine::Level Level,
+                                const Diagnostic &Info) {
+    DiagnosticConsumer::HandleDiagnostic(Level, Info);
+    if (Level < DiagnosticsEngine::Error)
+      return;
+
+    std::string Path;
+    unsigned Offset = 0, Line = 0, Column = 0;
+    if (Info.getLocation().isValid() && Info.hasSourceManager()) {
+      SourceManager &SM = Info.getSourceManager();
+      std::pair<FileID, unsigned> Location =
+        SM.getDecomposedLoc(SM.getFileLoc(Info.getLocation()));
+      if (const FileEntry *Entry = SM.getFileEntryForID(Location.first)) {
+        Path = getRealPath(Entry->getName());
+        Offset = Location.second;
+        Line = SM.getLineNumber(Location.first, Offset);
+        Column = SM.getColumnNumber(Location.first, Offset);
+      }
+    }
+    llvm::SmallString<256> Message;
+    Info.FormatDiagnostic(Message);
+
+    std::string Text = "E\t";
+    escape(SourcePath, Text);
+    Text += "\t";
+    escape(Path, Text);
+    Text += "\t" + llvm::utostr(Offset) + "\t" + llvm::utostr(Line) + "\t" +
+      llvm::utostr(Column) + "\t";
+    escape(Message.str(), Text);
+    writeAll(FD, Text + "\n");
+  }
+
+  virtual DiagnosticConsumer *clone(DiagnosticsEngine &Diags) const {
+    return new ErrorRecorder(FD, SourcePath);
+  }
+
+private:
+  int FD;
+  std::string SourcePath;
+};
+
+/// \brief Checks the syntax of a translation unit, recording its errors and
+/// then a "T <source path>" record once it was checked.
+class VerifyAction : public SyntaxOnlyAction {
+public:
+  VerifyAction(int FD, llvm::StringRef BuiltinIncludes)
+    : FD(FD), BuiltinIncludes(BuiltinIncludes) {}
+
+protected:
+  virtual bool BeginInvocation(CompilerInstance &CI) {
+    if (!BuiltinIncludes.empty())
+      CI.getHeaderSearchOpts().AddPath(BuiltinIncludes, frontend::System,
+                                       false, false, false);
+    if (CI.hasFileManager())
+      FileCache::get().attach(CI.getFileManager());
+    return true;
+  }
+
+  virtual bool BeginSourceFileAction(CompilerInstance &CI,
+                                     llvm::StringRef Filename) {
+    FileCache::get().overrideOnDemand(CI);
+    CI.getDiagnostics().setClient(new ErrorRecorder(FD, Filename), true);
+    return SyntaxOnlyAction::BeginSourceFileAction(CI, Filename);
+  }
+
+  virtual void EndSourceFileAction() {
+    FileCache::get().collect(getCompilerInstance().getSourceManager());
+    std::string Text = "T\t";
+    escape(getCurrentFile(), Text);
+    writeAll(FD, Text + "\n");
+  }
+
+private:
+  int FD;
+  std::string BuiltinIncludes;
+};
+
+class VerifyActionFactory : public FrontendActionFactory {
+public:
+  VerifyActionFactory(int FD, llvm::StringRef BuiltinIncludes)
+    : FD(FD), BuiltinIncludes(BuiltinIncludes) {}
+
+  virtual FrontendAction *create() {
+    return new VerifyAction(FD, BuiltinIncludes);
+  }
+
+private:
+  int FD;
+  std::string BuiltinIncludes;
+};
+
+/// \brief An error found by verify().
+struct VerifyError {
+  std::string Path;
+  unsigned Offset;
+  unsigned Line;
+  unsigned Column;
+  std::string Message;
+};
+}
+
+/// \brief The edit an error at Offset most likely comes from: the one it
+/// lies in, or else the nearest one on the same line of Contents.
+static const Replacement *findEditAt(const Replacements &Edits,
+                                     llvm::StringRef Contents,
+                                     unsigned Offset) {
+  const Replacement *Nearest = NULL;
+  unsigned Distance = 0;
+  for (Replacements::const_iterator I = Edits.begin(), E = Edits.end();
+       I != E; ++I) {
+    unsigned Start = I->getOffset(), End = Start + I->getLength();
+    if (Start <= Offset && Offset <= End)
+      return &*I;
+    unsigned From = std::min(Offset, End), To = std::max(Offset, Start);
+    if (To > Contents.size() ||
+        Contents.slice(From, To).find('\n') != llvm::StringRef::npos)
+      continue;
+    if (Nearest == NULL || To - From < Distance) {
+      Nearest = &*I;
+      Distance = To - From;
+    }
+  }
+  return Nearest;
+}
+
+static void getLineAndColumn(llvm::StringRef Contents, unsigned Offset,
+                             unsigned &Line, unsigned &Column) {
+  llvm::StringRef Before = Contents.substr(0, Offset);
+  Line = Before.count('\n') + 1;
+  size_t LineStart = Before.rfind('\n');
+  Column = LineStart == llvm::StringRef::npos ? Offset + 1
+                                              : Offset - LineStart;
+}
+
+static bool isIdentifier(llvm::StringRef S) {
+  if (S.empty() || isdigit((unsigned char)S[0]))
+    return false;
+  for (llvm::StringRef::iterator I = S.begin(), E = S.end(); I != E; ++I)
+    if (!isalnum((unsigned char)*I) && *I != '_')
+      return false;
+  return true;
+}
+
+/// \brief Reports where a name that was replaced by another one is still
+/// spelled in Files: a reference in a preprocessor branch that was skipped
+/// is invisible to the parse, and so to the rename. Returns the number of
+/// places found.
+static unsigned reportLeftoverNames(
+    const std::map<std::string, Replacements> &Edits,
+    std::map<std::string, std::string> &Contents,
+    const std::set<std::string> &Files) {
+  std::vector<std::string> OldNames, NewNames;
+  std::set<std::string> Seen;
+  for (std::map<std::string, Replacements>::const_iterator
+         I = Edits.begin(), E = Edits.end(); I != E; ++I)
+    for (Replacements::const_iterator R = I->second.begin(),
+                                      RE = I->second.end();
+         R != RE; ++R) {
+      llvm::StringRef Old = R->getReplacementText();
+      llvm::StringRef New = llvm::StringRef(Contents[I->first]).substr(
+        R->getOffset(), R->getLength());
+      if (Old != New && isIdentifier(Old) && isIdentifier(New) &&
+          Seen.insert(Old).second) {
+        OldNames.push_back(Old);
+        NewNames.push_back(New);
+      }
+    }
+  if (OldNames.empty())
+    return 0;
+
+  const unsigned MaxReported = 20;
+  unsigned Found = 0;
+  IdentifierScanner Scanner(OldNames, IdentifierScanner::WholeIdentifier);
+  for (std::set<std::string>::const_iterator I = Files.begin(),
+                                             E = Files.end();
+       I != E; ++I) {
+    std::map<std::string, std::string>::iterator File = Contents.find(*I);
+    if (File == Contents.end()) {
+      llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+      if (llvm::MemoryBuffer::getFile(*I, Buffer))
+        continue;
+      File = Contents.insert(
+        std::make_pair(*I, Buffer->getBuffer().str())).first;
+    }
+    const char *Begin = File->second.data();
+    const char *End = Begin + File->second.size();
+    unsigned Literal;
+    for (const char *P = Scanner.findFirst(Begin, Begin, End, &Literal);
+         P != End;
+         P = Scanner.findFirst(Begin, P + OldNames[Literal].size(), End,
+                               &Literal)) {
+      if (++Found > MaxReported)
+        continue;
+      unsigned Line, Column;
+      getLineAndColumn(File->second, P - Begin, Line, Column);
+      llvm::errs() << "Verify: " << *I << ":" << Line << ":" << Column
+                   << ": note: '" << OldNames[Literal] << "' is still "
+                   << "spelled here; it was replaced with '"
+                   << NewNames[Literal] << "' elsewhere\n";
+    }
+  }
+  if (Found > MaxReported)
+    llvm::errs() << "Verify: ... and " << Found - MaxReported
+                 << " more places that spell a replaced name\n";
+  return Found;
+}
+
+/// \brief Checks the syntax of Paths in up to Jobs worker processes, with
+/// the files of Mapped given the contents they map to, and collects the
+/// translation units that were checked and their errors.
+static bool checkSyntax(const CompilationDatabase &Compilations,
+                        const std::vector<std::string> &Paths,
+                        const std::map<std::string, std::string> &Mapped,
+                        llvm::StringRef BuiltinIncludes, unsigned Jobs,
+                        std::set<std::string> &Checked,
+                        std::map<std::string, std::vector<VerifyError> >
+                          &Errors) {
+  char TempPath[] = "/tmp/refactorial-verify.XXXXXX";
+  int FD = mkstemp(TempPath);
+  if (FD == -1 || fcntl(FD, F_SETFL, O_APPEND) == -1) {
+    llvm::errs() << "Verify: could not create a temporary file\n";
+    return false;
+  }
+
+  // each worker checks a run of translation units that share headers
+  Jobs = std::max(1u, std::min(Jobs, (unsigned)Paths.size()));
+  std::vector<pid_t> Workers;
+  for (unsigned J = 0; J != Jobs; ++J) {
+    pid_t Pid = fork();
+    if (Pid == -1) {
+      llvm::errs() << "Could not start a worker process\n";
+      break;
+    }
+    if (Pid == 0) {
+      std::vector<std::string> Mine(Paths.begin() + Paths.size() * J / Jobs,
+                                    Paths.begin() +
+                                    Paths.size() * (J + 1) / Jobs);
+      ClangTool Tool(Compilations, Mine);
+      for (std::map<std::string, std::string>::const_iterator
+             I = Mapped.begin(), E = Mapped.end(); I != E; ++I)
+        Tool.mapVirtualFile(I->first, I->second);
+      VerifyActionFactory Factory(FD, BuiltinIncludes);
+      Tool.run(&Factory);
+      _exit(0);
+    }
+    Workers.push_back(Pid);
+  }
+  for (size_t I = 0, E = Workers.size(); I != E; ++I) {
+    int Status;
+    while (waitpid(Workers[I], &Status, 0) == -1 && errno == EINTR)
+      ;
+  }
+
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  bool Read = !llvm::MemoryBuffer::getFile(TempPath, Buffer);
+  close(FD);
+  unlink(TempPath);
+  if (!Read)
+    return false;
+
+  llvm::StringRef Text = Buffer->getBuffer();
+  while (!Text.empty()) {
+    std::pair<llvm::StringRef, llvm::StringRef> Line = Text.split('\n');
+    Text = Line.second;
+    llvm::SmallVector<llvm::StringRef, 7> Fields;
+    Line.first.split(Fields, "\t", 6);
+    if (Fields.size() == 2 && Fields[0] == "T") {
+      Checked.insert(unescape(Fields[1]));
+    } else if (Fields.size() == 7 && Fields[0] == "E") {
+      VerifyError Error;
+      Error.Path = unescape(Fields[2]);
+      if (Fields[3].getAsInteger(10, Error.Offset) ||
+          Fields[4].getAsInteger(10, Error.Line) ||
+          Fields[5].getAsInteger(10, Error.Column))
+        continue;
+      Error.Message = unescape(Fields[6]);
+      Errors[unescape(Fields[1])].push_back(Error);
+    }
+  }
+  return true;
+}
+
+bool RefactoringTool::verify(const std::map<std::string, Replacements> &Edits,
+                             const std::set<std::string> &Parsed,
+                             const std::set<std::string> &Baseline,
+                             llvm::StringRef BuiltinIncludes, unsigned Jobs) {
+  std::vector<std::string> Paths = schedule(SourcePaths);
+
+  // A translation unit this run did not parse, e.g. one no transform needed
+  // or whose worker crashed, is parsed with the edits undone first, to learn
+  // whether it had errors before.
+  std::set<std::string> HadErrors(Baseline);
+  std::vector<std::string> Unparsed;
+  for (std::vector<std::string>::const_iterator I = Paths.begin(),
+                                                E = Paths.end();
+       I != E; ++I) {
+    if (!Parsed.count(*I))
+      Unparsed.push_back(*I);
+  }
+  if (!Unparsed.empty()) {
+    std::map<std::string, std::string> Originals;
+    for (std::map<std::string, Replacements>::const_iterator
+           I = Edits.begin(), E = Edits.end(); I != E; ++I) {
+      llvm::OwningPtr<llvm::MemoryBuffer> File;
+      std::string Original;
+      if (!llvm::MemoryBuffer::getFile(I->first, File) &&
+          applySortedReplacements(File->getBuffer(), I->second.begin(),
+                                  I->second.end(), Original))
+        Originals[I->first].swap(Original);
+    }
+    std::set<std::string> BaselineChecked;
+    std::map<std::string, std::vector<VerifyError> > BaselineErrors;
+    llvm::errs() << "Verify: parsing " << Unparsed.size()
+                 << " translation units as they were before the rewrite\n";
+    if (checkSyntax(Compilations, Unparsed, Originals, BuiltinIncludes, Jobs,
+                    BaselineChecked, BaselineErrors)) {
+      for (std::map<std::string, std::vector<VerifyError> >::const_iterator
+             I = BaselineErrors.begin(), E = BaselineErrors.end();
+           I != E; ++I)
+        HadErrors.insert(I->first);
+    }
+  }
+
+  std::set<std::string> Checked;
+  std::map<std::string, std::vector<VerifyError> > Errors;
+  if (!checkSyntax(Compilations, Paths, std::map<std::string, std::string>(),
+                   BuiltinIncludes, Jobs, Checked, Errors))
+    return false;
+
+  // the contents of the edited files, and who replaced what, by the text
+  // that was replaced
+  std::map<std::string, std::string> Contents;
+  for (std::map<std::string, Replacements>::const_iterator
+         I = Edits.begin(), E = Edits.end(); I != E; ++I) {
+    llvm::OwningPtr<llvm::MemoryBuffer> File;
+    if (!llvm::MemoryBuffer::getFile(I->first, File))
+      Contents[I->first] = File->getBuffer().str();
+  }
+  std::map<std::string, std::pair<std::string, const Replacement *> > Replaced;
+  for (std::map<std::string, Replacements>::const_iterator
+         I = Edits.begin(), E = Edits.end(); I != E; ++I)
+    for (Replacements::const_iterator R = I->second.begin(),
+                                      RE = I->second.end();
+         R != RE; ++R)
+      Replaced.insert(std::make_pair(R->getReplacementText().str(),
+                                     std::make_pair(I->first, &*R)));
+
+  // an error in a header is reported once, for the first translation unit
+  std::set<std::string> Reported;
+  unsigned NewErrors = 0, OldErrors = 0, Unchecked = 0;
+  for (std::vector<std::string>::const_iterator I = Paths.begin(),
+                                                E = Paths.end();
+       I != E; ++I) {
+    if (!Checked.count(*I)) {
+      llvm::errs() << "Verify: " << *I << " could not be checked\n";
+      ++Unchecked;
+      continue;
+    }
+    const std::vector<VerifyError> &TUErrors = Errors[*I];
+    for (std::vector<VerifyError>::const_iterator V = TUErrors.begin(),
+                                                  VE = TUErrors.end();
+         V != VE; ++V) {
+      std::string Key = V->Path + "\t" + llvm::utostr(V->Offset) + "\t" +
+        V->Message;
+      if (!Reported.insert(Key).second)
+        continue;
+
+      const Replacement *At = NULL;
+      std::map<std::string, Replacements>::const_iterator FileEdits =
+        Edits.find(V->Path);
+      if (FileEdits != Edits.end())
+        At = findEditAt(FileEdits->second, Contents[V->Path], V->Offset);
+      if (HadErrors.count(*I) && At == NULL) {
+        ++OldErrors;
+        continue;
+      }
+
+      ++NewErrors;
+      llvm::errs() << "Verify: " << (V->Path.empty() ? *I : V->Path) << ":"
+                   << V->Line << ":" << V->Column << ": error: "
+                   << V->Message << "\n";
+      if (At != NULL) {
+        llvm::errs() << "Verify:   at the replacement of '"
+                     << At->getReplacementText() << "' with '"
+                     << llvm::StringRef(Contents[V->Path]).substr(
+                          At->getOffset(), At->getLength())
+                     << "'\n";
+        continue;
+      }
+
+      // a reference the rewrite missed names what the declaration was
+      // renamed from
+      llvm::StringRef Message = V->Message;
+      for (size_t Quote = Message.find('\''); Quote != llvm::StringRef::npos;
+           Quote = Message.find('\'', Quote + 1)) {
+        size_t Close = Message.find('\'', Quote + 1);
+        if (Close == llvm::StringRef::npos)
+          break;
+        std::map<std::string,
+                 std::pair<std::string, const Replacement *> >::const_iterator
+          R = Replaced.find(Message.slice(Quote + 1, Close).str());
+        if (R != Replaced.end()) {
+          const std::string &File = Contents[R->second.first];
+          unsigned Line, Column;
+          getLineAndColumn(File, R->second.second->getOffset(), Line, Column);
+          llvm::errs() << "Verify:   '" << R->first << "' was replaced with '"
+                       << llvm::StringRef(File).substr(
+                            R->second.second->getOffset(),
+                            R->second.second->getLength())
+                       << "' at " << R->second.first << ":" << Line << ":"
+                       << Column << "\n";
+          break;
+        }
+        Quote = Close;
+      }
+    }
+  }
+
+  // the parse only sees the active preprocessor branches
+  std::set<std::string> Scanned;
+  for (std::map<std::string, Replacements>::const_iterator
+         I = Edits.begin(), E = Edits.end(); I != E; ++I)
+    Scanned.insert(I->first);
+  for (std::vector<std::string>::const_iterator I = Paths.begin(),
+                                                E = Paths.end();
+       I != E; ++I)
+    Scanned.insert(getRealPath(*I));
+  reportLeftoverNames(Edits, Contents, Scanned);
+
+  llvm::errs() << "Verify: checked " << Checked.size() << " of "
+               << Paths.size() << " translation units, " << NewErrors
+               << " errors";
+  if (OldErrors)
+    llvm::errs() << " (and " << OldErrors << " away from any edit in "
+                 << "translation units that had errors before)";
+  llvm::errs() << "\n";
+  return NewErrors == 0 && Unchecked == 0;
+}
+
+int RefactoringTool::applyReplacements() {
   LangOptions DefaultLangOptions;
 
   DiagnosticOptions *DefaultDiagnosticOptions = new DiagnosticOptions;
@@ -190,14 +1799,101 @@ int RefactoringTool::run(FrontendActionFactory *ActionFactory) {
                                 DefaultDiagnosticOptions, 
                                 DiagnosticPrinter);
 
-  SourceManager Sources(Diagnostics, Tool.getFiles());
+  FileManager Files((FileSystemOptions()));
+  SourceManager Sources(Diagnostics, Files);
   Rewriter Rewrite(Sources, DefaultLangOptions);
-  if (!applyAllReplacements(Replace, Rewrite)) {
+  if (Overlay)
+    Overlay->overrideIn(Sources);
+  int Result = 0;
+  resolveFilePaths(Replace);
+  bool Skipped = !removeStaleReplacements(Replace, Sources);
+  removeDuplicateReplacements(Replace);
+
+  // A file whose replacements do not overlap is rewritten in a single pass;
+  // the others go through the Rewriter, which maps every offset through its
+  // delta tree.
+  Replacements Overlapping;
+  RewrittenFiles.clear();
+  size_t Applied = 0;
+  for (Replacements::const_iterator I = Replace.begin(), E = Replace.end();
+       I != E; ) {
+    Replacements::const_iterator End = I;
+    while (End != E && End->getFilePath() == I->getFilePath())
+      ++End;
+
+    const FileEntry *Entry =
+      I->isApplicable() ? Files.getFile(I->getFilePath()) : NULL;
+    bool Invalid = true;
+    llvm::StringRef Contents;
+    if (Entry != NULL)
+      Contents = Sources.getBufferData(getFileIDForEntry(Sources, Entry),
+                                       &Invalid);
+    std::string Rewritten;
+    if (!Invalid && applySortedReplacements(Contents, I, End, Rewritten)) {
+      if (!Overlay && !saveFile(Entry->getName(), Contents, Rewritten)) {
+        Result = 1;
+      } else if (Undo &&
+                 !Undo->record(Entry->getName(), Contents, Rewritten, I, End)) {
+        llvm::errs() << "Could not log the edits of " << Entry->getName()
+                     << " for undo\n";
+        Result = 1;
+      }
+      if (Overlay)
+        Overlay->store(Entry->getName(), Contents, Rewritten);
+      RewrittenFiles.insert(getRealPath(Entry->getName()));
+      Applied += End - I;
+    } else {
+      Overlapping.insert(Overlapping.end(), I, End);
+    }
+    I = End;
+  }
+
+  for (Replacements::const_iterator I = Overlapping.begin(),
+                                    E = Overlapping.end();
+       I != E; ++I) {
+    if (I->isApplicable() && I->apply(Rewrite))
+      ++Applied;
+    else
+      Skipped = true;
+  }
+  if (Skipped) {
     llvm::errs() << "Skipped some replacements.\n";
+    Result = 1;
   }
-  if (!saveRewrittenFiles(Rewrite)) {
+  for (Rewriter::buffer_iterator I = Rewrite.buffer_begin(),
+                                 E = Rewrite.buffer_end();
+       I != E; ++I)
+    RewrittenFiles.insert(
+      getRealPath(Sources.getFileEntryForID(I->first)->getName()));
+  llvm::errs() << "Applied " << Applied << " replacements to "
+               << RewrittenFiles.size() << " files\n";
+  Replace.clear();
+
+  // the Rewriter does not tell which edits it made, only the new contents
+  std::vector<std::pair<FileID, std::string> > Logged;
+  if (Undo)
+    for (Rewriter::buffer_iterator I = Rewrite.buffer_begin(),
+                                   E = Rewrite.buffer_end();
+         I != E; ++I) {
+      Logged.push_back(std::make_pair(I->first, std::string()));
+      llvm::raw_string_ostream Stream(Logged.back().second);
+      I->second.write(Stream);
+      Stream.flush();
+    }
+
+  if (Overlay) {
+    Overlay->store(Rewrite);
+  } else if (!saveRewrittenFiles(Rewrite)) {
     llvm::errs() << "Could not save rewritten files.\n";
     return 1;
   }
+  for (size_t I = 0, E = Logged.size(); I != E; ++I) {
+    const char *Name = Sources.getFileEntryForID(Logged[I].first)->getName();
+    if (!Undo->record(Name, Sources.getBufferData(Logged[I].first),
+                      Logged[I].second)) {
+      llvm::errs() << "Could not log the edits of " << Name << " for undo\n";
+      Result = 1;
+    }
+  }
   return Result;
 }
@@ -22,8 +22,11 @@
 #include "llvm/ADT/StringRef.h"
 #include "clang/Basic/SourceLocation.h"
 #include "clang/Tooling/Tooling.h"
+#include <map>
+#include <set>
 #include <string>
 #include <vector>
+#include <stdint.h>
 
 namespace clang
 {
@@ -72,14 +75,35 @@ public:
   llvm::StringRef getFilePath() const { return FilePath; }
   unsigned getOffset() const { return Offset; }
   unsigned getLength() const { return Length; }
+  llvm::StringRef getReplacementText() const { return ReplacementText; }
   /// @}
 
+  /// \brief Names the file by another path, e.g. its real path, so that
+  /// the replacements of one file are grouped together however the path
+  /// was spelled.
+  void setFilePath(llvm::StringRef Path) { FilePath = Path; }
+
   /// \brief Applies the replacement on the Rewriter.
   bool apply(clang::Rewriter &Rewrite) const;
 
+  /// \brief Returns whether the range still holds the text the replacement
+  /// was created for, given the current contents of the file.
+  ///
+  /// Replacements created from a SourceManager remember a hash of the text
+  /// they replace. Others can only be checked against the size of the file.
+  bool matchesOriginalText(llvm::StringRef FileContents) const;
+
   /// \brief Returns a human readable string representation.
   std::string toString() const;
 
+  /// \brief Returns the replacement as a single line of text that
+  /// deserialize() turns back into an equal replacement.
+  std::string serialize() const;
+
+  /// \brief Parses the output of serialize(). Returns false if Line is
+  /// malformed.
+  static bool deserialize(llvm::StringRef Line, Replacement &Result);
+
   /// \brief Comparator to be able to use Replacement in std::set for uniquing.
   class Equal {
   public:
@@ -96,6 +120,8 @@ public:
   unsigned Offset;
   unsigned Length;
   std::string ReplacementText;
+  bool HasOriginalText;
+  uint64_t OriginalTextHash;
 };
 
 /// \brief A set of Replacements.
@@ -106,8 +132,229 @@ typedef std::vector<Replacement> Replacements;
 /// If at least one Apply returns false, ApplyAll returns false. Every
 /// Apply will be executed independently of the result of other
 /// Apply operations.
+///
+/// Before anything is applied, the replacements of every file are checked
+/// against its current contents. A replacement whose range no longer holds
+/// the text it was created for is not applied; the others still are.
 bool applyAllReplacements(Replacements &Replaces, clang::Rewriter &Rewrite);
 
+/// \brief Applies the replacements of one file to its contents in a single
+/// pass, copying the unchanged text in between.
+///
+/// The replacements must be sorted by offset. Returns false, leaving Result
+/// untouched, if two of them overlap or one lies outside of Contents; the
+/// Rewriter has to sort those out.
+bool applySortedReplacements(llvm::StringRef Contents,
+                             Replacements::const_iterator Begin,
+                             Replacements::const_iterator End,
+                             std::string &Result);
+
+/// \brief Rewritten file contents kept in memory between runs.
+///
+/// A later run parses and edits the rewritten contents without a round-trip
+/// through the disk; the files are written once, by save(). Files are keyed
+/// by their real path, so different spellings of a path find the same file.
+class FileOverlay {
+public:
+  bool empty() const { return Contents.empty(); }
+
+  /// \brief Returns the rewritten contents of Path, or NULL if the file has
+  /// not been rewritten.
+  const std::string *lookup(llvm::StringRef Path) const;
+
+  /// \brief Makes the tool parse the rewritten contents. The overlay must
+  /// outlive the tool's run.
+  void mapInto(clang::tooling::ClangTool &Tool) const;
+
+  /// \brief Makes the rewritten contents the buffers of SM's files.
+  void overrideIn(clang::SourceManager &SM) const;
+
+  /// \brief Takes over the buffers the Rewriter changed, remembering the
+  /// contents on disk the first time a file is rewritten.
+  void store(clang::Rewriter &Rewrite);
+
+  /// \brief Takes over the rewritten contents of Path, which had Original
+  /// before. Rewritten is left empty.
+  void store(llvm::StringRef Path, llvm::StringRef Original,
+             std::string &Rewritten);
+
+  /// \brief Writes every rewritten file, and its contents on disk as
+  /// <file>.orig. Returns false if a file could not be written.
+  bool save() const;
+
+private:
+  static std::string getKey(llvm::StringRef Path);
+
+  std::map<std::string, std::string> Contents;
+  std::map<std::string, std::string> Originals;
+};
+
+/// \brief Append-only log of the translation units a run has completed,
+/// with their replacements.
+///
+/// Every record is tagged with a step, the config section and transform it
+/// belongs to. A translation unit's replacements are appended together with
+/// the record completing it in a single write, so a process that dies
+/// half-way leaves no partial result. A run resumed from the log skips the
+/// translation units it lists as completed and takes their replacements
+/// from the log instead.
+class CheckpointLog {
+public:
+  CheckpointLog();
+  ~CheckpointLog();
+
+  /// \brief Opens the log at Path. With Resume, the records of an earlier
+  /// run with the same ConfigHash are kept; otherwise the log starts empty.
+  bool open(llvm::StringRef Path, uint64_t ConfigHash, bool Resume);
+
+  bool isOpen() const { return FD != -1; }
+
+  /// \brief Selects the step that the following calls refer to.
+  void setStep(unsigned Section, llvm::StringRef Transform);
+
+  /// \brief Returns whether the translation unit completed in this step,
+  /// and if so appends its replacements to Result.
+  bool getCompleted(llvm::StringRef SourcePath, Replacements &Result) const;
+
+  /// \brief Records that the translation unit completed in this step with
+  /// the given replacements.
+  bool complete(llvm::StringRef SourcePath, Replacements::const_iterator Begin,
+                Replacements::const_iterator End);
+
+  /// \brief Records that the translation unit could not be processed; a
+  /// resumed run tries it again.
+  void fail(llvm::StringRef SourcePath, llvm::StringRef Reason);
+
+  /// \brief A translation unit that failed in this run.
+  struct Failure {
+    unsigned Section;
+    std::string Transform;
+    std::string SourcePath;
+    std::string Reason;
+  };
+
+  const std::vector<Failure> &getFailures() const { return Failures; }
+
+  /// \brief The size of the log file, which grows with every record.
+  uint64_t getSize() const;
+
+  /// \brief Records, in a worker process, how long the translation unit
+  /// took to parse and transform.
+  void addTiming(llvm::StringRef SourcePath, double Parse, double Transform);
+
+  /// \brief Returns the timings recorded by workers since the last call,
+  /// as (path, (parse, transform)) pairs.
+  std::vector<std::pair<std::string, std::pair<double, double> > >
+  takeTimings();
+
+  /// \brief Records, in a worker process, state that the supervisor has to
+  /// take over, e.g. what a cache learnt. Kind says what Value holds. The
+  /// state is written by the next complete(), and is lost if the
+  /// translation unit does not complete.
+  void addState(llvm::StringRef Kind, llvm::StringRef Value);
+
+  typedef void (*StateHandler)(llvm::StringRef Kind, llvm::StringRef Value);
+
+  /// \brief Sets the function that update() passes the state records of
+  /// every completed translation unit to, including those of an earlier run
+  /// that is resumed.
+  void setStateHandler(StateHandler Handler) { this->Handler = Handler; }
+
+  /// \brief Whether the records are written by a worker process.
+  void setWorker(bool Worker) { this->Worker = Worker; }
+  bool isWorker() const { return Worker; }
+
+  /// \brief Records that the replacements of a section were written to disk,
+  /// so that a resumed run does not apply them again.
+  void markApplied(unsigned Section);
+  bool isApplied(unsigned Section) const;
+
+  /// \brief Reads the records other processes appended since the last call.
+  void update();
+
+private:
+  bool append(llvm::StringRef Text);
+  void parse(llvm::StringRef Line);
+  std::string getStepKey() const;
+
+  int FD;
+  bool Worker;
+  StateHandler Handler;
+  std::string Path;
+  uint64_t ReadOffset;
+  std::string Step;
+  unsigned Section;
+  /// \brief Replacements of the translation unit whose record is next.
+  Replacements Pending;
+  /// \brief State records of that translation unit, as (kind, value).
+  std::vector<std::pair<std::string, std::string> > PendingState;
+  /// \brief State records added since the last complete().
+  std::string UnwrittenState;
+  std::map<std::string, std::map<std::string, Replacements> > Completed;
+  std::vector<std::pair<std::string, std::pair<double, double> > > Timings;
+  std::set<unsigned> Applied;
+  std::vector<Failure> Failures;
+};
+
+/// \brief Log of the edits a run made to each file, from which they are
+/// undone without parsing anything.
+///
+/// Every edit is logged as the text it replaced, at its offset in the edited
+/// file, together with hashes of the file before and after the edits. Undo
+/// checks that every file still has the contents the run left behind, and
+/// rejects the whole log otherwise.
+class UndoLog {
+public:
+  UndoLog();
+  ~UndoLog();
+
+  /// \brief Opens the log at Path. With Append, the records of earlier runs
+  /// are kept, and undone together with this one. Otherwise the log is only
+  /// started over when the first edit is recorded, so that a run which
+  /// edits nothing leaves the log of the run before in place.
+  bool open(llvm::StringRef Path, bool Append);
+
+  bool isOpen() const { return FD != -1 || !Path.empty(); }
+
+  /// \brief Records that the sorted, non-overlapping replacements
+  /// [Begin, End) turned Original into Rewritten.
+  bool record(llvm::StringRef Path, llvm::StringRef Original,
+              llvm::StringRef Rewritten, Replacements::const_iterator Begin,
+              Replacements::const_iterator End);
+
+  /// \brief Records that Path went from Original to Rewritten, by edits that
+  /// are not known one by one; everything between the common prefix and
+  /// suffix of the two is logged as one edit.
+  bool record(llvm::StringRef Path, llvm::StringRef Original,
+              llvm::StringRef Rewritten);
+
+  /// \brief Restores the files logged at Path to their contents before the
+  /// logged runs. If any of them was changed since, or the log is damaged,
+  /// no file is touched and false is returned.
+  static bool undo(llvm::StringRef Path);
+
+  /// \brief The edits recorded since the log was opened, by the real path
+  /// of the file. Each one covers the new text as it lies in the file now,
+  /// and holds the text it replaced; an edit of a later section that touches
+  /// an earlier one is merged into it.
+  const std::map<std::string, Replacements> &getEdits() const {
+    return Edits;
+  }
+
+  /// \brief Whether Path, in any spelling, was edited since the log was
+  /// opened.
+  bool isEdited(llvm::StringRef Path) const;
+
+private:
+  bool append(llvm::StringRef Path, llvm::StringRef Original,
+              llvm::StringRef Rewritten, const Replacements &Reverse);
+
+  int FD;
+  /// \brief The log to start at the first edit, if it is not open yet.
+  std::string Path;
+  std::map<std::string, Replacements> Edits;
+};
+
 /// \brief A tool to run refactorings.
 ///
 /// This is a refactoring specific version of \see ClangTool.
@@ -121,16 +368,118 @@ public:
                   clang::ArrayRef<std::string> SourcePaths);
 
   /// \brief Returns a set of replacements. All replacements added during the
-  /// run of the tool will be applied after all translation units have been
-  /// processed.
+  /// runs of the tool are applied together by applyReplacements().
   Replacements &getReplacements();
 
   /// \see ClangTool::run.
   int run(clang::tooling::FrontendActionFactory *ActionFactory);
 
+  /// \brief Runs the action on the given subset of the source paths only.
+  ///
+  /// Used when it is known up front that the other translation units cannot
+  /// produce any replacements.
+  int run(clang::tooling::FrontendActionFactory *ActionFactory,
+          clang::ArrayRef<std::string> SourcePaths);
+
+  /// \brief Applies the replacements collected by all runs so far in one
+  /// pass, saves the rewritten files and clears the replacements.
+  ///
+  /// All replacements refer to the files as they were before the first run,
+  /// so several transforms can edit the same files without re-parsing.
+  int applyReplacements();
+
+  /// \brief The real paths of the files the last applyReplacements()
+  /// rewrote, on disk or in the overlay.
+  const std::set<std::string> &getRewrittenFiles() const {
+    return RewrittenFiles;
+  }
+
+  /// \brief Parses and rewrites the contents in Overlay instead of the files
+  /// on disk, and keeps the rewritten files there instead of saving them.
+  void setOverlay(FileOverlay *Overlay);
+
+  /// \brief Records the files a translation unit includes.
+  ///
+  /// Once known, run() visits translation units that share most of their
+  /// headers back to back, while those headers are still cached, instead of
+  /// in the order of the compilation database.
+  void setIncludes(llvm::StringRef SourcePath,
+                   const std::vector<std::string> &Files);
+
+  /// \brief Records how long the next run() is expected to take on a
+  /// translation unit, in seconds.
+  ///
+  /// The groups of translation units sharing headers are visited most
+  /// expensive first.
+  void setCost(llvm::StringRef SourcePath, double Seconds);
+  void clearCosts();
+
+  /// \brief Runs the translation units in worker processes and records them
+  /// in Checkpoint as they complete; those it already lists are skipped.
+  ///
+  /// A worker that crashes costs the translation unit it was working on,
+  /// which is reported and recorded as failed, and a new worker continues
+  /// with the next one.
+  void setCheckpoint(CheckpointLog *Checkpoint);
+
+  /// \brief Limits the wall-clock time (in seconds) and resident memory (in
+  /// bytes) a worker may spend on one translation unit; 0 means no limit.
+  ///
+  /// A worker over budget is killed, and its translation unit is recorded
+  /// as failed like one that crashed. Requires a checkpoint log. Memory is
+  /// only watched where /proc is available, as the growth of the worker's
+  /// resident set since it started the translation unit.
+  void setBudgets(double Seconds, uint64_t Bytes);
+
+  /// \brief Logs the edits applyReplacements() makes to Undo.
+  void setUndoLog(UndoLog *Undo);
+
+  /// \brief Checks that the source paths still compile after they were
+  /// rewritten, parsing them with -fsyntax-only in Jobs worker processes.
+  ///
+  /// Every error is reported with the edit it most likely comes from: the
+  /// one of Edits it lies in or shares a line with, or else one that
+  /// replaced a name the message quotes. Parsed lists the translation units
+  /// that were parsed before they were rewritten, and Baseline those of them
+  /// that had errors then; the others are first parsed with Edits undone.
+  /// Of a translation unit that had errors before, only the errors at an
+  /// edit are reported. Places in the rewritten files and the checked
+  /// sources that still spell a replaced name, e.g. in a skipped #if branch,
+  /// are listed as notes. Returns false if there were errors or a
+  /// translation unit could not be checked.
+  bool verify(const std::map<std::string, Replacements> &Edits,
+              const std::set<std::string> &Parsed,
+              const std::set<std::string> &Baseline,
+              llvm::StringRef BuiltinIncludes, unsigned Jobs);
+
 private:
-  clang::tooling::ClangTool Tool;
+  /// \brief The order in which run() visits SourcePaths.
+  std::vector<std::string> schedule(
+      clang::ArrayRef<std::string> SourcePaths) const;
+
+  /// \brief run() with a checkpoint log.
+  int runInWorkers(clang::tooling::FrontendActionFactory *ActionFactory,
+                   const std::vector<std::string> &SourcePaths);
+
+  /// \brief Waits for a worker to exit, killing it if a translation unit
+  /// takes it over budget. Returns why it was killed, or an empty string.
+  std::string watchWorker(int Pid, int &Status);
+
+  /// \brief The loop of a worker process, starting at SourcePaths[Next].
+  void runWorker(clang::tooling::FrontendActionFactory *ActionFactory,
+                 const std::vector<std::string> &SourcePaths, size_t Next);
+
+  const clang::tooling::CompilationDatabase &Compilations;
+  std::vector<std::string> SourcePaths;
   Replacements Replace;
+  FileOverlay *Overlay;
+  std::map<std::string, std::vector<std::string> > Includes;
+  std::map<std::string, double> Costs;
+  CheckpointLog *Checkpoint;
+  double TimeBudget;
+  uint64_t MemoryBudget;
+  UndoLog *Undo;
+  std::set<std::string> RewrittenFiles;
 };
 
 template <typename Node>
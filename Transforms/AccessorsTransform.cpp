@@ -1,25 +1,92 @@
 #include "Transforms.h"
 
 #include <clang/AST/ParentMap.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/Mutex.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include "hash-util.h"
+
 using namespace clang;
 using namespace clang::tooling;
 using namespace std;
 
+// Accessor insertions are planned once per record definition for the whole
+// run. Otherwise every translation unit including a record's header would
+// insert the same accessors again, leaving applyAllReplacements to drop the
+// copies (and keep them if the generated text differs in any way).
+class AccessorPlans
+{
+public:
+	static AccessorPlans &get() {
+		static AccessorPlans instance;
+		return instance;
+	}
+	// returns true if the caller is the first to plan the record at key;
+	// a worker process passes its claims on to the ones that follow it
+	bool claim(const string &key) {
+		{
+			llvm::sys::ScopedLock L(lock);
+			if(!claimed.insert(key))
+				return false;
+		}
+		TransformRegistry::get().shareState("AccessorClaim", key);
+		return true;
+	}
+	static void takeClaim(llvm::StringRef key) {
+		get().claim(key.str());
+	}
+private:
+	llvm::sys::Mutex lock;
+	llvm::StringSet<> claimed;
+};
+
+static StateHandlerRegistration _accessor_claims("AccessorClaim", &AccessorPlans::takeClaim);
+
 class AccessorsTransform : public Transform
 {
 private:
 	map<string, FieldDecl*> fieldRanges;
-	list<string> fields;
+	// the configured fields by qualified name, and the declarations of those
+	// seen so far by canonical declaration
+	llvm::StringSet<> fields;
+	llvm::SmallPtrSet<const Decl*, 32> fieldDecls;
+	// one parent map for all function bodies, grown as they are visited
+	llvm::OwningPtr<ParentMap> parentMap;
 	ASTContext *ctx;
 public:
 	void HandleTranslationUnit(ASTContext &Ctx) {
-		fields = TransformRegistry::get().config["Accessors"].as<list<string> >();
+		auto configured = TransformRegistry::get().config["Accessors"];
+		for(auto iter = configured.begin(); iter != configured.end(); ++iter)
+			fields.insert(iter->as<string>());
 		ctx = &Ctx;
 		collect(ctx->getTranslationUnitDecl());
 		insertAccessors();
 	}
+	bool isConfiguredField(const ValueDecl *decl) {
+		return fieldDecls.count(decl->getCanonicalDecl());
+	}
+	// "foo." or "foo->" for an access through an object, nothing for an
+	// implicit this->
+	string getBasePrefix(const MemberExpr *mem_expr) {
+		const Expr *base = mem_expr->getBase();
+		if(base->isImplicitCXXThis())
+			return "";
+		string text = Lexer::getSourceText(CharSourceRange::getTokenRange(base->getSourceRange()),
+		                                   ctx->getSourceManager(), ctx->getLangOpts());
+		return text + (mem_expr->isArrow() ? "->" : ".");
+	}
+	string getSourceText(SourceRange range) {
+		return Lexer::getSourceText(CharSourceRange::getTokenRange(range),
+		                            ctx->getSourceManager(), ctx->getLangOpts());
+	}
+	// replaces the text from begin up to, but not including, end
+	void replaceUpTo(SourceLocation begin, SourceLocation end, const string &text) {
+		TransformRegistry::get().replacements->push_back(
+			Replacement(ctx->getSourceManager(), CharSourceRange::getCharRange(begin, end), text));
+	}
 	void collect(const DeclContext *ns_decl) {
 		for(auto subdecl = ns_decl->decls_begin(); subdecl != ns_decl->decls_end(); subdecl++) {
 			/*
@@ -51,15 +118,34 @@ public:
 			 */
 			if(const CXXRecordDecl *rc_decl = dyn_cast<CXXRecordDecl>(*subdecl)) {
 				for(auto member = rc_decl->field_begin(); member != rc_decl->field_end(); member++)
-					if(find(fields.begin(), fields.end(), member->getQualifiedNameAsString())!=fields.end())
-            fieldRanges[member->getQualifiedNameAsString()] = *member;
+				{
+					string name = member->getQualifiedNameAsString();
+					if(fields.count(name))
+					{
+						fieldRanges[name] = *member;
+						fieldDecls.insert(member->getCanonicalDecl());
+					}
+				}
 			}
 			if(const FunctionDecl *fn_decl = dyn_cast<FunctionDecl>(*subdecl)) {
-				if(fn_decl->getNameAsString() != "main")
-					continue;
-				if(Stmt *body = fn_decl->getBody())
+				// the record's own methods (and the accessors) keep using the
+				// field directly
+				auto method = dyn_cast<CXXMethodDecl>(fn_decl);
+				bool ownsField = false;
+				if(method)
+				{
+					for(auto member = method->getParent()->field_begin(); member != method->getParent()->field_end(); member++)
+						if(isConfiguredField(*member))
+							ownsField = true;
+				}
+				Stmt *body = fn_decl->getBody();
+				if(body && !ownsField && fn_decl->isThisDeclarationADefinition())
 				{
-					collect(body, ParentMap(body));
+					if(!parentMap)
+						parentMap.reset(new ParentMap(body));
+					else
+						parentMap->addStmt(body);
+					collect(body, *parentMap);
 				}
 			}
 			//recurse into inner contexts
@@ -75,70 +161,73 @@ public:
 			collect(bin_op->getRHS(), PM);
 			return;
 		}
-		for(auto iter = fieldRanges.begin(); iter != fieldRanges.end(); ++iter)
+		if(!isConfiguredField(lhs_expr->getMemberDecl()))
 		{
-			if(lhs_expr->getMemberDecl() == iter->second)
+			collect(lhs_expr->getBase(), PM);
+			collect(bin_op->getRHS(), PM);
+			return;
+		}
+		const Stmt *top_stmt_within_compound = bin_op;
+		while(isa<Expr>(PM.getParent(top_stmt_within_compound))
+		      || isa<DeclStmt>(PM.getParent(top_stmt_within_compound)))
+			top_stmt_within_compound = PM.getParent(top_stmt_within_compound);
+		
+		string stmts_str;
+		llvm::raw_string_ostream sstr(stmts_str);
+		string base_str = getBasePrefix(lhs_expr);
+		
+		string getterName = "get" + lhs_expr->getMemberDecl()->getNameAsString();
+		getterName[3] = toupper(getterName[3]);
+		string setterName = "set" + lhs_expr->getMemberDecl()->getNameAsString();
+		setterName[3] = toupper(setterName[3]);
+		
+		const Expr *rhs = bin_op->getRHS();
+		if(bin_op->isCompoundAssignmentOp())
+		{
+			string op = BinaryOperator::getOpcodeStr(BinaryOperator::getOpForCompoundAssignment(bin_op->getOpcode()));
+			if(bin_op!=top_stmt_within_compound)
 			{
-				const Stmt *top_stmt_within_compound = bin_op;
-				while(isa<Expr>(PM.getParent(top_stmt_within_compound))
-				      || isa<DeclStmt>(PM.getParent(top_stmt_within_compound)))
-					top_stmt_within_compound = PM.getParent(top_stmt_within_compound);
-				
-				string stmts_str, base_str;
-				llvm::raw_string_ostream sstr(stmts_str), base_sstr(base_str);
-				// lhs_expr->getBase()->printPretty(base_sstr, *ctx, 0, PrintingPolicy(ctx->getLangOpts()));
-				
-				string getterName = "get" + lhs_expr->getMemberDecl()->getNameAsString();
-				getterName[3] = toupper(getterName[3]);
-				string setterName = "set" + lhs_expr->getMemberDecl()->getNameAsString();
-				setterName[3] = toupper(setterName[3]);
-				
-				if(bin_op->isCompoundAssignmentOp())
-				{
-					
-					if(bin_op!=top_stmt_within_compound)
-					{
-						// rewrite something like:
-						// int z = (foo.x+=3);
-						// to
-						// foo.setX(foo.getX()+3);
-						// int z = foo.getX();
-						
-						sstr << base_sstr.str() << "." << setterName << "( ";
-						sstr << base_sstr.str() << "." << getterName << "() ";
-						sstr << BinaryOperator::getOpcodeStr(BinaryOperator::getOpForCompoundAssignment(bin_op->getOpcode())) << " ";
-						// bin_op->getRHS()->printPretty(sstr, *ctx, 0, PrintingPolicy(ctx->getLangOpts()));
-						collect(bin_op->getRHS(), PM);
-						sstr << " );\n";
-						insert(top_stmt_within_compound->getLocStart(), sstr.str());
-						replace(bin_op->getSourceRange(), base_sstr.str() + "." + getterName + "()");
-						
-					}
-					else
-					{
-						// just a simple compound assignment, e.g.
-						// foo.x+=3;
-						// to
-						// foo.setX(foo.getX() + 3);
-						sstr << base_sstr.str() << "." << setterName << "( ";
-						sstr << base_sstr.str() << "." << getterName << "() ";
-						sstr << BinaryOperator::getOpcodeStr(BinaryOperator::getOpForCompoundAssignment(bin_op->getOpcode())) << " ";
-						collect(bin_op->getRHS(), PM);
-						// bin_op->getRHS()->printPretty(sstr, *ctx, 0, PrintingPolicy(ctx->getLangOpts()));
-						sstr << " )";
-						replace(bin_op->getSourceRange(), sstr.str());
-					}
-				}
-				else if(bin_op->getOpcode() == clang::BO_Assign)
-				{
-					sstr << base_sstr.str() << "." << setterName << "( ";
-					collect(bin_op->getRHS(), PM);
-					// bin_op->getRHS()->printPretty(sstr, *ctx, 0, PrintingPolicy(ctx->getLangOpts()));
-					sstr << " )";
-					replace(bin_op->getSourceRange(), sstr.str());
-				}
+				// rewrite something like:
+				// int z = (foo.x+=3);
+				// to
+				// foo.setX( foo.getX() + (3) );
+				// int z = foo.getX();
+				// the right-hand side is copied as written, since the
+				// assignment it is part of is replaced
+				sstr << base_str << setterName << "( ";
+				sstr << base_str << getterName << "() " << op << " (";
+				sstr << getSourceText(rhs->getSourceRange()) << ") );\n";
+				insert(top_stmt_within_compound->getLocStart(), sstr.str());
+				replace(bin_op->getSourceRange(), base_str + getterName + "()");
+			}
+			else
+			{
+				// just a simple compound assignment, e.g.
+				// foo.x+=3;
+				// to
+				// foo.setX( foo.getX() + (3) );
+				sstr << base_str << setterName << "( ";
+				sstr << base_str << getterName << "() " << op << " (";
+				replaceUpTo(bin_op->getLocStart(), rhs->getLocStart(), sstr.str());
+				insert(getLocForEndOfToken(rhs->getLocEnd()), ") )");
+				collect(rhs, PM);
 			}
 		}
+		else if(bin_op->getOpcode() == clang::BO_Assign)
+		{
+			// foo.x = 3; to foo.setX( 3 ); the right-hand side stays in
+			// place, so the accesses in it are rewritten too
+			sstr << base_str << setterName << "( ";
+			replaceUpTo(bin_op->getLocStart(), rhs->getLocStart(), sstr.str());
+			insert(getLocForEndOfToken(rhs->getLocEnd()), " )");
+			collect(rhs, PM);
+		}
+		else
+		{
+			// a read, e.g. foo.x < 10
+			rewrite(lhs_expr, PM);
+			collect(bin_op->getRHS(), PM);
+		}
 	}
 	void rewrite(const UnaryOperator *un_op, const ParentMap &PM) {
 		MemberExpr *sub_expr;
@@ -147,216 +236,211 @@ public:
 			collect(un_op->getSubExpr(), PM);
 			return;
 		}
-		for(auto iter = fieldRanges.begin(); iter != fieldRanges.end(); ++iter)
+		if(!isConfiguredField(sub_expr->getMemberDecl()))
 		{
-			if(sub_expr->getMemberDecl() == iter->second)
+			collect(sub_expr->getBase(), PM);
+			return;
+		}
+		const Stmt *top_stmt_within_compound = un_op;
+		while(isa<Expr>(PM.getParent(top_stmt_within_compound))
+		      || isa<DeclStmt>(PM.getParent(top_stmt_within_compound)))
+			top_stmt_within_compound = PM.getParent(top_stmt_within_compound);
+		const Stmt *top_stmt_or_compound = top_stmt_within_compound;
+		if(isa<CompoundStmt>(PM.getParent(top_stmt_within_compound)))
+			top_stmt_or_compound = PM.getParent(top_stmt_within_compound);
+		
+		string base_str = getBasePrefix(sub_expr);
+		
+		string getterName = "get" + sub_expr->getMemberDecl()->getNameAsString();
+		getterName[3] = toupper(getterName[3]);
+		string setterName = "set" + sub_expr->getMemberDecl()->getNameAsString();
+		setterName[3] = toupper(setterName[3]);
+		if(!un_op->isIncrementDecrementOp())
+		{
+			collect(un_op->getSubExpr(), PM);
+		}
+		else
+		{
+			string incrStmt;
+			{
+				llvm::raw_string_ostream sstr(incrStmt);
+				sstr << base_str << setterName << "( ";
+				sstr << base_str << getterName << "() ";
+				sstr << (un_op->isIncrementOp()?"+":"-") << " 1)";
+				incrStmt = sstr.str();
+			}
+			
+			string getStmt;
 			{
-				const Stmt *top_stmt_within_compound = un_op;
-				while(isa<Expr>(PM.getParent(top_stmt_within_compound))
-				      || isa<DeclStmt>(PM.getParent(top_stmt_within_compound)))
-					top_stmt_within_compound = PM.getParent(top_stmt_within_compound);
-				const Stmt *top_stmt_or_compound = top_stmt_within_compound;
-				if(isa<CompoundStmt>(PM.getParent(top_stmt_within_compound)))
-					top_stmt_or_compound = PM.getParent(top_stmt_within_compound);
-				
-				string base_str;
-				llvm::raw_string_ostream base_sstr(base_str);
-				// sub_expr->getBase()->printPretty(base_sstr, *ctx, 0, PrintingPolicy(ctx->getLangOpts()));
-				base_str = base_sstr.str();
-				
-				string getterName = "get" + sub_expr->getMemberDecl()->getNameAsString();
-				getterName[3] = toupper(getterName[3]);
-				string setterName = "set" + sub_expr->getMemberDecl()->getNameAsString();
-				setterName[3] = toupper(setterName[3]);
-				if(!un_op->isIncrementDecrementOp())
+				llvm::raw_string_ostream sstr(getStmt);
+				sstr << base_str << getterName << "()";
+				getStmt = sstr.str();
+			}
+			
+			bool onlyStmt = top_stmt_within_compound == top_stmt_or_compound;
+			bool onlyExpr = un_op == top_stmt_within_compound;
+			
+			bool needToInsertBraces = false, needToInsertParentBraces = false;
+			if( const IfStmt *if_stmt = dyn_cast<IfStmt>(PM.getParent(top_stmt_or_compound)) )
+			{
+				if(if_stmt->getThen() == top_stmt_or_compound
+				   || if_stmt->getElse() == top_stmt_or_compound)
 				{
-					collect(un_op->getSubExpr(), PM);
+					if(onlyExpr)
+						replace(un_op->getSourceRange(), incrStmt);
+					else
+					{
+						replace(un_op->getSourceRange(), getStmt);
+						if(un_op->isPrefix())
+						{
+							insert(un_op->getLocStart(), incrStmt + ";\n");
+						}
+						else
+						{
+							assert(un_op->isPostfix());
+							insert(findLocAfterSemi(un_op->getLocEnd()), incrStmt + ";\n");
+						}
+						if(onlyStmt)
+							needToInsertBraces = true;
+					}
 				}
 				else
 				{
-					string incrStmt;
+					assert(top_stmt_within_compound == top_stmt_or_compound);
+					assert(if_stmt->getCond() == top_stmt_within_compound);
+					if(un_op->isPrefix())
 					{
-						llvm::raw_string_ostream sstr(incrStmt);
-						sstr << base_str << "." << setterName << "( ";
-						sstr << base_str << "." << getterName << "() ";
-						sstr << (un_op->isIncrementOp()?"+":"-") << " 1)";
-						incrStmt = sstr.str();
+						insert(if_stmt->getLocStart(), incrStmt);
 					}
-					
-					string getStmt;
+					else
 					{
-						llvm::raw_string_ostream sstr(getStmt);
-						sstr << base_str << "." << getterName << "()";
-						getStmt = sstr.str();
+						assert(un_op->isPostfix());
+						insert(if_stmt->getLocEnd(), incrStmt);
 					}
-					
-					bool onlyStmt = top_stmt_within_compound == top_stmt_or_compound;
-					bool onlyExpr = un_op == top_stmt_within_compound;
-					
-					bool needToInsertBraces = false, needToInsertParentBraces = false;
-					if( const IfStmt *if_stmt = dyn_cast<IfStmt>(PM.getParent(top_stmt_or_compound)) )
+					if(onlyStmt)
+						needToInsertParentBraces = true;
+				}
+			}
+			else if( const ForStmt *for_stmt = dyn_cast<ForStmt>(PM.getParent(top_stmt_or_compound)) )
+			{
+				if(for_stmt->getBody() == top_stmt_or_compound)
+				{
+					if(onlyExpr)
+						replace(un_op->getSourceRange(), incrStmt);
+					else
 					{
-						if(if_stmt->getThen() == top_stmt_or_compound
-						   || if_stmt->getElse() == top_stmt_or_compound)
+						replace(un_op->getSourceRange(), getStmt);
+						if(un_op->isPrefix())
 						{
-							if(onlyExpr)
-								replace(un_op->getSourceRange(), incrStmt);
-							else
-							{
-								replace(un_op->getSourceRange(), getStmt);
-								if(un_op->isPrefix())
-								{
-									insert(un_op->getLocStart(), incrStmt + ";\n");
-								}
-								else
-								{
-									assert(un_op->isPostfix());
-									insert(findLocAfterSemi(un_op->getLocEnd()), incrStmt + ";\n");
-								}
-								if(onlyStmt)
-									needToInsertBraces = true;
-							}
+							insert(un_op->getLocStart(), incrStmt);
 						}
 						else
 						{
-							assert(top_stmt_within_compound == top_stmt_or_compound);
-							assert(if_stmt->getCond() == top_stmt_within_compound);
-							if(un_op->isPrefix())
-							{
-								insert(if_stmt->getLocStart(), incrStmt);
-							}
-							else
-							{
-								assert(un_op->isPostfix());
-								insert(if_stmt->getLocEnd(), incrStmt);
-							}
-							if(onlyStmt)
-								needToInsertParentBraces = true;
+							assert(un_op->isPostfix());
+							insert(un_op->getLocEnd(), incrStmt);
 						}
+						if(onlyStmt)
+							needToInsertBraces = true;
 					}
-					else if( const ForStmt *for_stmt = dyn_cast<ForStmt>(PM.getParent(top_stmt_or_compound)) )
+				}
+				else if( for_stmt->getInit() == top_stmt_within_compound )
+				{
+					assert(onlyStmt); //no blocks in initializer
+					if(onlyExpr)
+						replace(un_op->getSourceRange(), incrStmt);
+					else
 					{
-						if(for_stmt->getBody() == top_stmt_or_compound)
-						{
-							if(onlyExpr)
-								replace(un_op->getSourceRange(), incrStmt);
-							else
-							{
-								replace(un_op->getSourceRange(), getStmt);
-								if(un_op->isPrefix())
-								{
-									insert(un_op->getLocStart(), incrStmt);
-								}
-								else
-								{
-									assert(un_op->isPostfix());
-									insert(un_op->getLocEnd(), incrStmt);
-								}
-								if(onlyStmt)
-									needToInsertBraces = true;
-							}
-						}
-						else if( for_stmt->getInit() == top_stmt_within_compound )
-						{
-							assert(onlyStmt); //no blocks in initializer
-							if(onlyExpr)
-								replace(un_op->getSourceRange(), incrStmt);
-							else
-							{
-								insert(for_stmt->getLocStart(), incrStmt + ";\n");
-								if(un_op->isPostfix())
-									//not sure if this is legit, but i can't think of a better way
-									replace(un_op->getSourceRange(), "(" + getStmt + " - 1)");
-								else
-									replace(un_op->getSourceRange(), getStmt );
-							}
-						}
-						else if( for_stmt->getInc() == top_stmt_within_compound )
-						{
-							assert(onlyStmt); //no blocks in increment
-							if(onlyExpr)
-							{
-								replace(top_stmt_within_compound->getSourceRange(), incrStmt);
-							}
-						}
+						insert(for_stmt->getLocStart(), incrStmt + ";\n");
+						if(un_op->isPostfix())
+							//not sure if this is legit, but i can't think of a better way
+							replace(un_op->getSourceRange(), "(" + getStmt + " - 1)");
 						else
-						{
-							assert(onlyStmt); //no blocks in conditions
-							assert(for_stmt->getCond() == top_stmt_within_compound);
-							if(un_op->isPrefix())
-							{
-								//rewriter.InsertTextBefore(for_stmt->getLocStart(), incrStmt);
-							}
-							else
-							{
-								assert(un_op->isPostfix());
-								//rewriter.InsertTextAfter(for_stmt->getLocEnd(), incrStmt);
-							}
-						}
+							replace(un_op->getSourceRange(), getStmt );
 					}
-						/*
-					bool needToInsertBraces =
-						(
-							(ifStmt = dyn_cast<IfStmt>(PM.getParent(top_stmt_within_compound))
-							 && ((ifStmt->getThen() == top_stmt_within_compound)
-							     || ifStmt->getElse() == top_stmt_within_compound))
-							|| (forStmt = dyn_cast<ForStmt>(PM.getParent(top_stmt_within_compound))
-							    && forStmt->getBody() == top_stmt_within_compound)
-							|| (whileStmt = dyn_cast<WhileStmt>(PM
-							)
-						&& un_op!=top_stmt_within_compound;
-					
-					if(un_op==top_stmt_within_compound)
+				}
+				else if( for_stmt->getInc() == top_stmt_within_compound )
+				{
+					assert(onlyStmt); //no blocks in increment
+					if(onlyExpr)
 					{
-						rewriter.ReplaceText(un_op->getSourceRange(), sstr.str());
+						replace(top_stmt_within_compound->getSourceRange(), incrStmt);
 					}
-					else if(un_op->isPrefix())
+				}
+				else
+				{
+					assert(onlyStmt); //no blocks in conditions
+					assert(for_stmt->getCond() == top_stmt_within_compound);
+					if(un_op->isPrefix())
 					{
-						rewriter.ReplaceText(un_op->getSourceRange(),
-						                     base_str + "." + getterName + "()");
-						rewriter.InsertTextBefore(top_stmt_within_compound->getLocStart(),
-						                          sstr.str() + ";\n");
+						//rewriter.InsertTextBefore(for_stmt->getLocStart(), incrStmt);
 					}
 					else
 					{
 						assert(un_op->isPostfix());
-						rewriter.ReplaceText(un_op->getSourceRange(),
-						                     base_sstr.str() + "." + getterName + "()");
-						rewriter.InsertTextAfterToken(top_stmt_within_compound->getLocEnd(),
-						                              ";\n" + sstr.str());
-						                              }*/
-					if(needToInsertBraces)
-					{
-						insert(top_stmt_within_compound->getLocStart(), "{\n");
-						SourceLocation locAfterSemi = findLocAfterToken(top_stmt_or_compound->getLocEnd(), tok::semi);
-						insert(locAfterSemi, "}\n");
+						//rewriter.InsertTextAfter(for_stmt->getLocEnd(), incrStmt);
 					}
 				}
 			}
+				/*
+			bool needToInsertBraces =
+				(
+					(ifStmt = dyn_cast<IfStmt>(PM.getParent(top_stmt_within_compound))
+					 && ((ifStmt->getThen() == top_stmt_within_compound)
+					     || ifStmt->getElse() == top_stmt_within_compound))
+					|| (forStmt = dyn_cast<ForStmt>(PM.getParent(top_stmt_within_compound))
+					    && forStmt->getBody() == top_stmt_within_compound)
+					|| (whileStmt = dyn_cast<WhileStmt>(PM
+					)
+				&& un_op!=top_stmt_within_compound;
+			
+			if(un_op==top_stmt_within_compound)
+			{
+				rewriter.ReplaceText(un_op->getSourceRange(), sstr.str());
+			}
+			else if(un_op->isPrefix())
+			{
+				rewriter.ReplaceText(un_op->getSourceRange(),
+				                     base_str + "." + getterName + "()");
+				rewriter.InsertTextBefore(top_stmt_within_compound->getLocStart(),
+				                          sstr.str() + ";\n");
+			}
+			else
+			{
+				assert(un_op->isPostfix());
+				rewriter.ReplaceText(un_op->getSourceRange(),
+				                     base_sstr.str() + "." + getterName + "()");
+				rewriter.InsertTextAfterToken(top_stmt_within_compound->getLocEnd(),
+				                              ";\n" + sstr.str());
+				                              }*/
+			if(needToInsertBraces)
+			{
+				insert(top_stmt_within_compound->getLocStart(), "{\n");
+				SourceLocation locAfterSemi = findLocAfterToken(top_stmt_or_compound->getLocEnd(), tok::semi);
+				insert(locAfterSemi, "}\n");
+			}
 		}
 	}
 	void rewrite(const MemberExpr *mem_expr, const ParentMap &PM) {
-		for(auto iter = fieldRanges.begin(); iter != fieldRanges.end(); ++iter)
+		if(!isConfiguredField(mem_expr->getMemberDecl()))
 		{
-			if(mem_expr->getMemberDecl() == iter->second)
-			{
-				const Stmt *top_stmt_within_compound = mem_expr;
-				while(isa<Expr>(PM.getParent(top_stmt_within_compound))
-				      || isa<DeclStmt>(PM.getParent(top_stmt_within_compound)))
-					top_stmt_within_compound = PM.getParent(top_stmt_within_compound);
-				
-				string stmts_str, base_str;
-				llvm::raw_string_ostream sstr(stmts_str), base_sstr(base_str);
-				// mem_expr->getBase()->printPretty(base_sstr, *ctx, 0, PrintingPolicy(ctx->getLangOpts()));
-				
-				string getterName = "get" + mem_expr->getMemberDecl()->getNameAsString();
-				getterName[3] = toupper(getterName[3]);
-				string setterName = "set" + mem_expr->getMemberDecl()->getNameAsString();
-				setterName[3] = toupper(setterName[3]);
-				sstr << base_sstr.str() << "." << getterName << "()";
-				replace(mem_expr->getSourceRange(), sstr.str());
-			}
+			collect(mem_expr->getBase(), PM);
+			return;
 		}
+		const Stmt *top_stmt_within_compound = mem_expr;
+		while(isa<Expr>(PM.getParent(top_stmt_within_compound))
+		      || isa<DeclStmt>(PM.getParent(top_stmt_within_compound)))
+			top_stmt_within_compound = PM.getParent(top_stmt_within_compound);
+		
+		string stmts_str;
+		llvm::raw_string_ostream sstr(stmts_str);
+		string base_str = getBasePrefix(mem_expr);
+		
+		string getterName = "get" + mem_expr->getMemberDecl()->getNameAsString();
+		getterName[3] = toupper(getterName[3]);
+		string setterName = "set" + mem_expr->getMemberDecl()->getNameAsString();
+		setterName[3] = toupper(setterName[3]);
+		sstr << base_str << getterName << "()";
+		replace(mem_expr->getSourceRange(), sstr.str());
 	}
 void collect(const Stmt *stmt, const ParentMap &PM) {
 	if(const BinaryOperator *bin_op = dyn_cast<BinaryOperator>(stmt))
@@ -381,10 +465,15 @@ void collect(const Stmt *stmt, const ParentMap &PM) {
 	}
 }
 void insertAccessors() {
+	// all accessors of a record go in with one insertion
+	vector<const CXXRecordDecl*> records;
+	map<const CXXRecordDecl*, string> accessors;
 	for(auto iter = fieldRanges.begin(); iter != fieldRanges.end(); ++iter)
 	{
-		CXXRecordDecl *parent = dyn_cast<CXXRecordDecl>(iter->second->getParent());
-		SourceLocation loc;
+		const CXXRecordDecl *parent = dyn_cast<CXXRecordDecl>(iter->second->getParent());
+		if(!accessors.count(parent))
+			records.push_back(parent);
+
 		string varname = iter->second->getNameAsString();
 		string fnname = varname;
 		fnname[0] = toupper(fnname[0]);
@@ -397,35 +486,34 @@ void insertAccessors() {
 		sstr << type << " &get" << fnname << "()  { return " << varname << "; };\n";
 		//setter
 		sstr << "void set" << fnname << "(" << ctype << "& _" << varname << ") { " << varname << " = _" << varname << "; };\n";
-			
-		bool hasUserDefinedMethods = false;
-		for(auto iter = parent->method_begin(); iter != parent->method_end(); ++iter)
-			if(iter->isUserProvided())
-				hasUserDefinedMethods = true;
-		if(!hasUserDefinedMethods)
-		{
+		accessors[parent] += sstr.str();
+	}
+
+	SourceManager &SM = ctx->getSourceManager();
+	for(auto iter = records.begin(); iter != records.end(); ++iter)
+	{
+		const CXXRecordDecl *parent = *iter;
+
+		// every translation unit including the record's header sees the same
+		// definition; only the first one to get here inserts
+		auto DL = SM.getDecomposedLoc(SM.getExpansionLoc(parent->getLocation()));
+		const FileEntry *FE = SM.getFileEntryForID(DL.first);
+		if(!FE)
+			continue;
+		string text = accessors[parent];
+		stringstream key;
+		key << FE->getName() << ":" << DL.second << ":" << hashString(text);
+		if(!AccessorPlans::get().claim(key.str()))
+			continue;
+
+		// after the last user-provided method, or before the closing brace
+		SourceLocation loc;
+		for(auto method = parent->method_begin(); method != parent->method_end(); ++method)
+			if(method->isUserProvided())
+				loc = method->getSourceRange().getEnd();
+		if(loc.isInvalid())
 			loc = parent->getRBraceLoc();
-			insert(parent->getRBraceLoc(), sstr.str());
-		}
-		else
-		{
-			CXXRecordDecl::method_iterator lastMethod = parent->method_begin();
-			CXXRecordDecl::method_iterator check = lastMethod;
-			do {
-				if(!lastMethod->isUserProvided())
-				{
-					++check;
-					++lastMethod;
-					continue;
-				}
-				loc = lastMethod->getSourceRange().getEnd();
-				++check;
-				if(check==parent->method_end())
-					break;
-				++lastMethod;
-			} while(1);
-			insert(loc, sstr.str());
-		}
+		insert(loc, text);
 	}
 }
 };
@@ -2,27 +2,136 @@
 
 #include <map>
 
+#include <clang/AST/RecursiveASTVisitor.h>
+#include <llvm/Support/Mutex.h>
+
 using namespace clang;
+using namespace clang::tooling;
 using namespace std;
 
+// Whether a function's definition is rewritten is decided in the translation
+// unit that defines it, but its callers may live in translation units that
+// only see a prototype. The decision is kept here for the whole run, and
+// calls seen before it are held back until it is made; a function whose
+// definition is never seen keeps its callers as they are.
+class ExtractionDecisions
+{
+public:
+	enum Decision { Undecided, Accepted, Rejected };
+
+	static ExtractionDecisions &get() {
+		static ExtractionDecisions instance;
+		return instance;
+	}
+	Decision lookup(const string &key) {
+		llvm::sys::ScopedLock L(lock);
+		auto I = decisions.find(key);
+		return I == decisions.end() ? Undecided : I->second;
+	}
+	// the calls held back for an accepted function are appended to out
+	void decide(const string &key, bool accepted, Replacements &out) {
+		{
+			llvm::sys::ScopedLock L(lock);
+			if(decisions.count(key))
+				return;
+			decisions[key] = accepted ? Accepted : Rejected;
+			auto I = deferred.find(key);
+			if(I != deferred.end())
+			{
+				if(accepted)
+					out.insert(out.end(), I->second.begin(), I->second.end());
+				deferred.erase(I);
+			}
+		}
+		TransformRegistry::get().shareState("ExtractParameterDecision", (accepted ? "1\t" : "0\t") + key);
+	}
+	void defer(const string &key, const Replacement &call) {
+		{
+			llvm::sys::ScopedLock L(lock);
+			deferred[key].push_back(call);
+		}
+		TransformRegistry::get().shareState("ExtractParameterCall", key + "\t" + call.serialize());
+	}
+
+	// state from worker processes; calls a worker let through with its
+	// decision are in that worker's replacements already
+	static void takeDecision(llvm::StringRef value) {
+		pair<llvm::StringRef, llvm::StringRef> fields = value.split('\t');
+		Replacements ignored;
+		get().decide(fields.second.str(), fields.first == "1", ignored);
+	}
+	static void takeCall(llvm::StringRef value) {
+		pair<llvm::StringRef, llvm::StringRef> fields = value.split('\t');
+		Replacement call;
+		if(Replacement::deserialize(fields.second, call) && get().lookup(fields.first.str()) == Undecided)
+		{
+			llvm::sys::ScopedLock L(get().lock);
+			get().deferred[fields.first.str()].push_back(call);
+		}
+	}
+private:
+	llvm::sys::Mutex lock;
+	map<string, Decision> decisions;
+	map<string, Replacements> deferred;
+};
+
+static StateHandlerRegistration _extraction_decisions("ExtractParameterDecision", &ExtractionDecisions::takeDecision);
+static StateHandlerRegistration _extraction_calls("ExtractParameterCall", &ExtractionDecisions::takeCall);
+
+// A default argument is evaluated at the call site, where the function's
+// locals and parameters are out of scope, even constant ones.
+static bool refersToLocals(const Stmt *S)
+{
+	if(!S)
+		return false;
+	if(isa<CXXThisExpr>(S))
+		return true;
+	if(auto DRE = dyn_cast<DeclRefExpr>(S))
+		if(DRE->getDecl()->getDeclContext()->isFunctionOrMethod())
+			return true;
+	for(auto I = S->child_begin(), E = S->child_end(); I != E; ++I)
+		if(refersToLocals(*I))
+			return true;
+	return false;
+}
 
-class ExtractParameterTransform : public Transform {
+
+class ExtractParameterTransform : public Transform,
+	public RecursiveASTVisitor<ExtractParameterTransform> {
 public:  
 	virtual void HandleTranslationUnit(ASTContext &C);
-	
+
+	bool VisitFunctionDecl(FunctionDecl *FN);
+	bool VisitCallExpr(CallExpr *CE);
   
 protected:
-	
-	string extractMethodName;
-	string extractVariableName;
-	string extractDefaultValue;
+	struct Extraction
+	{
+		string variable;
+		string defaultValue;
+		bool hasDefault;
+	};
+	typedef vector<Extraction> Extractions;
 
-	map<const FunctionDecl*, list<const VarDecl*> > rewrites;
-  
-	void collectDeclContext(const DeclContext *DC);
-	void collectFunction(const FunctionDecl *FN);
+	// every spec, by qualified function name
+	map<string, Extractions> specs;
+	// the spec of every function seen so far, by canonical declaration; null
+	// for functions that are not extracted from
+	map<const FunctionDecl*, const Extractions*> targets;
+
+	// the definitions being rewritten, with their variables in spec order
+	map<const FunctionDecl*, vector<const VarDecl*> > rewrites;
+	vector<const CallExpr*> calls;
+
+	void loadConfig();
+	const Extractions *getExtractions(const FunctionDecl *FN);
+	static string getDecisionKey(const FunctionDecl *FN);
+	void decide(const FunctionDecl *FN, bool accepted);
 
 	void process();
+	void processCall(const CallExpr *CE);
+	SourceLocation getParameterInsertionLoc(const FunctionDecl *FN);
+	string getSourceText(SourceRange range);
 	void removeDecl(const Stmt *stmt, const VarDecl *decl);
 };
 
@@ -30,47 +139,159 @@ REGISTER_TRANSFORM(ExtractParameterTransform);
   
 void ExtractParameterTransform::HandleTranslationUnit(ASTContext &C)
 {
-	auto extractSpec = TransformRegistry::get().config["ExtractParameter"].begin();
-	extractMethodName = (*extractSpec)["method"].as<string>();
-	extractVariableName = (*extractSpec)["variable"].as<string>();
-	extractDefaultValue = "";
-	if((*extractSpec)["default"])
-		extractDefaultValue = (*extractSpec)["default"].as<string>();
-
-	collectDeclContext(C.getTranslationUnitDecl());
+	loadConfig();
+	if(specs.empty())
+		return;
+
+	// one traversal collects the definitions and the calls of all functions
+	TraverseDecl(C.getTranslationUnitDecl());
 	process();
 }
-  
-void ExtractParameterTransform::collectDeclContext(const DeclContext *DC)
-{  
-	for(auto I = DC->decls_begin(), E = DC->decls_end(); I != E; ++I) {
-		if (auto innerFN = dyn_cast<FunctionDecl>(*I))
+
+void ExtractParameterTransform::loadConfig()
+{
+	auto extractSpecs = TransformRegistry::get().config["ExtractParameter"];
+	for(auto I = extractSpecs.begin(), E = extractSpecs.end(); I != E; ++I)
+	{
+		if(!(*I)["method"] || !(*I)["variable"])
 		{
-			collectFunction(innerFN);
-		}
-		if (auto innerDC = dyn_cast<DeclContext>(*I)) {
-			// descend into the next level (namespace, etc.)
-			collectDeclContext(innerDC);
+			llvm::errs() << "ExtractParameter: every entry needs a method and a variable\n";
+			continue;
 		}
 
+		Extraction X;
+		X.variable = (*I)["variable"].as<string>();
+		X.hasDefault = false;
+		if((*I)["default"])
+		{
+			X.hasDefault = true;
+			X.defaultValue = (*I)["default"].as<string>();
+		}
+		specs[(*I)["method"].as<string>()].push_back(X);
 	}
 }
 
-void ExtractParameterTransform::collectFunction(const FunctionDecl *FN)
+const ExtractParameterTransform::Extractions *
+ExtractParameterTransform::getExtractions(const FunctionDecl *FN)
+{
+	FN = FN->getCanonicalDecl();
+	auto TI = targets.find(FN);
+	if(TI != targets.end())
+		return TI->second;
+
+	// the qualified name is only computed once per function
+	auto SI = specs.find(FN->getQualifiedNameAsString());
+	const Extractions *X = SI == specs.end() ? 0 : &SI->second;
+	targets[FN] = X;
+	return X;
+}
+
+string ExtractParameterTransform::getDecisionKey(const FunctionDecl *FN)
+{
+	// overloads are decided one by one
+	return FN->getQualifiedNameAsString() + " " + FN->getType().getCanonicalType().getAsString();
+}
+
+void ExtractParameterTransform::decide(const FunctionDecl *FN, bool accepted)
 {
-	if(FN->getQualifiedNameAsString() == extractMethodName)
+	ExtractionDecisions::get().decide(getDecisionKey(FN), accepted, *TransformRegistry::get().replacements);
+}
+
+bool ExtractParameterTransform::VisitFunctionDecl(FunctionDecl *FN)
+{
+	if(!FN->isThisDeclarationADefinition())
+		return true;
+
+	const Extractions *X = getExtractions(FN);
+	if(!X)
+		return true;
+
+	if(FN->isVariadic())
+	{
+		llvm::errs() << "ExtractParameter: cannot add a parameter to variadic function "
+		             << FN->getQualifiedNameAsString() << "\n";
+		decide(FN, false);
+		return true;
+	}
+
+	vector<const VarDecl*> values;
+	for(auto XI = X->begin(), XE = X->end(); XI != XE; ++XI)
 	{
 		for(auto I = FN->decls_begin(), E = FN->decls_end(); I != E; ++I)
 		{
-			if(auto valueDecl = dyn_cast<VarDecl>(*I))
+			auto valueDecl = dyn_cast<VarDecl>(*I);
+			if(valueDecl && !isa<ParmVarDecl>(valueDecl)
+			   && valueDecl->getNameAsString() == XI->variable)
 			{
-				if(valueDecl->getNameAsString() == extractVariableName)
-				{
-					rewrites[FN].push_back(valueDecl);
-				}
+				values.push_back(valueDecl);
+				break;
 			}
 		}
 	}
+
+	// the call sites are rewritten for every configured variable, so either
+	// all of them become parameters or none
+	if(values.size() != X->size())
+	{
+		llvm::errs() << "ExtractParameter: not every configured variable is declared in "
+		             << FN->getQualifiedNameAsString() << "\n";
+		decide(FN, false);
+		return true;
+	}
+
+	// without a configured default, the initializer becomes the default
+	// argument, which cannot refer to other locals or parameters
+	ASTContext &C = sema->getASTContext();
+	for(unsigned I = 0, E = values.size(); I != E; ++I)
+	{
+		const Expr *init = values[I]->getInit();
+		if((*X)[I].hasDefault || !init)
+			continue;
+		if(!refersToLocals(init) && (init->isEvaluatable(C)
+		   || init->isConstantInitializer(C, values[I]->getType()->isReferenceType())))
+			continue;
+		llvm::errs() << "ExtractParameter: the initializer of " << (*X)[I].variable << " in "
+		             << FN->getQualifiedNameAsString()
+		             << " is not a constant and cannot become a default argument; configure a default\n";
+		decide(FN, false);
+		return true;
+	}
+	rewrites[FN] = values;
+	decide(FN, true);
+	return true;
+}
+
+bool ExtractParameterTransform::VisitCallExpr(CallExpr *CE)
+{
+	// operators cannot take another argument
+	if(isa<CXXOperatorCallExpr>(CE))
+		return true;
+
+	auto FN = CE->getDirectCallee();
+	if(FN && getExtractions(FN))
+		calls.push_back(CE);
+	return true;
+}
+
+SourceLocation ExtractParameterTransform::getParameterInsertionLoc(const FunctionDecl *FN)
+{
+	if(FN->getNumParams()>0)
+	{
+		const ParmVarDecl *lastParam = FN->getParamDecl(FN->getNumParams()-1);
+		return getLocForEndOfToken(lastParam->getLocEnd());
+	}
+
+	TypeLoc TL = FN->getTypeSourceInfo()->getTypeLoc();
+	auto FTL = dyn_cast<FunctionTypeLoc>(&TL);
+	if(!FTL)
+		return SourceLocation();
+	return getLocForEndOfToken(FTL->getLocalRangeBegin());
+}
+
+string ExtractParameterTransform::getSourceText(SourceRange range)
+{
+	return Lexer::getSourceText(CharSourceRange::getTokenRange(range),
+	                            sema->getSourceManager(), sema->getLangOpts());
 }
 
 void ExtractParameterTransform::process()
@@ -78,41 +299,126 @@ void ExtractParameterTransform::process()
 	for(auto RI = rewrites.begin(), RE = rewrites.end(); RI != RE; ++RI)
 	{
 		const FunctionDecl *FN = RI->first;
-		list<const VarDecl*> values = RI->second;
-		SourceLocation insertionLoc;
+		const vector<const VarDecl*> &values = RI->second;
+		const Extractions *X = getExtractions(FN);
 
-		if(FN->getNumParams()>0)
-		{
-			const ParmVarDecl *lastParam = FN->getParamDecl(FN->getNumParams()-1);
-			insertionLoc = lastParam->getLocEnd();
-		}
-		else
-		{
-			TypeLoc TL = FN->getTypeSourceInfo()->getTypeLoc();
-			SourceLocation lParenLoc = dyn_cast<FunctionTypeLoc>(&TL)->getLocalRangeBegin();
-			insertionLoc = getLocForEndOfToken(lParenLoc);
-		}
-		vector<YAML::Node> transformData = TransformRegistry::get().config["ExtractParameter"].as<vector<YAML::Node> >();
-		for(auto CI = transformData.begin(), CE = transformData.end(); CI != CE; ++CI)
+		// every declaration gets the new parameters; only the first one may
+		// carry the default arguments
+		const FunctionDecl *firstDecl = FN->getFirstDeclaration();
+		for(auto DI = FN->redecls_begin(), DE = FN->redecls_end(); DI != DE; ++DI)
 		{
-			YAML::Node node = *CI;
-			if(node["method"].as<string>() == FN->getQualifiedNameAsString())
+			SourceLocation insertionLoc = getParameterInsertionLoc(*DI);
+			if(insertionLoc.isInvalid() || insertionLoc.isMacroID())
 			{
-				for(auto VI = values.begin(), VE = values.end(); VI != VE; ++VI)
+				llvm::errs() << "ExtractParameter: cannot find the parameter list of "
+				             << FN->getQualifiedNameAsString() << "\n";
+				continue;
+			}
+
+			string str;
+			for(auto VI = values.begin(), VE = values.end(); VI != VE; ++VI)
+			{
+				if(!str.empty() || DI->getNumParams()>0)
+					str += ", ";
+				str += (*VI)->getType().getAsString() + " " + (*VI)->getNameAsString();
+
+				if(*DI != firstDecl)
+					continue;
+
+				// without a default in the config, the variable's initializer
+				// keeps the behavior of existing callers
+				for(auto XI = X->begin(), XE = X->end(); XI != XE; ++XI)
 				{
-					if(node["variable"].as<string>() == (*VI)->getNameAsString())
-					{
-						string str = (*VI)->getType().getAsString() + " " + (*VI)->getNameAsString()
-							+ " = " + node["default"].as<string>();
-						insert(insertionLoc, str);
-						if(FN->hasBody())
-							removeDecl(FN->getBody(), *VI);
-						break;
-					}
+					if(XI->variable != (*VI)->getNameAsString())
+						continue;
+					if(XI->hasDefault)
+						str += " = " + XI->defaultValue;
+					else if((*VI)->getInit())
+						str += " = " + getSourceText((*VI)->getInit()->getSourceRange());
+					break;
 				}
 			}
+			insert(insertionLoc, str);
 		}
+
+		if(FN->hasBody())
+		{
+			for(auto VI = values.begin(), VE = values.end(); VI != VE; ++VI)
+				removeDecl(FN->getBody(), *VI);
+		}
+	}
+
+	for(auto CI = calls.begin(), CE = calls.end(); CI != CE; ++CI)
+		processCall(*CI);
+}
+
+// Passes the configured default explicitly, so the new argument is visible
+// at every call site. Variables without a configured default are left to
+// the default argument.
+void ExtractParameterTransform::processCall(const CallExpr *CE)
+{
+	auto FN = CE->getDirectCallee();
+	const Extractions *X = getExtractions(FN);
+	if(FN->isVariadic() || CE->getRParenLoc().isMacroID())
+		return;
+
+	// a definition that was not rewritten keeps its old signature, so its
+	// callers must keep theirs; without the definition in this translation
+	// unit, the one that has it decides
+	const FunctionDecl *definition;
+	ExtractionDecisions::Decision decision = ExtractionDecisions::Accepted;
+	if(FN->isDefined(definition))
+	{
+		if(!rewrites.count(definition))
+			return;
+	}
+	else
+	{
+		decision = ExtractionDecisions::get().lookup(getDecisionKey(FN));
+		if(decision == ExtractionDecisions::Rejected)
+			return;
+	}
+
+	string args;
+	unsigned numArgs = 0;
+	for(auto XI = X->begin(), XE = X->end(); XI != XE; ++XI)
+	{
+		if(!XI->hasDefault)
+			return;
+	}
+
+	// arguments left to their defaults must now be spelled out
+	for(unsigned I = 0, E = CE->getNumArgs(); I != E; ++I)
+	{
+		if(!isa<CXXDefaultArgExpr>(CE->getArg(I)))
+		{
+			numArgs++;
+			continue;
+		}
+
+		const ParmVarDecl *P = FN->getParamDecl(I);
+		if(!P->hasDefaultArg() || P->hasUninstantiatedDefaultArg())
+			return;
+		if(numArgs++ > 0)
+			args += ", ";
+		args += getSourceText(P->getDefaultArg()->getSourceRange());
+	}
+
+	for(auto XI = X->begin(), XE = X->end(); XI != XE; ++XI)
+	{
+		if(numArgs++ > 0)
+			args += ", ";
+		args += XI->defaultValue;
+	}
+
+	if(decision == ExtractionDecisions::Undecided)
+	{
+		SourceLocation loc = CE->getRParenLoc();
+		ExtractionDecisions::get().defer(getDecisionKey(FN),
+			Replacement(sema->getSourceManager(), CharSourceRange(SourceRange(loc, loc), false), args));
+		return;
 	}
+	insert(CE->getRParenLoc(), args);
 }
 
 void ExtractParameterTransform::removeDecl(const Stmt *stmt, const VarDecl *decl)
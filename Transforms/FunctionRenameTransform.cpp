@@ -30,6 +30,7 @@ void FunctionRenameTransform::HandleTranslationUnit(ASTContext &C)
   auto TUD = C.getTranslationUnitDecl();
   collectAndRenameFunctionDecl(TUD, true);
   processDeclContext(TUD, true);
+  flushMacroRenames();
 }
 
 void FunctionRenameTransform::collectAndRenameFunctionDecl(DeclContext *DC,
@@ -50,22 +51,12 @@ void FunctionRenameTransform::collectAndRenameFunctionDecl(DeclContext *DC,
     if (auto D = dyn_cast<FunctionDecl>(*I)) {
       // TODO: If it's a ctor/dtor, it's an error
       
+      // a method is also renamed if it overrides a renamed method
       std::string newName;
-      if (nameMatches(D, newName)) {
+      if (nameMatches(D, newName) ||
+          overriddenNameMatches(dyn_cast<CXXMethodDecl>(D), newName)) {
         renameLocation(D->getLocation(), newName);
       }
-
-      // see if it overrides a known method
-      pushIndent();
-      if (auto M = dyn_cast<CXXMethodDecl>(D)) {
-        for (auto MI = M->begin_overridden_methods(),
-             ME = M->end_overridden_methods(); MI != ME; ++MI) {
-          if (nameMatches(*MI, newName, true)) {
-            renameLocation(D->getLocation(), newName);
-          }
-        }
-      }
-      popIndent();
     }
     
     // descend into the next level (namespace, etc.)    
@@ -5,6 +5,8 @@
 #include "Transforms.h"
 
 #include <set>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringSet.h>
 #include <clang/Basic/SourceManager.h>
 #include <clang/Sema/Sema.h>
 #include <llvm/Support/raw_ostream.h>
@@ -19,7 +21,10 @@ public:
 	
   
 protected:
-	std::string movingClassName;
+	// the classes whose methods move into the current main file
+	llvm::StringSet<> movingClassNames;
+	// everything moved into the current main file, inserted in one go
+	std::string aggregateSource;
   
 	void processDeclContext(DeclContext *DC);
 	void processCXXRecordDecl(CXXRecordDecl *CRD);
@@ -42,17 +47,46 @@ REGISTER_TRANSFORM(MethodMoveTransform);
   
 void MethodMoveTransform::HandleTranslationUnit(ASTContext &C)
 {
-	auto movingSpec = TransformRegistry::get().config["MethodMove"].begin();
-	movingClassName = movingSpec->first.as<std::string>();
 	clang::SourceManager &SM = C.getSourceManager();
 	clang::FileManager &FM = SM.getFileManager();
-	if(FM.getFile(movingSpec->second.as<std::string>()) == SM.getFileEntryForID(SM.getMainFileID()))
+	auto MFE = SM.getFileEntryForID(SM.getMainFileID());
+
+	// group the classes by target file, so that every target is looked up
+	// once no matter how many classes move there
+	llvm::StringMap<std::vector<std::string> > classesByTarget;
+	auto movingSpecs = TransformRegistry::get().config["MethodMove"];
+	for(auto I = movingSpecs.begin(), E = movingSpecs.end(); I != E; ++I)
 	{
-		llvm::errs() << "MovingClassName: " << movingClassName << "\n";
-		llvm::errs() << SM.getFileEntryForID(SM.getMainFileID())->getName() << "\n";
-		auto TUD = C.getTranslationUnitDecl();
-		processDeclContext(TUD);
+		classesByTarget[I->second.as<std::string>()].push_back(I->first.as<std::string>());
 	}
+
+	movingClassNames.clear();
+	for(auto I = classesByTarget.begin(), E = classesByTarget.end(); I != E; ++I)
+	{
+		if(FM.getFile(I->getKey()) != MFE)
+			continue;
+
+		for(auto CI = I->getValue().begin(), CE = I->getValue().end(); CI != CE; ++CI)
+		{
+			llvm::errs() << "MovingClassName: " << *CI << "\n";
+			movingClassNames.insert(*CI);
+		}
+	}
+
+	if(movingClassNames.empty())
+		return;
+
+	llvm::errs() << MFE->getName() << "\n";
+	aggregateSource.clear();
+	processDeclContext(C.getTranslationUnitDecl());
+
+	if(aggregateSource.empty())
+		return;
+
+	// write the source
+	auto MFI = SM.getMainFileID();
+	auto LEOF = SM.getLocForEndOfFile(MFI);
+	insert(LEOF, aggregateSource);
 }
   
 void MethodMoveTransform::processDeclContext(DeclContext *DC)
@@ -73,7 +107,8 @@ void MethodMoveTransform::processCXXRecordDecl(CXXRecordDecl *CRD)
 	// // TODO: handle nested class
 	// processDeclContext(CRD);
   
-	if (movingClassName != CRD->getQualifiedNameAsString()) {
+	if (!CRD->isThisDeclarationADefinition() ||
+	    !movingClassNames.count(CRD->getQualifiedNameAsString())) {
 		return;
 	}
 
@@ -85,7 +120,6 @@ void MethodMoveTransform::processCXXRecordDecl(CXXRecordDecl *CRD)
   
 	std::string sourceHeader;
 	std::string sourceFooter;
-	std::string aggregateSource;
 	collectNamespaceInfo(CRD->getParent(), CRDRBL, sourceHeader, sourceFooter);
 
 	aggregateSource += "\n";
@@ -134,13 +168,6 @@ void MethodMoveTransform::processCXXRecordDecl(CXXRecordDecl *CRD)
 	}
   
 	aggregateSource += sourceFooter;
-
-
-	// write the source
-	auto MFI = sema->getSourceManager().getMainFileID();
-	auto LEOF = sema->getSourceManager().getLocForEndOfFile(MFI);
-	
-	insert(LEOF, aggregateSource);
 }
 
 void MethodMoveTransform::collectNamespaceInfo(DeclContext *DC,
@@ -3,17 +3,33 @@
 //
 
 #include "RenameTransforms.h"
+#include "IdentifierScanner.h"
+#include <clang/Lex/MacroInfo.h>
+#include <clang/Lex/Preprocessor.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/ADT/SmallPtrSet.h>
 
 using namespace clang;
 
 class RecordFieldRenameTransform : public RenameTransform {
 public:
+  RecordFieldRenameTransform() : bodiesSkipped(0), bodiesSeen(0) {}
   virtual void HandleTranslationUnit(ASTContext &);
   
 protected:
   void collectAndRenameFieldDecl(DeclContext *DC, bool topLevel = false);
   void processDeclContext(DeclContext *DC, bool topLevel = false);  
   void processStmt(Stmt *S);
+  void processBody(Stmt *B);
+  void prepareBodyScanner();
+
+private:
+  // Function bodies are only walked if their text mentions the name of a
+  // renamed field, or of a macro that expands to one.
+  llvm::SmallPtrSet<const IdentifierInfo *, 16> renamedFieldNames;
+  llvm::OwningPtr<IdentifierScanner> bodyScanner;
+  unsigned bodiesSkipped;
+  unsigned bodiesSeen;
 };
 
 REGISTER_TRANSFORM(RecordFieldRenameTransform);
@@ -27,7 +43,83 @@ void RecordFieldRenameTransform::HandleTranslationUnit(ASTContext &C)
   
   auto TUD = C.getTranslationUnitDecl();  
   collectAndRenameFieldDecl(TUD, true);
+  prepareBodyScanner();
   processDeclContext(TUD, true);
+  flushMacroRenames();
+
+  TransformRegistry::get().countSkipped("RecordFieldRename function bodies",
+                                       bodiesSkipped, bodiesSeen);
+}
+
+void RecordFieldRenameTransform::prepareBodyScanner()
+{
+  // a body may use a field only through a macro, possibly a macro using
+  // another macro, so the macros are added until nothing changes; the
+  // macro table is read once the TU is parsed so that no definition is
+  // missed, including those seen before the first token
+  Preprocessor &PP = sema->getPreprocessor();
+  llvm::SmallPtrSet<const IdentifierInfo *, 16> names(renamedFieldNames);
+  bool changed = !names.empty();
+  while (changed) {
+    changed = false;
+    for (auto I = PP.macro_begin(), E = PP.macro_end(); I != E; ++I) {
+      if (names.count(I->first)) {
+        continue;
+      }
+      const MacroInfo *MI = I->second;
+      for (auto TI = MI->tokens_begin(), TE = MI->tokens_end(); TI != TE;
+           ++TI) {
+        auto II = TI->getIdentifierInfo();
+        if (II && names.count(II)) {
+          names.insert(I->first);
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+
+  std::vector<std::string> literals;
+  for (auto I = names.begin(), E = names.end(); I != E; ++I) {
+    literals.push_back((*I)->getName());
+  }
+  if (!literals.empty()) {
+    bodyScanner.reset(
+      new IdentifierScanner(literals, IdentifierScanner::WholeIdentifier));
+  }
+}
+
+void RecordFieldRenameTransform::processBody(Stmt *B)
+{
+  bodiesSeen++;
+
+  // nothing is renamed in this TU
+  if (!bodyScanner) {
+    bodiesSkipped++;
+    return;
+  }
+
+  SourceManager &SM = sema->getSourceManager();
+  auto BL = B->getLocStart();
+  auto EL = B->getLocEnd();
+  if (BL.isFileID() && EL.isFileID()) {
+    auto BD = SM.getDecomposedLoc(BL);
+    auto ED = SM.getDecomposedLoc(EL);
+    bool invalid = false;
+    StringRef buffer = SM.getBufferData(BD.first, &invalid);
+    if (!invalid && BD.first == ED.first && BD.second <= ED.second &&
+        ED.second < buffer.size()) {
+      // the body ends with the one-character token }
+      const char *begin = buffer.data() + BD.second;
+      const char *end = buffer.data() + ED.second + 1;
+      if (bodyScanner->findFirst(begin, begin, end) == end) {
+        bodiesSkipped++;
+        return;
+      }
+    }
+  }
+
+  processStmt(B);
 }
 
 void RecordFieldRenameTransform::collectAndRenameFieldDecl(DeclContext *DC,
@@ -48,6 +140,10 @@ void RecordFieldRenameTransform::collectAndRenameFieldDecl(DeclContext *DC,
       if (nameMatches(D, newName)) {
         // llvm::errs() << indent() << "Rename to: " << newName << "\n";
         renameLocation(D->getLocation(), newName);
+        // an unnamed bit-field has no identifier to look for in bodies
+        if (auto II = D->getIdentifier()) {
+          renamedFieldNames.insert(II);
+        }
       }
     }
     
@@ -111,7 +207,7 @@ void RecordFieldRenameTransform::processDeclContext(DeclContext *DC,
       // handle body
       if (auto B = D->getBody()) {
         if (stmtInSameFileAsDecl(B, D)) {
-          processStmt(B);
+          processBody(B);
         }
       }
     }
@@ -125,7 +221,7 @@ void RecordFieldRenameTransform::processDeclContext(DeclContext *DC,
       // handle body
       if (auto B = D->getBody()) {
         if (stmtInSameFileAsDecl(B, D)) {
-          processStmt(B);
+          processBody(B);
         }
       }
     }
@@ -156,6 +252,7 @@ void RecordFieldRenameTransform::processStmt(Stmt *S)
     }
   }
   else if (auto E = dyn_cast<DeclRefExpr>(S)) {
+    // also member pointers, &Foo::field
     if (auto D = E->getDecl()) {
       std::string newName;
       if (nameMatches(D, newName, true)) {
@@ -163,6 +260,35 @@ void RecordFieldRenameTransform::processStmt(Stmt *S)
       }
     }
   }
+  else if (auto E = dyn_cast<InitListExpr>(S)) {
+    // designators such as { .field = 1 } only exist in the syntactic form
+    if (auto SF = E->getSyntacticForm()) {
+      processStmt(SF);
+      popIndent();
+      return;
+    }
+  }
+  else if (auto E = dyn_cast<DesignatedInitExpr>(S)) {
+    for (auto DI = E->designators_begin(), DE = E->designators_end();
+         DI != DE; ++DI) {
+      std::string newName;
+      if (DI->isFieldDesignator() &&
+          nameMatches(DI->getField(), newName, true)) {
+        renameLocation(DI->getFieldLoc(), newName);
+      }
+    }
+  }
+  else if (auto E = dyn_cast<OffsetOfExpr>(S)) {
+    // offsetof(struct Foo, a.b); a component's range ends at its name
+    for (unsigned I = 0, N = E->getNumComponents(); I != N; ++I) {
+      const OffsetOfExpr::OffsetOfNode &C = E->getComponent(I);
+      std::string newName;
+      if (C.getKind() == OffsetOfExpr::OffsetOfNode::Field &&
+          nameMatches(C.getField(), newName, true)) {
+        renameLocation(C.getSourceRange().getEnd(), newName);
+      }
+    }
+  }
 
   for (auto I = S->child_begin(), E = S->child_end(); I != E; ++I) {
     processStmt(*I);
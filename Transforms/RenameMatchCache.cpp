@@ -0,0 +1,237 @@
+//
+// RenameMatchCache.cpp
+//
+
+#include "RenameMatchCache.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Format.h>
+#include <fstream>
+
+using namespace std;
+
+llvm::sys::Mutex RenameMatchCache::registryLock;
+map<uint64_t, RenameMatchCache *> RenameMatchCache::registry;
+
+static const char *const CacheMagic = "refactorial-match-cache";
+
+RenameMatchCache &RenameMatchCache::get(uint64_t ruleSetHash)
+{
+  llvm::sys::ScopedLock L(registryLock);
+  auto I = registry.find(ruleSetHash);
+  if (I != registry.end()) {
+    return *I->second;
+  }
+
+  auto C = new RenameMatchCache(ruleSetHash);
+  registry[ruleSetHash] = C;
+  return *C;
+}
+
+bool RenameMatchCache::lookup(const string &USR, bool &outMatched,
+                              string &outNewName)
+{
+  llvm::sys::ScopedLock L(lock);
+  auto I = entries.find(USR);
+  if (I == entries.end()) {
+    misses++;
+    return false;
+  }
+
+  hits++;
+  outMatched = I->second.matched;
+  if (outMatched) {
+    outNewName = I->second.newName;
+  }
+  return true;
+}
+
+void RenameMatchCache::insert(const string &USR, bool matched,
+                              const string &newName)
+{
+  llvm::sys::ScopedLock L(lock);
+  llvm::StringMapEntry<Entry> &SE = entries.GetOrCreateValue(USR);
+  SE.getValue().matched = matched;
+  SE.getValue().newName = newName;
+  unshared.push_back(&SE);
+  dirty = true;
+}
+
+void RenameMatchCache::setPath(const string &P)
+{
+  llvm::sys::ScopedLock L(lock);
+  if (path == P) {
+    return;
+  }
+  path = P;
+  load();
+}
+
+bool RenameMatchCache::load()
+{
+  ifstream in(path.c_str());
+  if (!in) {
+    return false;
+  }
+
+  string magic;
+  uint64_t hash = 0;
+  in >> magic >> hex >> hash;
+  if (magic != CacheMagic || hash != ruleSetHash) {
+    llvm::errs() << "Ignoring match cache " << path
+                 << ": produced by a different rule set\n";
+    return false;
+  }
+  in.ignore(1);
+
+  // one entry per line: "M\t<usr>\t<new name>" or "U\t<usr>"
+  unsigned count = 0;
+  string line;
+  while (getline(in, line)) {
+    if (line.size() < 3 || line[1] != '\t') {
+      continue;
+    }
+
+    auto T = line.find('\t', 2);
+    Entry &E = entries[line.substr(2, T == string::npos ? T : T - 2)];
+    E.matched = line[0] == 'M';
+    if (E.matched && T != string::npos) {
+      E.newName = line.substr(T + 1);
+    }
+    count++;
+  }
+
+  llvm::errs() << "Loaded " << count << " match cache entries from "
+               << path << "\n";
+  return true;
+}
+
+bool RenameMatchCache::save()
+{
+  llvm::sys::ScopedLock L(lock);
+  if (path.empty() || !dirty) {
+    return true;
+  }
+
+  ofstream out(path.c_str());
+  if (!out) {
+    llvm::errs() << "Error: Cannot write match cache " << path << "\n";
+    return false;
+  }
+
+  out << CacheMagic << " " << hex << ruleSetHash << "\n";
+  for (auto I = entries.begin(), E = entries.end(); I != E; ++I) {
+    if (I->second.matched) {
+      out << "M\t" << I->first().str() << "\t" << I->second.newName << "\n";
+    }
+    else {
+      out << "U\t" << I->first().str() << "\n";
+    }
+  }
+
+  dirty = false;
+  return true;
+}
+
+void RenameMatchCache::saveAll()
+{
+  llvm::sys::ScopedLock L(registryLock);
+  for (auto I = registry.begin(), E = registry.end(); I != E; ++I) {
+    I->second->save();
+  }
+}
+
+void RenameMatchCache::takeUnshared(vector<string> &out)
+{
+  llvm::sys::ScopedLock L(registryLock);
+  for (auto I = registry.begin(), E = registry.end(); I != E; ++I) {
+    RenameMatchCache &C = *I->second;
+    llvm::sys::ScopedLock CL(C.lock);
+    if (C.unshared.empty() && C.hits == C.sharedHits &&
+        C.misses == C.sharedMisses) {
+      continue;
+    }
+
+    // "<rule set hash>\t<path>\t<hits>\t<misses>", then the entries in the
+    // format of the cache file
+    string text;
+    llvm::raw_string_ostream os(text);
+    os << llvm::format("%016llx", (unsigned long long)I->first) << "\t"
+       << C.path << "\t" << C.hits - C.sharedHits << "\t"
+       << C.misses - C.sharedMisses << "\n";
+    for (auto UI = C.unshared.begin(), UE = C.unshared.end(); UI != UE; ++UI) {
+      const Entry &entry = (*UI)->getValue();
+      if (entry.matched) {
+        os << "M\t" << (*UI)->getKey() << "\t" << entry.newName << "\n";
+      }
+      else {
+        os << "U\t" << (*UI)->getKey() << "\n";
+      }
+    }
+    out.push_back(os.str());
+
+    C.unshared.clear();
+    C.sharedHits = C.hits;
+    C.sharedMisses = C.misses;
+  }
+}
+
+void RenameMatchCache::mergeShared(llvm::StringRef text)
+{
+  pair<llvm::StringRef, llvm::StringRef> header = text.split('\n');
+  llvm::SmallVector<llvm::StringRef, 4> fields;
+  header.first.split(fields, "\t");
+  uint64_t hash;
+  unsigned sharedHits, sharedMisses;
+  if (fields.size() != 4 || fields[0].getAsInteger(16, hash) ||
+      fields[2].getAsInteger(10, sharedHits) ||
+      fields[3].getAsInteger(10, sharedMisses)) {
+    return;
+  }
+
+  RenameMatchCache &C = get(hash);
+  // the supervisor runs no transform, so the cache learns its path here
+  if (!fields[1].empty()) {
+    C.setPath(fields[1]);
+  }
+
+  llvm::sys::ScopedLock L(C.lock);
+  C.hits += sharedHits;
+  C.misses += sharedMisses;
+  // a worker forked later must not send them back
+  C.sharedHits = C.hits;
+  C.sharedMisses = C.misses;
+  C.unshared.clear();
+  llvm::StringRef rest = header.second;
+  while (!rest.empty()) {
+    pair<llvm::StringRef, llvm::StringRef> line = rest.split('\n');
+    rest = line.second;
+    if (line.first.size() < 3 || line.first[1] != '\t') {
+      continue;
+    }
+    pair<llvm::StringRef, llvm::StringRef> usr =
+      line.first.substr(2).split('\t');
+    Entry &E = C.entries[usr.first];
+    E.matched = line.first[0] == 'M';
+    E.newName = E.matched ? usr.second.str() : string();
+    C.dirty = true;
+  }
+}
+
+void RenameMatchCache::printStats(llvm::raw_ostream &OS)
+{
+  llvm::sys::ScopedLock L(registryLock);
+  for (auto I = registry.begin(), E = registry.end(); I != E; ++I) {
+    RenameMatchCache &C = *I->second;
+    llvm::sys::ScopedLock CL(C.lock);
+    unsigned total = C.hits + C.misses;
+    if (!total) {
+      continue;
+    }
+
+    OS << "Match cache " << llvm::format("%016llx", (unsigned long long)I->first)
+       << ": " << C.entries.size() << " decls, " << C.hits << "/" << total
+       << " lookups hit ("
+       << llvm::format("%.1f", 100.0 * C.hits / total) << "%)\n";
+  }
+}
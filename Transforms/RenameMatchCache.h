@@ -0,0 +1,72 @@
+//
+// RenameMatchCache.h: run-wide cache of rename rule matches, keyed by USR
+//
+
+#ifndef RENAME_MATCH_CACHE_H
+#define RENAME_MATCH_CACHE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Mutex.h>
+#include <llvm/Support/raw_ostream.h>
+
+// A declaration from a header is seen by every translation unit that
+// includes it. Rather than computing its qualified name and running the
+// rename regexes again in each of them, the outcome is recorded here once
+// per run. There is one cache per rule set, so different transforms or
+// config sections never see each other's results.
+class RenameMatchCache {
+public:
+  static RenameMatchCache &get(uint64_t ruleSetHash);
+
+  // returns false if USR has not been seen yet
+  bool lookup(const std::string &USR, bool &outMatched,
+              std::string &outNewName);
+  void insert(const std::string &USR, bool matched,
+              const std::string &newName);
+
+  // persist the cache between runs; entries are only loaded back if they
+  // were produced by the same rule set
+  void setPath(const std::string &path);
+  bool save();
+
+  static void saveAll();
+  static void printStats(llvm::raw_ostream &OS);
+
+  // a worker process hands what it learnt to the supervisor: takeUnshared()
+  // returns, per cache, the entries inserted and the lookups made since its
+  // last call, and mergeShared() adds one of those to the supervisor's cache
+  static void takeUnshared(std::vector<std::string> &out);
+  static void mergeShared(llvm::StringRef text);
+
+private:
+  RenameMatchCache(uint64_t hash)
+    : ruleSetHash(hash), hits(0), misses(0), sharedHits(0), sharedMisses(0),
+      dirty(false) {}
+  bool load();
+
+  struct Entry {
+    bool matched;
+    std::string newName;
+  };
+
+  uint64_t ruleSetHash;
+  std::string path;
+  llvm::StringMap<Entry> entries;
+  std::vector<const llvm::StringMapEntry<Entry> *> unshared;
+  unsigned hits;
+  unsigned misses;
+  unsigned sharedHits;
+  unsigned sharedMisses;
+  bool dirty;
+  llvm::sys::Mutex lock;
+
+  static llvm::sys::Mutex registryLock;
+  static std::map<uint64_t, RenameMatchCache *> registry;
+};
+
+#endif
@@ -0,0 +1,165 @@
+//
+// RenameRules.cpp
+//
+
+#include "RenameRules.h"
+#include "hash-util.h"
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/DeclObjC.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <string.h>
+
+using namespace clang;
+
+bool RenameRules::load(const YAML::Node &config,
+                       const std::string &transformName,
+                       const std::string &renameKeyName,
+                       const std::string &ignoreKeyName,
+                       bool verbose)
+{
+  auto S = config[transformName];
+  if (!S.IsMap()) {
+    llvm::errs() << "Error: Cannot find config entry \"" << transformName
+                 << "\" or entry is not a map\n";
+    return false;
+  }
+
+  auto IG = S[ignoreKeyName];
+
+  if (IG && !IG.IsSequence()) {
+    llvm::errs() << "Error: Config key \"" << ignoreKeyName
+                 << "\" must be a sequence\n";
+    return false;
+  }
+
+  for (auto I = IG.begin(), E = IG.end(); I != E; ++I) {
+    if (I->IsScalar()) {
+      auto P = I->as<std::string>();
+      ignoreList.push_back(pcrecpp::RE(P));
+      if (verbose) {
+        llvm::errs() << "Ignoring: " << P << "\n";
+      }
+    }
+  }
+
+  auto RN = S[renameKeyName];
+  if (!RN.IsSequence()) {
+    llvm::errs() << "\"" << renameKeyName << "\" is not specified or is"
+                 << " not a sequence\n";
+    return false;
+  }
+
+  std::string ruleSetText = transformName + "\n";
+
+  for (auto I = RN.begin(), E = RN.end(); I != E; ++I) {
+    if (!I->IsMap()) {
+      llvm::errs() << "Error: \"" << renameKeyName
+                   << "\" contains non-map items\n";
+      return false;
+    }
+
+    for (auto MI = I->begin(), ME = I->end(); MI != ME; ++MI) {
+      auto F = MI->first.as<std::string>();
+      auto T = MI->second.as<std::string>();
+      pcrecpp::RE re(F);
+      renameList.push_back(REStringPair(re, T));
+      ruleSetText += F + "\t" + T + "\n";
+
+      if (verbose) {
+        llvm::errs() << "renames: " << F << " -> " << T << "\n";
+      }
+    }
+  }
+
+  // the persisted match results depend on how the keys are spelled too
+  hash = hashString(ruleSetText,
+                    hashString("match keys " + llvm::utostr(MatchKeyVersion)));
+  return true;
+}
+
+bool RenameRules::isIgnored(const std::string &fileName) const
+{
+  for (auto I = ignoreList.begin(), E = ignoreList.end(); I != E; ++I) {
+    if (I->FullMatch(fileName)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool RenameRules::match(const std::string &name,
+                        std::string &outNewName) const
+{
+  for (auto I = renameList.begin(), E = renameList.end(); I != E; ++I) {
+    if (I->first.FullMatch(name)) {
+      std::string newName;
+      I->first.Extract(I->second, name, &newName);
+      outNewName = newName;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+std::vector<std::string> RenameRules::getPatterns() const
+{
+  std::vector<std::string> patterns;
+  for (auto I = renameList.begin(), E = renameList.end(); I != E; ++I) {
+    patterns.push_back(I->first.pattern());
+  }
+  return patterns;
+}
+
+std::string RenameRules::getMatchKey(const NamedDecl *D)
+{
+  auto QN = D->getQualifiedNameAsString();
+  if (QN.size() == 0) {
+    return QN;
+  }
+
+  // special handling for TagDecl
+  if (auto T = llvm::dyn_cast<TagDecl>(D)) {
+    auto KN = T->getKindName();
+    assert(KN && "getKindName() must return a non-NULL value");
+    QN.insert(0, KN);
+    QN.insert(strlen(KN), " ");
+  }
+
+  // an Objective-C category is matched as Class(Category)
+  const ObjCInterfaceDecl *CI = 0;
+  if (auto C = llvm::dyn_cast<ObjCCategoryDecl>(D)) {
+    CI = C->getClassInterface();
+  }
+  else if (auto C = llvm::dyn_cast<ObjCCategoryImplDecl>(D)) {
+    CI = C->getClassInterface();
+  }
+  if (CI) {
+    QN = CI->getNameAsString() + "(" + QN + ")";
+  }
+
+  return QN;
+}
+
+bool RenameRules::getRenameKeyName(const std::string &transformName,
+                                   std::string &outKeyName)
+{
+  if (transformName == "TypeRename") {
+    outKeyName = "Types";
+  }
+  else if (transformName == "FunctionRename") {
+    outKeyName = "Functions";
+  }
+  else if (transformName == "RecordFieldRename") {
+    outKeyName = "Fields";
+  }
+  else {
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,66 @@
+//
+// RenameRules.h: the Ignore and rename rules of a rename transform
+//
+
+#ifndef RENAME_RULES_H
+#define RENAME_RULES_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <pcrecpp.h>
+#include <yaml-cpp/yaml.h>
+
+namespace clang {
+  class NamedDecl;
+}
+
+class RenameRules {
+public:
+  RenameRules() : hash(0) {}
+
+  // reads the rules from the config entry of transformName, e.g.
+  //
+  //   TypeRename:
+  //     Ignore:
+  //       - /usr/.*
+  //     Types:
+  //       - class Tree(.*): Trie\1
+  bool load(const YAML::Node &config,
+            const std::string &transformName,
+            const std::string &renameKeyName,
+            const std::string &ignoreKeyName = "Ignore",
+            bool verbose = true);
+
+  bool isIgnored(const std::string &fileName) const;
+  bool match(const std::string &name, std::string &outNewName) const;
+
+  // identifies the rule set, e.g. for caches that outlive a transform
+  uint64_t getHash() const { return hash; }
+
+  // the patterns of the rename rules, in config order
+  std::vector<std::string> getPatterns() const;
+
+  // the string rename rules are matched against: the fully-qualified name,
+  // prefixed with the kind name ("class", "struct", ...) for tag types;
+  // Objective-C categories are Class(Category)
+  static std::string getMatchKey(const clang::NamedDecl *D);
+
+  // changes whenever getMatchKey() spells a declaration differently, so
+  // that match caches and indexes holding the old keys are not used
+  static const unsigned MatchKeyVersion = 2;
+
+  // the key of the rename list for the built-in rename transforms, e.g.
+  // "Types" for "TypeRename"; returns false for other transforms
+  static bool getRenameKeyName(const std::string &transformName,
+                               std::string &outKeyName);
+
+private:
+  std::vector<pcrecpp::RE> ignoreList;
+  typedef std::pair<pcrecpp::RE, std::string> REStringPair;
+  std::vector<REStringPair> renameList;
+  uint64_t hash;
+};
+
+#endif
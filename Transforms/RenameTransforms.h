@@ -2,63 +2,37 @@
 #define RENAME_TRANSFORMS_H
 
 #include "Transforms.h"
-#include <pcrecpp.h>
+#include "RenameMatchCache.h"
+#include "RenameRules.h"
+#include "USRGeneration.h"
+#include "hash-util.h"
+#include <clang/AST/DeclCXX.h>
 #include <clang/Lex/Preprocessor.h>
 
 class RenameTransform : public Transform {
 public:
-  RenameTransform() : indentLevel(0) {}
+  RenameTransform()
+    : indentLevel(0), matchCache(0), overrideCache(0), renameCount(0) {}
 protected:
   // utility functions shared by all rename transforms
   
   bool loadConfig(const std::string& transformName,                        
                   const std::string& renameKeyName,
                   const std::string& ignoreKeyName = "Ignore") {
-    auto S = TransformRegistry::get().config[transformName];
-    if (!S.IsMap()) {
-      llvm::errs() << "Error: Cannot find config entry \"" << transformName
-                   << "\" or entry is not a map\n";
+    auto &config = TransformRegistry::get().config;
+    if (!rules.load(config, transformName, renameKeyName, ignoreKeyName)) {
       return false;
     }
 
-    auto IG = S[ignoreKeyName];
+    matchCache = &RenameMatchCache::get(rules.getHash());
+    // never persisted: whether a method inherits a rename depends on the
+    // class hierarchy, which the USR does not capture
+    overrideCache = &RenameMatchCache::get(hashString("overrides",
+                                                      rules.getHash()));
 
-    if (IG && !IG.IsSequence()) {
-      llvm::errs() << "Error: Config key \"" << ignoreKeyName
-                   << "\" must be a sequence\n";
-      return false;
-    }
-
-    for (auto I = IG.begin(), E = IG.end(); I != E; ++I) {
-      if (I->IsScalar()) {
-        auto P = I->as<std::string>();
-        ignoreList.push_back(pcrecpp::RE(P));
-        llvm::errs() << "Ignoring: " << P << "\n";
-      }
-    }
-
-    auto RN = S[renameKeyName];
-    if (!RN.IsSequence()) {
-      llvm::errs() << "\"" << renameKeyName << "\" is not specified or is"
-                   << " not a sequence\n";
-      return false;
-    }
-
-    for (auto I = RN.begin(), E = RN.end(); I != E; ++I) {
-      if (!I->IsMap()) {
-        llvm::errs() << "Error: \"" << renameKeyName
-                     << "\" contains non-map items\n";
-        return false;
-      }
-
-      for (auto MI = I->begin(), ME = I->end(); MI != ME; ++MI) {
-        auto F = MI->first.as<std::string>();
-        auto T = MI->second.as<std::string>();      
-        pcrecpp::RE re(F);
-        renameList.push_back(REStringPair(re, T));
-
-        llvm::errs() << "renames: " << F << " -> " << T << "\n";
-      }
+    auto MC = config[transformName]["MatchCache"];
+    if (MC && MC.IsScalar()) {
+      matchCache->setPath(MC.as<std::string>());
     }
     
     return true;
@@ -86,15 +60,7 @@ protected:
       }
     }
 
-    auto FN = FE->getName();
-
-    for (auto I = ignoreList.begin(), E = ignoreList.end(); I != E; ++I) {
-      if (I->FullMatch(FN)) {
-        return true;
-      }
-    }
-
-    return false;
+    return rules.isIgnored(FE->getName());
   }
   
   // if we have a NamedDecl and the fully-qualified name matches
@@ -119,33 +85,78 @@ protected:
     if (!D->getLocation().isValid()) {
       return false;
     }
+
+    // a declaration from a header has most likely been matched already
+    // while processing another translation unit
+    std::string usr;
+    if (matchCache) {
+      usr = getUSRForDecl(D);
+    }
+    
+    bool matched;
+    if (!usr.empty() && matchCache->lookup(usr, matched, outNewName)) {
+      if (matched) {
+        nameMap[D] = outNewName;
+      }
+      return matched;
+    }
         
-    auto QN = D->getQualifiedNameAsString();
-    if (QN.size() == 0) {
+    auto QN = RenameRules::getMatchKey(D);
+    std::string newName;
+    matched = QN.size() && rules.match(QN, newName);
+    if (matched) {
+      nameMap[D] = newName;
+      outNewName = newName;
+    }
+
+    if (!usr.empty()) {
+      matchCache->insert(usr, matched, newName);
+    }
+    return matched;
+  }
+  
+  // A method overriding a renamed method is renamed with it, however deep
+  // the hierarchy. The chain of overridden methods is always declared in
+  // the translation unit, so it is resolved here instead of relying on the
+  // base having been visited first; the outcome is kept per USR for the
+  // rest of the run.
+  bool overriddenNameMatches(const clang::CXXMethodDecl *M,
+                             std::string &outNewName) {
+    if (!M || !M->size_overridden_methods()) {
       return false;
     }
-    
-    // special handling for TagDecl
-    if (auto T = llvm::dyn_cast<clang::TagDecl>(D)) {
-      auto KN = T->getKindName();
-      assert(KN && "getKindName() must return a non-NULL value");
-      QN.insert(0, KN);
-      QN.insert(strlen(KN), " ");
+
+    std::string usr;
+    if (overrideCache) {
+      usr = getUSRForDecl(M);
     }
-    
-    for (auto I = renameList.begin(), E = renameList.end(); I != E; ++I) {
-      if (I->first.FullMatch(QN)) {
-        std::string newName;
-        I->first.Extract(I->second, QN, &newName);
-        nameMap[D] = newName;
-        outNewName = newName;
-        return true;
+
+    bool matched;
+    if (!usr.empty() && overrideCache->lookup(usr, matched, outNewName)) {
+      if (matched) {
+        nameMap[M] = outNewName;
       }
+      return matched;
     }
-  
-    return false;
+
+    matched = false;
+    std::string newName;
+    for (auto I = M->begin_overridden_methods(),
+         E = M->end_overridden_methods(); I != E && !matched; ++I) {
+      matched = nameMatches(*I, newName) ||
+                overriddenNameMatches(*I, newName);
+    }
+
+    if (matched) {
+      nameMap[M] = newName;
+      outNewName = newName;
+    }
+    if (!usr.empty()) {
+      overrideCache->insert(usr, matched, newName);
+    }
+    return matched;
   }
-  
+
   // useful when we can't just rely on Decl, e.g. built-in type
   // unmatched names are cached to speed things up
   bool stringMatches(std::string name, std::string &outNewName) {
@@ -160,14 +171,11 @@ protected:
       return false;
     }
 
-    for (auto I = renameList.begin(), E = renameList.end(); I != E; ++I) {
-      if (I->first.FullMatch(name)) {
-        std::string newName;
-        I->first.Extract(I->second, name, &newName);
-        matchedStringMap[name] = newName;
-        outNewName = newName;
-        return true;
-      }
+    std::string newName;
+    if (rules.match(name, newName)) {
+      matchedStringMap[name] = newName;
+      outNewName = newName;
+      return true;
     }
     
     unmatchedStringSet.insert(name);
@@ -181,66 +189,65 @@ protected:
     return FSL1.getFileID() == FSL2.getFileID();    
   }
   
+  // the number of renameLocation calls so far in this translation unit
+  unsigned getRenameCount() const {
+    return renameCount;
+  }
+
   void renameLocation(clang::SourceLocation L, std::string& N) {
-    if (L.isValid()) {
-      if (L.isMacroID()) {        
-        // TODO: emit error using diagnostics
-        clang::SourceManager &SM = sema->getSourceManager();
-        if (SM.isMacroArgExpansion(L) || SM.isInSystemMacro(L)) {
-          // see if it's the macro expansion we can handle
-          // e.g.
-          //   #define call(x) x
-          //   call(y());   // if we want to rename y()
-          L = SM.getSpellingLoc(L);
-          
-          // this falls through to the rename routine below
-        }
-        else {
-          // if the spelling location is from an actual file that we can
-          // touch, then do the replacement, but show a warning          
-          clang::SourceManager &SM = sema->getSourceManager();
-          auto SL = SM.getSpellingLoc(L);
-          clang::FullSourceLoc FSL(SL, SM);
-          const clang::FileEntry *FE = SM.getFileEntryForID(FSL.getFileID());
-          if (FE) {
-            llvm::errs() << "Warning: Rename attempted as a result of macro "
-                         << "expansion may break things, at: " << loc(L) << "\n";            
-            L = SL;
-            // this falls through to the rename routine below
-          }
-          else {
-            // cannot handle this case
-            llvm::errs() << "Error: Token is resulted from macro expansion"
-              " and is therefore not renamed, at: " << loc(L) << "\n";
-            return;
-          }
-        }
+    renameCount++;
+    if (!L.isValid()) {
+      return;
+    }
+
+    if (L.isMacroID()) {
+      clang::SourceManager &SM = sema->getSourceManager();
+      if (SM.isMacroArgExpansion(L) || SM.isInSystemMacro(L)) {
+        // see if it's the macro expansion we can handle
+        // e.g.
+        //   #define call(x) x
+        //   call(y());   // if we want to rename y()
+        renameToken(SM.getSpellingLoc(L), N);
       }
-      
-      if (shouldIgnore(L)) {
-        return;
+      else {
+        // the token is spelled in a macro definition, which is shared by
+        // all of its expansions; decide once per definition, at the end of
+        // the translation unit
+        addMacroRename(L, N);
       }
-      
-      clang::Preprocessor &P = sema->getPreprocessor();      
-      auto LE = P.getLocForEndOfToken(L);
-      if (LE.isValid()) {
-        
-        // getLocWithOffset returns the location *past* the token, hence -1
-        auto E = LE.getLocWithOffset(-1);
-        
-        // TODO: Determine if it's a wrtiable file
-        
-        // TODO: Determine if the location has already been touched or
-        // needs skipping (such as in refactoring API user's code, then
-        // the API headers need no changing since later the new API will be
-        // in place)
-        
-        // llvm::errs() << "rep: " << loc(L) << ", " << loc(E) << "\n";
-        replace(clang::SourceRange(L, E), N);
+      return;
+    }
+
+    renameToken(L, N);
+  }
+
+  // Renames the tokens spelled in macro definitions recorded during this
+  // translation unit. To be called at the end of HandleTranslationUnit.
+  void flushMacroRenames() {
+    clang::SourceManager &SM = sema->getSourceManager();
+    for (auto I = macroRenames.begin(), E = macroRenames.end(); I != E; ++I) {
+      MacroRename &R = I->second;
+      auto SL = clang::SourceLocation::getFromRawEncoding(I->first);
+      if (R.conflict) {
+        llvm::errs() << "Error: Macro definition at: " << loc(SL)
+                     << " is renamed differently by its " << R.uses
+                     << " uses and is therefore not renamed\n";
+      }
+      else if (!SM.getFileEntryForID(SM.getFileID(SL))) {
+        // e.g. a token pasted together with ##
+        llvm::errs() << "Error: Token is resulted from macro expansion"
+          " and is therefore not renamed, at: " << loc(R.firstExpansion)
+          << " (" << R.uses << " uses)\n";
       }
-    }    
+      else {
+        llvm::errs() << "Warning: Rename in macro definition (" << R.uses
+                     << " uses) may break things, at: " << loc(SL) << "\n";
+        renameToken(SL, R.newName);
+      }
+    }
+    macroRenames.clear();
   }
-    
+
   const std::string& indent() {    
     return indentString;
   }
@@ -275,16 +282,71 @@ protected:
   }
   
 private:
+  struct MacroRename {
+    std::string newName;
+    clang::SourceLocation firstExpansion;
+    unsigned uses;
+    bool conflict;
+  };
+
+  void addMacroRename(clang::SourceLocation L, const std::string &N) {
+    clang::SourceManager &SM = sema->getSourceManager();
+    unsigned key = SM.getSpellingLoc(L).getRawEncoding();
+    auto I = macroRenames.find(key);
+    if (I == macroRenames.end()) {
+      MacroRename R;
+      R.newName = N;
+      R.firstExpansion = L;
+      R.uses = 1;
+      R.conflict = false;
+      macroRenames[key] = R;
+      return;
+    }
+
+    I->second.uses++;
+    if (I->second.newName != N) {
+      I->second.conflict = true;
+    }
+  }
+
+  void renameToken(clang::SourceLocation L, const std::string &N) {
+    if (shouldIgnore(L)) {
+      return;
+    }
+    
+    clang::Preprocessor &P = sema->getPreprocessor();      
+    auto LE = P.getLocForEndOfToken(L);
+    if (LE.isValid()) {
+      
+      // getLocWithOffset returns the location *past* the token, hence -1
+      auto E = LE.getLocWithOffset(-1);
+      
+      // TODO: Determine if it's a wrtiable file
+      
+      // TODO: Determine if the location has already been touched or
+      // needs skipping (such as in refactoring API user's code, then
+      // the API headers need no changing since later the new API will be
+      // in place)
+      
+      // llvm::errs() << "rep: " << loc(L) << ", " << loc(E) << "\n";
+      replace(clang::SourceRange(L, E), N);
+    }
+  }
+
   int indentLevel;
   std::string indentString;
 
-  std::vector<pcrecpp::RE> ignoreList;
-  typedef std::pair<pcrecpp::RE, std::string> REStringPair;
-  std::vector<REStringPair> renameList;
+  RenameRules rules;
 
   std::map<const clang::Decl *, std::string> nameMap;
+  RenameMatchCache *matchCache;
+  RenameMatchCache *overrideCache;
   std::map<std::string, std::string> matchedStringMap;
   std::set<std::string> unmatchedStringSet;
+  unsigned renameCount;
+
+  // tokens spelled in macro definitions, by raw spelling location
+  std::map<unsigned, MacroRename> macroRenames;
 };
 
 #endif
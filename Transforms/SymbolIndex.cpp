@@ -0,0 +1,493 @@
+//
+// SymbolIndex.cpp
+//
+
+#include "SymbolIndex.h"
+#include "RenameRules.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <fstream>
+#include <limits.h>
+#include <sstream>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static const char *const IndexMagic = "refactorial-index";
+// bumped whenever the format or RenameRules::MatchKeyVersion changes; 4
+// has Objective-C categories keyed as Class(Category)
+static const unsigned IndexVersion = 4;
+
+SymbolIndex &SymbolIndex::get()
+{
+  static SymbolIndex instance;
+  return instance;
+}
+
+bool SymbolIndex::Ref::operator<(const Ref &R) const
+{
+  if (file != R.file) {
+    return file < R.file;
+  }
+  if (offset != R.offset) {
+    return offset < R.offset;
+  }
+  if (symbol != R.symbol) {
+    return symbol < R.symbol;
+  }
+  return length < R.length;
+}
+
+void SymbolIndex::Builder::addFile(const string &file)
+{
+  files.insert(file);
+}
+
+void SymbolIndex::Builder::addOccurrence(SymbolKind kind, const string &usr,
+                                         const string &matchKey,
+                                         const string &file, unsigned offset,
+                                         unsigned length)
+{
+  Symbol &S = symbols[usr];
+  S.kind = kind;
+  S.matchKey = matchKey;
+
+  Ref R;
+  R.usr = usr;
+  R.file = file;
+  R.offset = offset;
+  R.length = length;
+  refs.push_back(R);
+}
+
+void SymbolIndex::Builder::addOverride(const string &usr,
+                                       const string &overriddenUSR)
+{
+  overrides.insert(make_pair(usr, overriddenUSR));
+}
+
+string SymbolIndex::getAbsolutePath(const string &path)
+{
+  llvm::SmallString<256> P(path);
+  llvm::sys::fs::make_absolute(P);
+  return P.str();
+}
+
+bool SymbolIndex::getSymbolKind(const string &transformName,
+                                SymbolKind &outKind)
+{
+  if (transformName == "TypeRename") {
+    outKind = TypeSymbol;
+  }
+  else if (transformName == "FunctionRename") {
+    outKind = FunctionSymbol;
+  }
+  else if (transformName == "RecordFieldRename") {
+    outKind = FieldSymbol;
+  }
+  else {
+    return false;
+  }
+
+  return true;
+}
+
+bool SymbolIndex::statFile(const string &path, uint64_t &mtime,
+                           uint64_t &size)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st)) {
+    return false;
+  }
+  // in nanoseconds: a same-length edit within the same second must still
+  // make the file stale
+#ifdef __APPLE__
+  uint64_t nsec = st.st_mtimespec.tv_nsec;
+#else
+  uint64_t nsec = st.st_mtim.tv_nsec;
+#endif
+  mtime = (uint64_t)st.st_mtime * 1000000000ULL + nsec;
+  size = st.st_size;
+  return true;
+}
+
+void SymbolIndex::invalidate(const set<string> &realPaths)
+{
+  llvm::sys::ScopedLock L(lock);
+  if (realPaths.empty()) {
+    return;
+  }
+
+  // a zero mtime never matches the file, so every translation unit that
+  // includes it is indexed again
+  char resolved[PATH_MAX];
+  for (auto I = files.begin(), E = files.end(); I != E; ++I) {
+    string path = realpath(I->path.c_str(), resolved) ? resolved : I->path;
+    if (realPaths.count(path)) {
+      I->mtime = 0;
+      I->size = 0;
+    }
+  }
+}
+
+unsigned SymbolIndex::fileId(const string &path)
+{
+  auto I = fileIds.find(path);
+  if (I != fileIds.end()) {
+    return I->second;
+  }
+
+  FileInfo F;
+  F.path = path;
+  F.mtime = 0;
+  F.size = 0;
+  files.push_back(F);
+  fileIds[path] = files.size() - 1;
+  return files.size() - 1;
+}
+
+unsigned SymbolIndex::symbolId(const string &usr, SymbolKind kind,
+                               const string &matchKey)
+{
+  auto I = symbolIds.find(usr);
+  if (I != symbolIds.end()) {
+    return I->second;
+  }
+
+  Symbol S;
+  S.usr = usr;
+  S.kind = kind;
+  S.matchKey = matchKey;
+  symbols.push_back(S);
+  symbolIds[usr] = symbols.size() - 1;
+  return symbols.size() - 1;
+}
+
+void SymbolIndex::commit(const string &mainFile, const Builder &B)
+{
+  llvm::sys::ScopedLock L(lock);
+
+  Unit &U = units[getAbsolutePath(mainFile)];
+  U.files.clear();
+  U.symbols.clear();
+
+  for (auto I = B.files.begin(), E = B.files.end(); I != E; ++I) {
+    unsigned id = fileId(*I);
+    U.files.push_back(id);
+
+    // references into a file that changed since it was last indexed are
+    // gone; the ones that still exist are about to be added again
+    uint64_t mtime = 0, size = 0;
+    statFile(*I, mtime, size);
+    FileInfo &F = files[id];
+    if (F.mtime != mtime || F.size != size) {
+      for (auto RI = refs.begin(); RI != refs.end(); ) {
+        if (RI->file == id) {
+          refs.erase(RI++);
+        }
+        else {
+          ++RI;
+        }
+      }
+      F.mtime = mtime;
+      F.size = size;
+    }
+  }
+
+  for (auto I = B.symbols.begin(), E = B.symbols.end(); I != E; ++I) {
+    U.symbols.push_back(symbolId(I->first, I->second.kind,
+                                 I->second.matchKey));
+  }
+
+  for (auto I = B.overrides.begin(), E = B.overrides.end(); I != E; ++I) {
+    auto SI = symbolIds.find(I->first);
+    auto OI = symbolIds.find(I->second);
+    if (SI != symbolIds.end() && OI != symbolIds.end()) {
+      overrides.insert(make_pair(SI->second, OI->second));
+    }
+  }
+
+  for (auto I = B.refs.begin(), E = B.refs.end(); I != E; ++I) {
+    Ref R;
+    R.symbol = symbolIds[I->usr];
+    R.file = fileId(I->file);
+    R.offset = I->offset;
+    R.length = I->length;
+    refs.insert(R);
+  }
+}
+
+vector<string>
+SymbolIndex::staleTranslationUnits(const vector<string> &sourcePaths)
+{
+  llvm::sys::ScopedLock L(lock);
+
+  vector<string> stale;
+  map<unsigned, bool> changed;
+  for (auto I = sourcePaths.begin(), E = sourcePaths.end(); I != E; ++I) {
+    auto UI = units.find(getAbsolutePath(*I));
+    if (UI == units.end()) {
+      stale.push_back(*I);
+      continue;
+    }
+
+    const Unit &U = UI->second;
+    for (auto FI = U.files.begin(), FE = U.files.end(); FI != FE; ++FI) {
+      auto CI = changed.find(*FI);
+      if (CI == changed.end()) {
+        uint64_t mtime = 0, size = 0;
+        const FileInfo &F = files[*FI];
+        bool c = !statFile(F.path, mtime, size) ||
+                 F.mtime != mtime || F.size != size;
+        CI = changed.insert(make_pair(*FI, c)).first;
+      }
+
+      if (CI->second) {
+        stale.push_back(*I);
+        break;
+      }
+    }
+  }
+
+  return stale;
+}
+
+vector<string>
+SymbolIndex::translationUnitsMatching(const RenameRules &rules,
+                                      SymbolKind kind,
+                                      const vector<string> &sourcePaths,
+                                      unsigned *outOccurrences)
+{
+  llvm::sys::ScopedLock L(lock);
+
+  vector<bool> matched(symbols.size(), false);
+  for (unsigned I = 0, E = symbols.size(); I != E; ++I) {
+    std::string newName;
+    matched[I] = symbols[I].kind == kind &&
+                 rules.match(symbols[I].matchKey, newName);
+  }
+
+  // a renamed virtual method takes its overriders along, however deep the
+  // hierarchy goes
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (auto I = overrides.begin(), E = overrides.end(); I != E; ++I) {
+      if (matched[I->second] && !matched[I->first]) {
+        matched[I->first] = true;
+        changed = true;
+      }
+    }
+  }
+
+  vector<string> result;
+  for (auto I = sourcePaths.begin(), E = sourcePaths.end(); I != E; ++I) {
+    auto UI = units.find(getAbsolutePath(*I));
+    if (UI == units.end()) {
+      // not indexed, so we cannot rule it out
+      result.push_back(*I);
+      continue;
+    }
+
+    const Unit &U = UI->second;
+    for (auto SI = U.symbols.begin(), SE = U.symbols.end(); SI != SE; ++SI) {
+      if (matched[*SI]) {
+        result.push_back(*I);
+        break;
+      }
+    }
+  }
+
+  if (outOccurrences) {
+    unsigned count = 0;
+    for (auto I = refs.begin(), E = refs.end(); I != E; ++I) {
+      if (matched[I->symbol] && !rules.isIgnored(files[I->file].path)) {
+        count++;
+      }
+    }
+    *outOccurrences = count;
+  }
+
+  return result;
+}
+
+bool SymbolIndex::includedFiles(const string &sourcePath,
+                                vector<string> &outFiles)
+{
+  llvm::sys::ScopedLock L(lock);
+
+  auto UI = units.find(getAbsolutePath(sourcePath));
+  if (UI == units.end()) {
+    return false;
+  }
+
+  const Unit &U = UI->second;
+  for (auto I = U.files.begin(), E = U.files.end(); I != E; ++I) {
+    outFiles.push_back(files[*I].path);
+  }
+  return true;
+}
+
+vector<SymbolIndex::Occurrence> SymbolIndex::getOccurrences(const string &usr)
+{
+  llvm::sys::ScopedLock L(lock);
+
+  vector<Occurrence> result;
+  auto SI = symbolIds.find(usr);
+  if (SI == symbolIds.end()) {
+    return result;
+  }
+
+  for (auto I = refs.begin(), E = refs.end(); I != E; ++I) {
+    if (I->symbol == SI->second) {
+      Occurrence O;
+      O.file = files[I->file].path;
+      O.offset = I->offset;
+      O.length = I->length;
+      result.push_back(O);
+    }
+  }
+  return result;
+}
+
+static void joinIds(ostream &out, const vector<unsigned> &ids)
+{
+  for (auto I = ids.begin(), E = ids.end(); I != E; ++I) {
+    if (I != ids.begin()) {
+      out << ",";
+    }
+    out << *I;
+  }
+}
+
+static void splitIds(const string &text, unsigned limit,
+                     vector<unsigned> &outIds)
+{
+  istringstream in(text);
+  string id;
+  while (getline(in, id, ',')) {
+    unsigned value = strtoul(id.c_str(), 0, 10);
+    if (id.size() && value < limit) {
+      outIds.push_back(value);
+    }
+  }
+}
+
+static vector<string> splitFields(const string &line)
+{
+  vector<string> fields;
+  size_t last = 0, index;
+  while ((index = line.find('\t', last)) != string::npos) {
+    fields.push_back(line.substr(last, index - last));
+    last = index + 1;
+  }
+  fields.push_back(line.substr(last));
+  return fields;
+}
+
+// The index is a tab-separated text file:
+//
+//   refactorial-index <version>
+//   F <mtime in ns> <size> <path>                file table
+//   S <kind> <usr> <match key>                   symbol table
+//   R <symbol> <file> <offset> <length>          references
+//   O <symbol> <overridden symbol>               overrides
+//   T <path> <file,file,...> <symbol,symbol,...> translation units
+//
+// Files and symbols are numbered in the order they appear.
+bool SymbolIndex::save(const string &path)
+{
+  llvm::sys::ScopedLock L(lock);
+
+  ofstream out(path.c_str());
+  if (!out) {
+    llvm::errs() << "Error: Cannot write index " << path << "\n";
+    return false;
+  }
+
+  out << IndexMagic << " " << IndexVersion << "\n";
+  for (auto I = files.begin(), E = files.end(); I != E; ++I) {
+    out << "F\t" << I->mtime << "\t" << I->size << "\t" << I->path << "\n";
+  }
+  for (auto I = symbols.begin(), E = symbols.end(); I != E; ++I) {
+    out << "S\t" << I->kind << "\t" << I->usr << "\t" << I->matchKey << "\n";
+  }
+  for (auto I = refs.begin(), E = refs.end(); I != E; ++I) {
+    out << "R\t" << I->symbol << "\t" << I->file << "\t" << I->offset
+        << "\t" << I->length << "\n";
+  }
+  for (auto I = overrides.begin(), E = overrides.end(); I != E; ++I) {
+    out << "O\t" << I->first << "\t" << I->second << "\n";
+  }
+  for (auto I = units.begin(), E = units.end(); I != E; ++I) {
+    out << "T\t" << I->first << "\t";
+    joinIds(out, I->second.files);
+    out << "\t";
+    joinIds(out, I->second.symbols);
+    out << "\n";
+  }
+
+  return true;
+}
+
+bool SymbolIndex::load(const string &path)
+{
+  llvm::sys::ScopedLock L(lock);
+
+  ifstream in(path.c_str());
+  if (!in) {
+    return false;
+  }
+
+  string magic;
+  unsigned version = 0;
+  in >> magic >> version;
+  if (magic != IndexMagic || version != IndexVersion) {
+    llvm::errs() << "Ignoring index " << path << ": unknown format\n";
+    return false;
+  }
+  in.ignore(1);
+
+  string line;
+  while (getline(in, line)) {
+    auto F = splitFields(line);
+    if (F[0] == "F" && F.size() == 4) {
+      unsigned id = fileId(F[3]);
+      files[id].mtime = strtoull(F[1].c_str(), 0, 10);
+      files[id].size = strtoull(F[2].c_str(), 0, 10);
+    }
+    else if (F[0] == "S" && F.size() == 4) {
+      symbolId(F[2], (SymbolKind)atoi(F[1].c_str()), F[3]);
+    }
+    else if (F[0] == "R" && F.size() == 5) {
+      Ref R;
+      R.symbol = strtoul(F[1].c_str(), 0, 10);
+      R.file = strtoul(F[2].c_str(), 0, 10);
+      R.offset = strtoul(F[3].c_str(), 0, 10);
+      R.length = strtoul(F[4].c_str(), 0, 10);
+      if (R.symbol < symbols.size() && R.file < files.size()) {
+        refs.insert(R);
+      }
+    }
+    else if (F[0] == "O" && F.size() == 3) {
+      unsigned symbol = strtoul(F[1].c_str(), 0, 10);
+      unsigned overridden = strtoul(F[2].c_str(), 0, 10);
+      if (symbol < symbols.size() && overridden < symbols.size()) {
+        overrides.insert(make_pair(symbol, overridden));
+      }
+    }
+    else if (F[0] == "T" && F.size() == 4) {
+      Unit &U = units[F[1]];
+      splitIds(F[2], files.size(), U.files);
+      splitIds(F[3], symbols.size(), U.symbols);
+    }
+  }
+
+  llvm::errs() << "Loaded index " << path << ": " << units.size()
+               << " translation units, " << symbols.size() << " symbols, "
+               << refs.size() << " references\n";
+  return true;
+}
@@ -0,0 +1,156 @@
+//
+// SymbolIndex.h: on-disk index of symbol declarations and references
+//
+
+#ifndef SYMBOL_INDEX_H
+#define SYMBOL_INDEX_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Mutex.h>
+
+class RenameRules;
+
+// Maps the USR of every renameable declaration to the places it is
+// declared or referenced (file:offset:length), and remembers which symbols
+// each translation unit refers to.
+//
+// The index is built in a separate phase by SymbolIndexTransform. A rename
+// transform then only needs to parse the translation units that refer to at
+// least one symbol matching its rules; for a targeted rename in a large tree
+// that is usually a small fraction of the compilation database.
+class SymbolIndex {
+public:
+  // which rename transform a symbol is relevant to
+  enum SymbolKind {
+    TypeSymbol,
+    FunctionSymbol,
+    FieldSymbol
+  };
+
+  struct Occurrence {
+    std::string file;
+    unsigned offset;
+    unsigned length;
+  };
+
+  static SymbolIndex &get();
+
+  bool load(const std::string &path);
+  bool save(const std::string &path);
+
+  // the translation units among sourcePaths that have not been indexed yet
+  // or that include a file that changed since
+  std::vector<std::string>
+  staleTranslationUnits(const std::vector<std::string> &sourcePaths);
+
+  // forgets what is known about the files (given by their real paths),
+  // which refactorial rewrote after they were indexed
+  void invalidate(const std::set<std::string> &realPaths);
+
+  // collects the symbols of one translation unit; committed in one go so
+  // that a translation unit that fails half-way leaves no partial record
+  class Builder {
+  public:
+    void addFile(const std::string &file);
+    void addOccurrence(SymbolKind kind, const std::string &usr,
+                       const std::string &matchKey, const std::string &file,
+                       unsigned offset, unsigned length);
+    // a virtual method and a method it directly overrides
+    void addOverride(const std::string &usr, const std::string &overriddenUSR);
+  private:
+    friend class SymbolIndex;
+    struct Symbol {
+      SymbolKind kind;
+      std::string matchKey;
+    };
+    struct Ref {
+      std::string usr;
+      std::string file;
+      unsigned offset;
+      unsigned length;
+    };
+    std::set<std::string> files;
+    std::map<std::string, Symbol> symbols;
+    std::vector<Ref> refs;
+    std::set<std::pair<std::string, std::string> > overrides;
+  };
+
+  void commit(const std::string &mainFile, const Builder &B);
+
+  // the translation units among sourcePaths that refer to a symbol of the
+  // given kind whose match key is matched by rules, or to a method that
+  // overrides such a symbol
+  std::vector<std::string>
+  translationUnitsMatching(const RenameRules &rules, SymbolKind kind,
+                           const std::vector<std::string> &sourcePaths,
+                           unsigned *outOccurrences = 0);
+
+  // the files the translation unit included when it was last indexed;
+  // returns false if it has not been indexed
+  bool includedFiles(const std::string &sourcePath,
+                     std::vector<std::string> &outFiles);
+
+  // all known declarations and references of a symbol
+  std::vector<Occurrence> getOccurrences(const std::string &usr);
+
+  static std::string getAbsolutePath(const std::string &path);
+
+  // the kind of symbols a built-in rename transform works on; returns false
+  // for other transforms
+  static bool getSymbolKind(const std::string &transformName,
+                            SymbolKind &outKind);
+
+private:
+  SymbolIndex() {}
+
+  struct FileInfo {
+    std::string path;
+    uint64_t mtime;
+    uint64_t size;
+  };
+
+  struct Symbol {
+    std::string usr;
+    std::string matchKey;
+    SymbolKind kind;
+  };
+
+  // (symbol, file, offset, length), all ids are indices into the tables
+  struct Ref {
+    unsigned symbol;
+    unsigned file;
+    unsigned offset;
+    unsigned length;
+    bool operator<(const Ref &R) const;
+  };
+
+  struct Unit {
+    std::vector<unsigned> files;
+    std::vector<unsigned> symbols;
+  };
+
+  unsigned fileId(const std::string &path);
+  unsigned symbolId(const std::string &usr, SymbolKind kind,
+                    const std::string &matchKey);
+  static bool statFile(const std::string &path, uint64_t &mtime,
+                       uint64_t &size);
+
+  std::vector<FileInfo> files;
+  llvm::StringMap<unsigned> fileIds;
+  std::vector<Symbol> symbols;
+  llvm::StringMap<unsigned> symbolIds;
+  std::set<Ref> refs;
+  // (overrider, overridden) symbol ids; the override graph of the whole
+  // indexed program
+  std::set<std::pair<unsigned, unsigned> > overrides;
+  std::map<std::string, Unit> units;
+  llvm::sys::Mutex lock;
+};
+
+#endif
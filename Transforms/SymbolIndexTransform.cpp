@@ -0,0 +1,299 @@
+//
+// SymbolIndexTransform.cpp: the indexing phase of the rename transforms
+//
+// Records every declaration of and reference to a type, function or field,
+// so that rename transforms can tell from the index alone which translation
+// units they need to parse. Nothing is rewritten.
+//
+
+#include "Transforms.h"
+#include "RenameRules.h"
+#include "SymbolIndex.h"
+#include "USRGeneration.h"
+
+#include <clang/AST/DeclObjC.h>
+#include <clang/AST/DeclTemplate.h>
+#include <clang/AST/RecursiveASTVisitor.h>
+#include <clang/Basic/SourceManager.h>
+
+using namespace clang;
+
+class SymbolIndexTransform : public Transform,
+                             public RecursiveASTVisitor<SymbolIndexTransform> {
+public:
+  virtual void HandleTranslationUnit(ASTContext &C);
+
+  bool VisitNamedDecl(NamedDecl *D);
+  bool VisitCXXMethodDecl(CXXMethodDecl *D);
+  bool VisitDeclRefExpr(DeclRefExpr *E);
+  bool VisitMemberExpr(MemberExpr *E);
+  bool VisitObjCProtocolExpr(ObjCProtocolExpr *E);
+  bool VisitObjCInterfaceDecl(ObjCInterfaceDecl *D);
+  bool VisitObjCCategoryDecl(ObjCCategoryDecl *D);
+  bool VisitObjCProtocolDecl(ObjCProtocolDecl *D);
+  bool VisitObjCImplDecl(ObjCImplDecl *D);
+  bool VisitTagTypeLoc(TagTypeLoc TL);
+  bool VisitTypedefTypeLoc(TypedefTypeLoc TL);
+  bool VisitInjectedClassNameTypeLoc(InjectedClassNameTypeLoc TL);
+  bool VisitTemplateSpecializationTypeLoc(TemplateSpecializationTypeLoc TL);
+  bool VisitObjCInterfaceTypeLoc(ObjCInterfaceTypeLoc TL);
+  bool VisitObjCObjectTypeLoc(ObjCObjectTypeLoc TL);
+  bool VisitBuiltinTypeLoc(BuiltinTypeLoc TL);
+  bool VisitTemplateTypeParmTypeLoc(TemplateTypeParmTypeLoc TL);
+  bool TraverseConstructorInitializer(CXXCtorInitializer *Init);
+
+protected:
+  void record(const NamedDecl *D, SourceLocation L);
+  void recordTypeName(QualType T, SourceLocation L);
+  void recordAt(SymbolIndex::SymbolKind kind, const std::string &usr,
+                const std::string &matchKey, SourceLocation L);
+
+  SymbolIndex::Builder builder;
+};
+
+REGISTER_TRANSFORM(SymbolIndexTransform);
+
+// without a USR, the match key still decides whether the declaration can be
+// renamed, so it is just as good an identity for the index
+static std::string getSymbolUSR(const NamedDecl *D,
+                                const std::string &matchKey)
+{
+  auto usr = getUSRForDecl(D);
+  if (usr.empty()) {
+    usr = "c:@Q@" + matchKey;
+  }
+  return usr;
+}
+
+void SymbolIndexTransform::HandleTranslationUnit(ASTContext &C)
+{
+  TraverseDecl(C.getTranslationUnitDecl());
+
+  // every file that took part in this translation unit
+  SourceManager &SM = sema->getSourceManager();
+  for (auto I = SM.fileinfo_begin(), E = SM.fileinfo_end(); I != E; ++I) {
+    builder.addFile(I->first->getName());
+  }
+
+  auto MFE = SM.getFileEntryForID(SM.getMainFileID());
+  if (MFE) {
+    SymbolIndex::get().commit(MFE->getName(), builder);
+  }
+}
+
+void SymbolIndexTransform::record(const NamedDecl *D, SourceLocation L)
+{
+  if (!D) {
+    return;
+  }
+
+  // the same decisions nameMatches() makes: templates are matched by their
+  // templated declaration
+  if (auto TD = dyn_cast<TemplateDecl>(D)) {
+    D = TD->getTemplatedDecl();
+    if (!D) {
+      return;
+    }
+  }
+
+  SymbolIndex::SymbolKind kind;
+  if (isa<TagDecl>(D) || isa<TypedefNameDecl>(D) ||
+      isa<ObjCContainerDecl>(D)) {
+    kind = SymbolIndex::TypeSymbol;
+  }
+  else if (isa<FunctionDecl>(D)) {
+    kind = SymbolIndex::FunctionSymbol;
+  }
+  else if (isa<FieldDecl>(D)) {
+    kind = SymbolIndex::FieldSymbol;
+  }
+  else {
+    return;
+  }
+
+  auto matchKey = RenameRules::getMatchKey(D);
+  if (matchKey.empty()) {
+    return;
+  }
+
+  recordAt(kind, getSymbolUSR(D, matchKey), matchKey, L);
+}
+
+// types TypeRename matches by their spelling rather than by a declaration
+void SymbolIndexTransform::recordTypeName(QualType T, SourceLocation L)
+{
+  auto name = T.getAsString();
+  recordAt(SymbolIndex::TypeSymbol, "c:@B@" + name, name, L);
+}
+
+void SymbolIndexTransform::recordAt(SymbolIndex::SymbolKind kind,
+                                    const std::string &usr,
+                                    const std::string &matchKey,
+                                    SourceLocation L)
+{
+  if (L.isInvalid()) {
+    return;
+  }
+
+  SourceManager &SM = sema->getSourceManager();
+  auto SL = SM.getSpellingLoc(L);
+  auto DL = SM.getDecomposedLoc(SL);
+  const FileEntry *FE = SM.getFileEntryForID(DL.first);
+  if (!FE) {
+    return;
+  }
+
+  unsigned length = Lexer::MeasureTokenLength(SL, SM, sema->getLangOpts());
+  builder.addOccurrence(kind, usr, matchKey, FE->getName(), DL.second,
+                        length);
+}
+
+bool SymbolIndexTransform::VisitNamedDecl(NamedDecl *D)
+{
+  if (!D->isImplicit()) {
+    record(D, D->getLocation());
+  }
+  return true;
+}
+
+bool SymbolIndexTransform::VisitCXXMethodDecl(CXXMethodDecl *D)
+{
+  auto matchKey = RenameRules::getMatchKey(D);
+  if (matchKey.empty()) {
+    return true;
+  }
+
+  auto usr = getSymbolUSR(D, matchKey);
+  for (auto I = D->begin_overridden_methods(),
+       E = D->end_overridden_methods(); I != E; ++I) {
+    auto overriddenKey = RenameRules::getMatchKey(*I);
+    if (!overriddenKey.empty()) {
+      builder.addOverride(usr, getSymbolUSR(*I, overriddenKey));
+    }
+  }
+  return true;
+}
+
+bool SymbolIndexTransform::VisitDeclRefExpr(DeclRefExpr *E)
+{
+  record(E->getDecl(), E->getLocation());
+  return true;
+}
+
+bool SymbolIndexTransform::VisitMemberExpr(MemberExpr *E)
+{
+  record(E->getMemberDecl(), E->getMemberLoc());
+  return true;
+}
+
+bool SymbolIndexTransform::VisitObjCProtocolExpr(ObjCProtocolExpr *E)
+{
+  record(E->getProtocol(), E->getProtocolIdLoc());
+  return true;
+}
+
+bool SymbolIndexTransform::VisitObjCInterfaceDecl(ObjCInterfaceDecl *D)
+{
+  record(D->getSuperClass(), D->getSuperClassLoc());
+
+  auto PLI = D->protocol_loc_begin();
+  for (auto I = D->protocol_begin(), E = D->protocol_end(); I != E;
+       ++I, ++PLI) {
+    record(*I, *PLI);
+  }
+  return true;
+}
+
+bool SymbolIndexTransform::VisitObjCCategoryDecl(ObjCCategoryDecl *D)
+{
+  record(D->getClassInterface(), D->getLocation());
+
+  auto PLI = D->protocol_loc_begin();
+  for (auto I = D->protocol_begin(), E = D->protocol_end(); I != E;
+       ++I, ++PLI) {
+    record(*I, *PLI);
+  }
+  return true;
+}
+
+bool SymbolIndexTransform::VisitObjCProtocolDecl(ObjCProtocolDecl *D)
+{
+  auto PLI = D->protocol_loc_begin();
+  for (auto I = D->protocol_begin(), E = D->protocol_end(); I != E;
+       ++I, ++PLI) {
+    record(*I, *PLI);
+  }
+  return true;
+}
+
+bool SymbolIndexTransform::VisitObjCImplDecl(ObjCImplDecl *D)
+{
+  record(D->getClassInterface(), D->getLocation());
+  return true;
+}
+
+bool SymbolIndexTransform::VisitTagTypeLoc(TagTypeLoc TL)
+{
+  record(TL.getDecl(), TL.getNameLoc());
+  return true;
+}
+
+bool SymbolIndexTransform::VisitTypedefTypeLoc(TypedefTypeLoc TL)
+{
+  record(TL.getTypedefNameDecl(), TL.getNameLoc());
+  return true;
+}
+
+bool SymbolIndexTransform::VisitInjectedClassNameTypeLoc(
+  InjectedClassNameTypeLoc TL)
+{
+  record(TL.getDecl(), TL.getNameLoc());
+  return true;
+}
+
+bool SymbolIndexTransform::VisitTemplateSpecializationTypeLoc(
+  TemplateSpecializationTypeLoc TL)
+{
+  auto TT = TL.getTypePtr();
+  if (auto TD = TT->getTemplateName().getAsTemplateDecl()) {
+    record(TD, TL.getTemplateNameLoc());
+  }
+  return true;
+}
+
+bool SymbolIndexTransform::VisitObjCInterfaceTypeLoc(ObjCInterfaceTypeLoc TL)
+{
+  record(TL.getIFaceDecl(), TL.getNameLoc());
+  return true;
+}
+
+bool SymbolIndexTransform::VisitObjCObjectTypeLoc(ObjCObjectTypeLoc TL)
+{
+  for (unsigned I = 0, E = TL.getNumProtocols(); I != E; ++I) {
+    record(TL.getProtocol(I), TL.getProtocolLoc(I));
+  }
+  return true;
+}
+
+bool SymbolIndexTransform::VisitBuiltinTypeLoc(BuiltinTypeLoc TL)
+{
+  recordTypeName(TL.getType(), TL.getBeginLoc());
+  return true;
+}
+
+bool SymbolIndexTransform::VisitTemplateTypeParmTypeLoc(
+  TemplateTypeParmTypeLoc TL)
+{
+  recordTypeName(TL.getType(), TL.getBeginLoc());
+  return true;
+}
+
+bool SymbolIndexTransform::TraverseConstructorInitializer(
+  CXXCtorInitializer *Init)
+{
+  if (Init->isWritten() && Init->isAnyMemberInitializer()) {
+    record(Init->getAnyMember(), Init->getMemberLocation());
+  }
+  return RecursiveASTVisitor<SymbolIndexTransform>::
+    TraverseConstructorInitializer(Init);
+}
@@ -0,0 +1,610 @@
+//
+// TUPrefilter.cpp
+//
+
+#include "TUPrefilter.h"
+#include "RenameRules.h"
+#include "SymbolIndex.h"
+#include "IdentifierScanner.h"
+#include "Refactoring.h"
+
+#include <clang/Tooling/CompilationDatabase.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <ctype.h>
+#include <set>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+using namespace clang;
+using namespace std;
+
+static const char *const TagKeywords[] = {
+  "class", "struct", "union", "enum", 0
+};
+
+// built-in types are matched by their printed name ("unsigned int"), which
+// need not be spelled that way in the source ("unsigned")
+static const char *const BuiltinKeywords[] = {
+  "void", "bool", "_Bool", "char", "wchar_t", "char16_t", "char32_t",
+  "short", "int", "long", "signed", "unsigned", "float", "double", 0
+};
+
+static bool isKeyword(const string &S, const char *const *keywords)
+{
+  for (auto K = keywords; *K; ++K) {
+    if (S == *K) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static llvm::StringRef skipSpace(llvm::StringRef S)
+{
+  return S.substr(S.find_first_not_of(" \t"));
+}
+
+static bool isIdentifierChar(char c)
+{
+  return isalnum((unsigned char)c) || c == '_';
+}
+
+TUPrefilter::TUPrefilter(const tooling::CompilationDatabase &compilations)
+  : compilations(compilations), rules(0), overlay(0), enabled(false),
+    generation(0)
+{
+}
+
+void TUPrefilter::setOverlay(const FileOverlay *overlay)
+{
+  this->overlay = overlay;
+}
+
+TUPrefilter::~TUPrefilter()
+{
+}
+
+bool TUPrefilter::extractRequiredFragments(const string &pattern,
+                                           vector<string> &outFragments)
+{
+  vector<string> found;
+  vector<size_t> groupStarts;
+  string run;
+  bool lastAtomInRun = false;
+
+  // only fragments of two or more characters are worth searching for;
+  // dropping a fragment only makes the filter weaker, never wrong
+#define FLUSH() do { \
+    if (run.size() >= 2) { \
+      found.push_back(run); \
+    } \
+    run.clear(); \
+  } while(0)
+
+  size_t i = 0, n = pattern.size();
+  while (i < n) {
+    char c = pattern[i];
+
+    if (c == '?' || c == '*' || c == '+' || c == '{') {
+      // a quantifier applies to the atom before it
+      bool optional = c == '?' || c == '*';
+      if (c == '{') {
+        size_t j = i + 1;
+        while (j < n && isdigit((unsigned char)pattern[j])) {
+          j++;
+        }
+        if (j == i + 1) {
+          // not a quantifier; PCRE reads a lone { as a literal
+          FLUSH();
+          lastAtomInRun = false;
+          i++;
+          continue;
+        }
+        optional = atoi(pattern.substr(i + 1, j - i - 1).c_str()) == 0;
+        while (j < n && pattern[j] != '}') {
+          j++;
+        }
+        i = j;
+      }
+      i++;
+
+      if (optional && lastAtomInRun) {
+        run.erase(run.size() - 1);
+      }
+      FLUSH();
+      lastAtomInRun = false;
+
+      // lazy and possessive modifiers
+      if (i < n && (pattern[i] == '?' || pattern[i] == '+')) {
+        i++;
+      }
+      continue;
+    }
+
+    if (c == '\\') {
+      if (i + 1 >= n) {
+        return false;
+      }
+      char e = pattern[i + 1];
+      i += 2;
+
+      // \Q...\E quoting is rare enough not to bother; escapes that take an
+      // argument (\x41, \x{..}, \p{..}, \cX, \g{..}, \k<..>, \o{..}, \N{..}) or
+      // are back references would leave it to merge into the next run
+      if (e == 'Q' || e == 'x' || e == 'p' || e == 'P' || e == 'c' ||
+          e == 'g' || e == 'k' || e == 'o' || e == 'N' || e == '{' ||
+          isdigit((unsigned char)e)) {
+        return false;
+      }
+
+      // classes like \w, assertions like \b and back references like \1
+      // are not literals; escaped punctuation matches itself
+      if (e == '_') {
+        run += e;
+        lastAtomInRun = true;
+      }
+      else {
+        FLUSH();
+        lastAtomInRun = false;
+      }
+      continue;
+    }
+
+    if (c == '|') {
+      // any alternative may match, so no fragment is required
+      return false;
+    }
+
+    if (c == '(') {
+      FLUSH();
+      lastAtomInRun = false;
+      if (i + 1 < n && pattern[i + 1] == '?') {
+        // only non-capturing groups; lookarounds and option settings such
+        // as (?i) change what the literals mean
+        if (i + 2 >= n || pattern[i + 2] != ':') {
+          return false;
+        }
+        i += 3;
+      }
+      else {
+        i++;
+      }
+      groupStarts.push_back(found.size());
+      continue;
+    }
+
+    if (c == ')') {
+      FLUSH();
+      lastAtomInRun = false;
+      if (groupStarts.empty()) {
+        return false;
+      }
+      size_t start = groupStarts.back();
+      groupStarts.pop_back();
+      i++;
+
+      // a group that may be skipped requires none of its fragments
+      if (i < n && (pattern[i] == '?' || pattern[i] == '*' ||
+                    (pattern[i] == '{' && i + 1 < n &&
+                     pattern[i + 1] == '0'))) {
+        found.resize(start);
+      }
+      continue;
+    }
+
+    if (c == '[') {
+      FLUSH();
+      lastAtomInRun = false;
+      i++;
+      if (i < n && pattern[i] == '^') {
+        i++;
+      }
+      if (i < n && pattern[i] == ']') {
+        i++;
+      }
+      while (i < n && pattern[i] != ']') {
+        i += pattern[i] == '\\' ? 2 : 1;
+      }
+      i++;
+      continue;
+    }
+
+    if (isIdentifierChar(c)) {
+      run += c;
+      lastAtomInRun = true;
+    }
+    else {
+      // ., ^, $ and literal punctuation such as :: end a fragment
+      FLUSH();
+      lastAtomInRun = false;
+    }
+    i++;
+  }
+
+  FLUSH();
+#undef FLUSH
+
+  if (!groupStarts.empty()) {
+    return false;
+  }
+
+  outFragments = found;
+  return true;
+}
+
+bool TUPrefilter::setRules(const RenameRules &R, const string &transformName)
+{
+  rules = &R;
+  fragments.clear();
+  ruleFragments.clear();
+  enabled = false;
+  generation++;
+
+  map<string, unsigned> fragmentIds;
+  auto patterns = R.getPatterns();
+  for (auto I = patterns.begin(), E = patterns.end(); I != E; ++I) {
+    vector<string> found;
+    if (!extractRequiredFragments(*I, found)) {
+      return false;
+    }
+
+    vector<unsigned> ids;
+    for (auto FI = found.begin(), FE = found.end(); FI != FE; ++FI) {
+      if (transformName == "TypeRename") {
+        if (isKeyword(*FI, BuiltinKeywords)) {
+          return false;
+        }
+        if (isKeyword(*FI, TagKeywords)) {
+          continue;
+        }
+      }
+
+      // "(anonymous namespace)" is part of qualified names, not of the source
+      if (*FI == "anonymous") {
+        continue;
+      }
+
+      auto IDI = fragmentIds.find(*FI);
+      if (IDI == fragmentIds.end()) {
+        IDI = fragmentIds.insert(make_pair(*FI, fragments.size())).first;
+        fragments.push_back(*FI);
+      }
+      ids.push_back(IDI->second);
+    }
+
+    if (ids.empty()) {
+      return false;
+    }
+    ruleFragments.push_back(ids);
+  }
+
+  scanner.reset(new IdentifierScanner(fragments,
+                                      IdentifierScanner::Substring));
+  enabled = !ruleFragments.empty();
+  return enabled;
+}
+
+vector<string> TUPrefilter::filter(const vector<string> &sourcePaths)
+{
+  vector<string> result;
+  for (auto I = sourcePaths.begin(), E = sourcePaths.end(); I != E; ++I) {
+    if (keep(*I)) {
+      result.push_back(*I);
+    }
+  }
+  return result;
+}
+
+bool TUPrefilter::keep(const string &sourcePath)
+{
+  if (!enabled) {
+    return true;
+  }
+
+  CommandInfo C = getCommandInfo(sourcePath);
+  vector<bool> present(fragments.size(), false);
+
+  // macros defined on the command line can spell any name
+  for (unsigned F = 0, FE = fragments.size(); F != FE; ++F) {
+    if (C.commandLineText.find(fragments[F]) != string::npos) {
+      present[F] = true;
+    }
+  }
+
+  vector<string> worklist;
+  set<string> visited;
+  worklist.push_back(SymbolIndex::getAbsolutePath(sourcePath));
+  worklist.insert(worklist.end(), C.forcedIncludes.begin(),
+                  C.forcedIncludes.end());
+
+  while (!worklist.empty()) {
+    string path = worklist.back();
+    worklist.pop_back();
+    if (!visited.insert(path).second) {
+      continue;
+    }
+
+    FileScan &S = scan(path);
+    if (!S.readable || S.computedInclude) {
+      return true;
+    }
+
+    // token pasting can form a name that is not spelled anywhere. Ignored
+    // files (system headers) are trusted not to paste together names from
+    // the rename rules; otherwise every TU including <stdio.h> would stay.
+    if (S.hasPaste && !rules->isIgnored(path)) {
+      return true;
+    }
+
+    for (unsigned F = 0, FE = fragments.size(); F != FE; ++F) {
+      if (S.hasFragment[F]) {
+        present[F] = true;
+      }
+    }
+
+    for (auto II = S.includes.begin(), IE = S.includes.end(); II != IE; ++II) {
+      string resolved;
+      if (resolveInclude(*II, path, C, resolved)) {
+        worklist.push_back(resolved);
+      }
+      else if (!II->angled) {
+        return true;
+      }
+      // an unresolved <...> include is a system header outside the search
+      // paths we know about; it cannot declare anything in the rename set
+    }
+  }
+
+  for (auto R = ruleFragments.begin(), RE = ruleFragments.end(); R != RE; ++R) {
+    bool all = true;
+    for (auto F = R->begin(), FE = R->end(); F != FE; ++F) {
+      if (!present[*F]) {
+        all = false;
+        break;
+      }
+    }
+    if (all) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void TUPrefilter::includeClosure(const string &sourcePath,
+                                 vector<string> &outFiles)
+{
+  CommandInfo C = getCommandInfo(sourcePath);
+  vector<string> worklist;
+  set<string> visited;
+  worklist.push_back(SymbolIndex::getAbsolutePath(sourcePath));
+  worklist.insert(worklist.end(), C.forcedIncludes.begin(),
+                  C.forcedIncludes.end());
+
+  while (!worklist.empty()) {
+    string path = worklist.back();
+    worklist.pop_back();
+    if (!visited.insert(path).second) {
+      continue;
+    }
+
+    FileScan &S = scan(path);
+    if (!S.readable) {
+      continue;
+    }
+    outFiles.push_back(path);
+
+    for (auto II = S.includes.begin(), IE = S.includes.end(); II != IE; ++II) {
+      string resolved;
+      if (resolveInclude(*II, path, C, resolved)) {
+        worklist.push_back(resolved);
+      }
+    }
+  }
+}
+
+TUPrefilter::FileScan &TUPrefilter::scan(const string &path)
+{
+  auto I = files.find(path);
+  if (I != files.end() && I->second.generation == generation) {
+    return I->second;
+  }
+
+  bool firstScan = I == files.end() || !I->second.readable;
+  FileScan &S = files[path];
+  S.generation = generation;
+  S.hasFragment.assign(fragments.size(), false);
+
+  llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+  const string *rewritten = overlay ? overlay->lookup(path) : 0;
+  if (!rewritten && llvm::MemoryBuffer::getFile(path, buffer)) {
+    S.readable = false;
+    return S;
+  }
+  S.readable = true;
+
+  const char *begin = rewritten ? rewritten->data() : buffer->getBufferStart();
+  const char *end = rewritten ? begin + rewritten->size()
+                              : buffer->getBufferEnd();
+  scanFragments(S, begin, end);
+
+  // the includes do not depend on the rules
+  if (!firstScan) {
+    return S;
+  }
+
+  S.computedInclude = false;
+  S.hasPaste = false;
+
+  // a raw scan of the preprocessor directives; conditional compilation is
+  // ignored, so every file that may be included is considered
+  bool inDefine = false;
+  for (const char *P = begin; P < end; ) {
+    const char *EOL = P;
+    while (EOL < end && *EOL != '\n') {
+      EOL++;
+    }
+    llvm::StringRef line(P, EOL - P);
+    P = EOL + 1;
+
+    llvm::StringRef T = skipSpace(line);
+    size_t last = line.size();
+    while (last && isspace((unsigned char)line[last - 1])) {
+      last--;
+    }
+    bool continued = last && line[last - 1] == '\\';
+    if (inDefine) {
+      if (line.find("##") != llvm::StringRef::npos) {
+        S.hasPaste = true;
+      }
+      inDefine = continued;
+      continue;
+    }
+
+    if (!T.startswith("#")) {
+      continue;
+    }
+    T = skipSpace(T.substr(1));
+
+    if (T.startswith("define")) {
+      if (T.find("##") != llvm::StringRef::npos) {
+        S.hasPaste = true;
+      }
+      inDefine = continued;
+      continue;
+    }
+
+    if (!T.startswith("include") && !T.startswith("import")) {
+      continue;
+    }
+
+    bool next = T.startswith("include_next");
+    T = skipSpace(T.substr(T.startswith("import") ? 6 : (next ? 12 : 7)));
+    Include inc;
+    if (T.startswith("\"")) {
+      inc.angled = false;
+      inc.name = T.substr(1).split('"').first;
+    }
+    else if (T.startswith("<")) {
+      inc.angled = true;
+      inc.name = T.substr(1).split('>').first;
+    }
+    else {
+      // #include MACRO
+      S.computedInclude = true;
+      continue;
+    }
+    S.includes.push_back(inc);
+  }
+
+  return S;
+}
+
+void TUPrefilter::scanFragments(FileScan &S, const char *begin,
+                                const char *end)
+{
+  // no rules yet when only the includes are wanted
+  if (scanner) {
+    scanner->scan(begin, end, S.hasFragment);
+  }
+}
+
+static bool isRegularFile(const string &path)
+{
+  struct stat st;
+  return !stat(path.c_str(), &st) && S_ISREG(st.st_mode);
+}
+
+bool TUPrefilter::resolveInclude(const Include &I, const string &includer,
+                                 const CommandInfo &C, string &outPath)
+{
+  if (llvm::sys::path::is_absolute(I.name)) {
+    outPath = I.name;
+    return isRegularFile(outPath);
+  }
+
+  vector<string> dirs;
+  if (!I.angled) {
+    dirs.push_back(llvm::sys::path::parent_path(includer));
+    dirs.insert(dirs.end(), C.quoteDirs.begin(), C.quoteDirs.end());
+  }
+  dirs.insert(dirs.end(), C.searchDirs.begin(), C.searchDirs.end());
+  dirs.push_back("/usr/local/include");
+  dirs.push_back("/usr/include");
+
+  for (auto D = dirs.begin(), DE = dirs.end(); D != DE; ++D) {
+    string candidate = *D + "/" + I.name;
+    if (isRegularFile(candidate)) {
+      outPath = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+TUPrefilter::CommandInfo TUPrefilter::getCommandInfo(const string &sourcePath)
+{
+  CommandInfo C;
+  auto commands = compilations.getCompileCommands(sourcePath);
+  if (commands.empty()) {
+    commands = compilations.getCompileCommands(
+      SymbolIndex::getAbsolutePath(sourcePath));
+  }
+  if (commands.empty()) {
+    C.directory = SymbolIndex::getAbsolutePath(".");
+    return C;
+  }
+
+  // a file compiled more than once is filtered by the union of its commands
+  C.directory = commands[0].Directory;
+  for (auto CI = commands.begin(), CE = commands.end(); CI != CE; ++CI) {
+    const vector<string> &args = CI->CommandLine;
+    for (size_t i = 0, n = args.size(); i < n; ++i) {
+      const string &A = args[i];
+      C.commandLineText += A + "\n";
+
+      string flag;
+      const char *const flags[] = {
+        "-I", "-iquote", "-isystem", "-idirafter", "-include", "-imacros", 0
+      };
+      for (auto F = flags; *F; ++F) {
+        if (llvm::StringRef(A).startswith(*F)) {
+          flag = *F;
+          break;
+        }
+      }
+      if (flag.empty()) {
+        continue;
+      }
+
+      string arg = A.substr(flag.size());
+      if (arg.empty() && i + 1 < n) {
+        arg = args[++i];
+        C.commandLineText += arg + "\n";
+      }
+      if (arg.empty()) {
+        continue;
+      }
+      if (!llvm::sys::path::is_absolute(arg)) {
+        arg = CI->Directory + "/" + arg;
+      }
+
+      if (flag == "-iquote") {
+        C.quoteDirs.push_back(arg);
+      }
+      else if (flag == "-include" || flag == "-imacros") {
+        C.forcedIncludes.push_back(arg);
+      }
+      else {
+        C.searchDirs.push_back(arg);
+      }
+    }
+  }
+
+  return C;
+}
@@ -0,0 +1,105 @@
+//
+// TUPrefilter.h: skip translation units that cannot contain a rename match
+//
+
+#ifndef TU_PREFILTER_H
+#define TU_PREFILTER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/OwningPtr.h>
+
+class FileOverlay;
+class IdentifierScanner;
+
+namespace clang {
+  namespace tooling {
+    class CompilationDatabase;
+  }
+}
+
+class RenameRules;
+
+// Before a rename transform parses anything, the literal identifier
+// fragments of its rules are extracted (e.g. "sqlite3_" from
+// "sqlite3_(\w+)"). A rule can only match a declaration whose name is
+// spelled somewhere in the translation unit, so a translation unit whose
+// source, include closure and -D flags lack a required fragment of every
+// rule does not need to be parsed.
+//
+// The filter errs on the side of parsing: rules it cannot reason about
+// (alternations, builtin types, no literals at all), includes it cannot
+// resolve and token pasting all keep a translation unit in.
+class TUPrefilter {
+public:
+  TUPrefilter(const clang::tooling::CompilationDatabase &compilations);
+  ~TUPrefilter();
+
+  // returns false if the rules cannot be used for filtering, in which case
+  // filter() keeps every translation unit
+  bool setRules(const RenameRules &rules, const std::string &transformName);
+
+  std::vector<std::string> filter(const std::vector<std::string> &sourcePaths);
+
+  // files rewritten in memory by an earlier section are scanned from there
+  void setOverlay(const FileOverlay *overlay);
+
+  // the files sourcePath may include, as far as a raw scan of the #include
+  // directives can tell; works without rules
+  void includeClosure(const std::string &sourcePath,
+                      std::vector<std::string> &outFiles);
+
+  // exposed for testing: the fragments every match of pattern must
+  // contain; returns false if the pattern cannot be reasoned about
+  static bool extractRequiredFragments(const std::string &pattern,
+                                       std::vector<std::string> &outFragments);
+
+private:
+  struct Include {
+    std::string name;
+    bool angled;
+  };
+
+  // what a file contributes, independent of the rules
+  struct FileScan {
+    bool readable;
+    bool computedInclude;
+    bool hasPaste;
+    std::vector<Include> includes;
+    // per entry in fragments; only valid for the current rule set
+    std::vector<bool> hasFragment;
+    unsigned generation;
+  };
+
+  struct CommandInfo {
+    std::string directory;
+    std::vector<std::string> quoteDirs;
+    std::vector<std::string> searchDirs;
+    std::vector<std::string> forcedIncludes;
+    std::string commandLineText;
+  };
+
+  bool keep(const std::string &sourcePath);
+  FileScan &scan(const std::string &path);
+  void scanFragments(FileScan &S, const char *begin, const char *end);
+  bool resolveInclude(const Include &I, const std::string &includer,
+                      const CommandInfo &C, std::string &outPath);
+  CommandInfo getCommandInfo(const std::string &sourcePath);
+
+  const clang::tooling::CompilationDatabase &compilations;
+  const RenameRules *rules;
+  const FileOverlay *overlay;
+
+  // every rule is a list of indices into fragments
+  std::vector<std::string> fragments;
+  std::vector<std::vector<unsigned> > ruleFragments;
+  llvm::OwningPtr<IdentifierScanner> scanner;
+  bool enabled;
+  unsigned generation;
+
+  std::map<std::string, FileScan> files;
+};
+
+#endif
@@ -0,0 +1,207 @@
+//
+// TUTimings.cpp
+//
+
+#include "TUTimings.h"
+#include "SymbolIndex.h"
+
+#include <llvm/Support/Format.h>
+
+#include <fstream>
+#include <sstream>
+#include <sys/time.h>
+
+using namespace std;
+
+static const char *const TimingsMagic = "refactorial-timings";
+
+// weight of the newest run in the smoothed duration
+static const double NewRunWeight = 0.5;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+TUTimings &TUTimings::get()
+{
+  static TUTimings instance;
+  return instance;
+}
+
+string TUTimings::getKey(const string &sourcePath) const
+{
+  return transform + "\t" + SymbolIndex::getAbsolutePath(sourcePath);
+}
+
+bool TUTimings::load(const string &P)
+{
+  llvm::sys::ScopedLock L(lock);
+  if (path == P) {
+    return true;
+  }
+  if (!path.empty()) {
+    save();
+  }
+  path = P;
+  timings.clear();
+
+  ifstream in(path.c_str());
+  if (!in) {
+    return false;
+  }
+
+  string magic;
+  getline(in, magic);
+  if (magic != TimingsMagic) {
+    llvm::errs() << "Ignoring timings " << path << ": not a timings file\n";
+    return false;
+  }
+
+  // one entry per line, in seconds:
+  // "<parse>\t<transform>\t<transform name>\t<path>"
+  string line;
+  while (getline(in, line)) {
+    istringstream fields(line);
+    Timing T;
+    string name, file;
+    if (fields >> T.parse >> T.transform >> name) {
+      fields.ignore(1);
+      getline(fields, file);
+      timings[name + "\t" + file] = T;
+    }
+  }
+  return true;
+}
+
+bool TUTimings::save()
+{
+  llvm::sys::ScopedLock L(lock);
+  if (path.empty() || !dirty) {
+    return true;
+  }
+
+  ofstream out(path.c_str());
+  if (!out) {
+    llvm::errs() << "Error: Cannot write timings " << path << "\n";
+    return false;
+  }
+
+  out << TimingsMagic << "\n";
+  for (auto I = timings.begin(), E = timings.end(); I != E; ++I) {
+    out << I->second.parse << "\t" << I->second.transform << "\t"
+        << I->first << "\n";
+  }
+
+  dirty = false;
+  return true;
+}
+
+void TUTimings::setTransform(const string &name)
+{
+  llvm::sys::ScopedLock L(lock);
+  transform = name;
+  report.clear();
+}
+
+bool TUTimings::predict(const string &sourcePath, double &outSeconds)
+{
+  llvm::sys::ScopedLock L(lock);
+  auto I = timings.find(getKey(sourcePath));
+  if (I == timings.end()) {
+    return false;
+  }
+  outSeconds = I->second.parse + I->second.transform;
+  return true;
+}
+
+void TUTimings::beginFile(const string &sourcePath)
+{
+  llvm::sys::ScopedLock L(lock);
+  current = sourcePath;
+  started = now();
+  parsed = 0;
+}
+
+void TUTimings::endParse()
+{
+  llvm::sys::ScopedLock L(lock);
+  parsed = now();
+}
+
+bool TUTimings::endFile(double &outParse, double &outTransform)
+{
+  llvm::sys::ScopedLock L(lock);
+  if (current.empty() || path.empty() || transform.empty()) {
+    return false;
+  }
+
+  // a translation unit that failed to parse never reached endParse()
+  double ended = now();
+  outParse = (parsed ? parsed : ended) - started;
+  outTransform = parsed ? ended - parsed : 0;
+  string sourcePath;
+  sourcePath.swap(current);
+  addFile(sourcePath, outParse, outTransform);
+  return true;
+}
+
+void TUTimings::addFile(const string &sourcePath, double parse,
+                        double transform)
+{
+  llvm::sys::ScopedLock L(lock);
+  Record R;
+  R.sourcePath = sourcePath;
+  R.actual.parse = parse;
+  R.actual.transform = transform;
+
+  string key = getKey(sourcePath);
+  auto I = timings.find(key);
+  R.predicted = I != timings.end();
+  if (R.predicted) {
+    R.prediction = I->second.parse + I->second.transform;
+    Timing &T = I->second;
+    T.parse += NewRunWeight * (parse - T.parse);
+    T.transform += NewRunWeight * (transform - T.transform);
+  }
+  else {
+    R.prediction = 0;
+    timings[key] = R.actual;
+  }
+  report.push_back(R);
+  dirty = true;
+}
+
+void TUTimings::printReport(llvm::raw_ostream &OS)
+{
+  llvm::sys::ScopedLock L(lock);
+  if (path.empty() || report.empty()) {
+    return;
+  }
+
+  double predicted = 0, actual = 0, actualPredicted = 0;
+  unsigned count = 0;
+  for (auto I = report.begin(), E = report.end(); I != E; ++I) {
+    double took = I->actual.parse + I->actual.transform;
+    OS << "Timing: " << I->sourcePath << ": ";
+    if (I->predicted) {
+      OS << llvm::format("predicted %.2f s, ", I->prediction);
+      predicted += I->prediction;
+      actualPredicted += took;
+      count++;
+    }
+    OS << llvm::format("took %.2f s (parse %.2f s, transform %.2f s)\n",
+                       took, I->actual.parse, I->actual.transform);
+    actual += took;
+  }
+  OS << "Timing: " << transform << ": " << report.size()
+     << llvm::format(" translation units took %.2f s", actual);
+  if (count) {
+    OS << "; the " << count << " with a prediction took "
+       << llvm::format("%.2f s, predicted %.2f s", actualPredicted, predicted);
+  }
+  OS << "\n";
+  report.clear();
+}
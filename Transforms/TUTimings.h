@@ -0,0 +1,75 @@
+//
+// TUTimings.h: how long each translation unit took in earlier runs
+//
+
+#ifndef TU_TIMINGS_H
+#define TU_TIMINGS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <llvm/Support/Mutex.h>
+#include <llvm/Support/raw_ostream.h>
+
+// Records the parse and transform time of every translation unit, per
+// transform, and keeps them in a small file between runs (the `Timings`
+// entry of a config section). The next run uses them as the expected cost
+// of each translation unit, so that the expensive ones are not left for
+// last, and reports how far off the prediction was.
+class TUTimings {
+public:
+  static TUTimings &get();
+
+  bool load(const std::string &path);
+  bool save();
+
+  // the transform whose translation units are timed next; also starts a
+  // new report
+  void setTransform(const std::string &name);
+
+  // the smoothed duration of earlier runs, in seconds
+  bool predict(const std::string &sourcePath, double &outSeconds);
+
+  // called by TransformAction around each translation unit; endFile()
+  // returns false if no timings file is in use
+  void beginFile(const std::string &sourcePath);
+  void endParse();
+  bool endFile(double &outParse, double &outTransform);
+
+  // a translation unit timed in a worker process
+  void addFile(const std::string &sourcePath, double parse, double transform);
+
+  // predicted and actual time of every translation unit since
+  // setTransform() or the last report
+  void printReport(llvm::raw_ostream &OS);
+
+private:
+  TUTimings() : started(0), parsed(0), dirty(false) {}
+
+  struct Timing {
+    double parse;
+    double transform;
+  };
+
+  struct Record {
+    std::string sourcePath;
+    bool predicted;
+    double prediction;
+    Timing actual;
+  };
+
+  std::string getKey(const std::string &sourcePath) const;
+
+  std::string path;
+  std::string transform;
+  std::map<std::string, Timing> timings;
+  std::vector<Record> report;
+  std::string current;
+  double started;
+  double parsed;
+  bool dirty;
+  llvm::sys::Mutex lock;
+};
+
+#endif
@@ -1,9 +1,22 @@
 #include "Transforms.h"
 
+#include <clang/Basic/Version.h>
 #include <clang/Frontend/CompilerInstance.h>
 #include <clang/Frontend/FrontendAction.h>
+#include <clang/Frontend/MultiplexConsumer.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
 
+#include "FileCache.h"
+#include "RenameMatchCache.h"
+#include "TUTimings.h"
+
+#include <limits.h>
 #include <stdexcept>
+#include <stdlib.h>
 
 using namespace clang;
 using namespace clang::tooling;
@@ -24,6 +37,40 @@ void Transform::replace(SourceRange range, string text)
 	TransformRegistry::get().replacements->push_back(Replacement(sema->getSourceManager(), CharSourceRange(range, true), text));
 }
 
+//state sent back by worker processes, see shareState
+static void takeParsedSource(llvm::StringRef value)
+{
+	TransformRegistry::get().parsedSources.insert(value.str());
+}
+
+static void takeFailedSource(llvm::StringRef value)
+{
+	TransformRegistry::get().failedSources.insert(value.str());
+}
+
+static void takeSkipCounts(llvm::StringRef value)
+{
+	//"<what>\t<skipped>\t<total>"
+	llvm::SmallVector<llvm::StringRef, 3> fields;
+	value.split(fields, "\t");
+	unsigned skipped, total;
+	if(fields.size() == 3 && !fields[1].getAsInteger(10, skipped) && !fields[2].getAsInteger(10, total))
+		TransformRegistry::get().countSkipped(fields[0].str(), skipped, total);
+}
+
+static void takeMatchCache(llvm::StringRef value)
+{
+	RenameMatchCache::mergeShared(value);
+}
+
+TransformRegistry::TransformRegistry() : replacements(0), checkpoint(0), beforeRewrite(true)
+{
+	addStateHandler("ParsedSource", &takeParsedSource);
+	addStateHandler("FailedSource", &takeFailedSource);
+	addStateHandler("SkipCounts", &takeSkipCounts);
+	addStateHandler("MatchCache", &takeMatchCache);
+}
+
 TransformRegistry &TransformRegistry::get()
 {
 	static TransformRegistry instance;
@@ -43,6 +90,78 @@ const transform_creator TransformRegistry::operator[](const string &name) const
 	return iter->second;
 }
 
+void TransformRegistry::countSkipped(const string &what, unsigned skipped, unsigned total)
+{
+	if(!total)
+		return;
+	pair<unsigned, unsigned> &counts = skipCounts[what];
+	counts.first += skipped;
+	counts.second += total;
+	shareState("SkipCounts", what + "\t" + llvm::utostr(skipped) + "\t" + llvm::utostr(total));
+}
+
+void TransformRegistry::addStateHandler(const string &kind, state_handler handler)
+{
+	m_stateHandlers[kind] = handler;
+}
+
+void TransformRegistry::shareState(const string &kind, llvm::StringRef value)
+{
+	//only writes in a worker process
+	if(checkpoint)
+		checkpoint->addState(kind, value);
+}
+
+void TransformRegistry::takeState(llvm::StringRef kind, llvm::StringRef value)
+{
+	TransformRegistry &registry = get();
+	auto iter = registry.m_stateHandlers.find(kind.str());
+	if(iter != registry.m_stateHandlers.end())
+		iter->second(value);
+}
+
+void TransformRegistry::printStats(llvm::raw_ostream &OS) const
+{
+	for(auto iter = skipCounts.begin(); iter != skipCounts.end(); ++iter)
+	{
+		OS << "Skipped " << iter->second.first << " of " << iter->second.second << " " << iter->first
+		   << " (" << llvm::format("%.1f", 100.0 * iter->second.first / iter->second.second) << "%)\n";
+	}
+}
+
+string TransformRegistry::findBuiltinIncludes()
+{
+	//clang's own headers (stddef.h, stdarg.h, ...) live next to the clang
+	//binary, in ../lib/clang/<version>/include
+	vector<string> candidates;
+	llvm::sys::Path clang = llvm::sys::Program::FindProgramByName("clang");
+	char resolved[PATH_MAX];
+	if(!clang.isEmpty() && realpath(clang.c_str(), resolved))
+	{
+		llvm::StringRef bin = llvm::sys::path::parent_path(resolved);
+		candidates.push_back((llvm::sys::path::parent_path(bin) + "/lib/clang/" CLANG_VERSION_STRING "/include").str());
+	}
+	candidates.push_back("/usr/local/lib/clang/" CLANG_VERSION_STRING "/include");
+	candidates.push_back("/usr/lib/clang/" CLANG_VERSION_STRING "/include");
+
+	for(auto iter = candidates.begin(); iter != candidates.end(); ++iter)
+	{
+		bool isDirectory = false;
+		if(!llvm::sys::fs::is_directory(*iter, isDirectory) && isDirectory)
+			return *iter;
+	}
+	llvm::errs() << "Warning: clang " CLANG_VERSION_STRING " builtin headers not found, system headers may not parse\n";
+	return string();
+}
+
+//runs before the transform's own HandleTranslationUnit, when parsing is done
+class ParseTimer : public ASTConsumer {
+public:
+	virtual void HandleTranslationUnit(ASTContext &) {
+		TUTimings::get().endParse();
+	}
+};
+
 class TransformAction : public ASTFrontendAction {
 private:
 	transform_creator tcreator;
@@ -50,13 +169,51 @@ public:
 	TransformAction(transform_creator creator) {tcreator = creator;}
 protected:
 	ASTConsumer *CreateASTConsumer(CompilerInstance &CI, llvm::StringRef) {
-		return tcreator();
+		vector<ASTConsumer *> consumers;
+		consumers.push_back(new ParseTimer);
+		consumers.push_back(tcreator());
+		return new MultiplexConsumer(consumers);
 	}
 
 	virtual bool BeginInvocation(CompilerInstance &CI) {
-		CI.getHeaderSearchOpts().AddPath("/usr/local/lib/clang/3.2/include", frontend::System, false, false, false);
+		const string &builtinIncludes = TransformRegistry::get().builtinIncludes;
+		if(!builtinIncludes.empty())
+			CI.getHeaderSearchOpts().AddPath(builtinIncludes, frontend::System, false, false, false);
+		//ClangTool drops the stat caches after every translation unit
+		if(CI.hasFileManager())
+			FileCache::get().attach(CI.getFileManager());
 		return true;
 	}
+	virtual bool BeginSourceFileAction(CompilerInstance &CI, llvm::StringRef filename) {
+		FileCache::get().overrideOnDemand(CI);
+		TUTimings::get().beginFile(filename);
+		return true;
+	}
+	virtual void EndSourceFileAction() {
+		FileCache::get().collect(getCompilerInstance().getSourceManager());
+		//a worker's timings only reach the supervisor through the log
+		double parse, transform;
+		CheckpointLog *checkpoint = TransformRegistry::get().checkpoint;
+		if(TUTimings::get().endFile(parse, transform) && checkpoint)
+			checkpoint->addTiming(getCurrentFile(), parse, transform);
+		//errors that are not the rewrite's fault, for --verify
+		TransformRegistry &registry = TransformRegistry::get();
+		if(registry.beforeRewrite && registry.parsedSources.insert(getCurrentFile()).second)
+			registry.shareState("ParsedSource", getCurrentFile());
+		if(registry.beforeRewrite && getCompilerInstance().getDiagnostics().hasErrorOccurred())
+		{
+			registry.failedSources.insert(getCurrentFile());
+			registry.shareState("FailedSource", getCurrentFile());
+		}
+		//what the match caches learnt, sent once per translation unit
+		if(checkpoint && checkpoint->isWorker())
+		{
+			vector<string> caches;
+			RenameMatchCache::takeUnshared(caches);
+			for(auto iter = caches.begin(); iter != caches.end(); ++iter)
+				registry.shareState("MatchCache", *iter);
+		}
+	}
 };
 
 TransformFactory::TransformFactory(transform_creator creator) {
@@ -1,6 +1,7 @@
 #ifndef TRANSFORM_H
 #define TRANSFORM_H
 
+#include <set>
 #include <string>
 #include <vector>
 #include <stdint.h>
@@ -44,18 +45,42 @@ template <typename T> Transform* transform_factory()
 
 typedef Transform* (*transform_creator)(void);
 
+typedef void (*state_handler)(llvm::StringRef value);
+
 class TransformRegistry
 {
  private:
 	std::map<std::string,transform_creator> m_transforms;
+	std::map<std::string,state_handler> m_stateHandlers;
+	TransformRegistry();
  public:
 	YAML::Node config;
 	std::map<std::string, std::string> touchedFiles;
 	Replacements *replacements;
+	//set when translation units run in worker processes
+	CheckpointLog *checkpoint;
+	//clang's builtin header directory, looked up once at startup
+	std::string builtinIncludes;
+	//translation units parsed before they were rewritten, and those of them
+	//that had errors; once the run rewrote a file, parses no longer tell
+	std::set<std::string> parsedSources;
+	std::set<std::string> failedSources;
+	bool beforeRewrite;
+	//work the transforms skipped, summed over the run: name -> (skipped, total)
+	std::map<std::string, std::pair<unsigned, unsigned> > skipCounts;
 	
 	static TransformRegistry& get();
+	static std::string findBuiltinIncludes();
 	void add(const std::string &, transform_creator);
 	const transform_creator operator[](const std::string &name) const;
+	void countSkipped(const std::string &what, unsigned skipped, unsigned total);
+	//worker processes send the state later translation units and the end of
+	//the run depend on to the supervisor, where the handler added for its
+	//kind takes it over
+	void addStateHandler(const std::string &kind, state_handler handler);
+	void shareState(const std::string &kind, llvm::StringRef value);
+	static void takeState(llvm::StringRef kind, llvm::StringRef value);
+	void printStats(llvm::raw_ostream &OS) const;
 };
 
 class TransformRegistration
@@ -66,6 +91,14 @@ public:
 	}
 };
 
+class StateHandlerRegistration
+{
+public:
+	StateHandlerRegistration(const std::string& kind, state_handler handler) {
+		TransformRegistry::get().addStateHandler(kind, handler);
+	}
+};
+
 #define REGISTER_TRANSFORM(transform)	  \
 	TransformRegistration _transform_registration_ \
 	## transform(#transform, &transform_factory<transform>)
@@ -4,7 +4,6 @@
 
 //
 // Limitations:
-// * No Objective-C category rename
 // * No Y, Z part for @implementation X (C) : Y <Z> -- perhaps you shouldn't
 
 #include "Transforms.h"
@@ -12,16 +11,21 @@
 #include <clang/AST/DeclFriend.h>
 #include <clang/AST/DeclTemplate.h>
 #include <clang/AST/TypeLoc.h>
+#include <map>
+#include <set>
 
 using namespace clang;
 
 class TypeRenameTransform : public RenameTransform {
 public:
+  TypeRenameTransform()
+    : typeLocBailouts(0), typeLocMemoHits(0), typeLocMemoLookups(0) {}
   virtual void HandleTranslationUnit(ASTContext &C);
   
 protected:
   void collectRenameDecls(DeclContext *DC, bool topLevel = false);
   void processDeclContext(DeclContext *DC, bool topLevel = false);  
+  void processRecordBases(CXXRecordDecl *CRD);
   void processStmt(Stmt *S);
   
   // forceRewriteMacro is needed to handle expressions like VAArgExpr
@@ -33,8 +37,68 @@ protected:
                            bool forceRewriteMacro = false);
   void processParmVarDecl(ParmVarDecl *P);
   bool tagNameMatches(TagDecl *T);
+
+  void addObjCRef(const NamedDecl *D, SourceLocation L);
+  template <class T> void addObjCProtocolRefs(const T *D);
+  void renameObjCRefs();
   
 private:
+  // The members of an instantiated class or function are copies of the
+  // template pattern and carry its source locations, so they are not walked;
+  // the pattern itself is visited once through its template decl.
+  static bool isInstantiation(const Decl *D) {
+    TemplateSpecializationKind K = TSK_Undeclared;
+    if (auto RD = dyn_cast<CXXRecordDecl>(D)) {
+      K = RD->getTemplateSpecializationKind();
+    }
+    else if (auto FD = dyn_cast<FunctionDecl>(D)) {
+      K = FD->getTemplateSpecializationKind();
+    }
+    return K == TSK_ImplicitInstantiation ||
+           K == TSK_ExplicitInstantiationDeclaration ||
+           K == TSK_ExplicitInstantiationDefinition;
+  }
+
+  // A type spelled in a header or a macro body is seen again and again with
+  // the same spelling location; once its TypeLoc subtree is known to hold
+  // nothing to rename, it is skipped for the rest of the translation unit.
+  // The type itself and forceRewriteMacro are part of the key, because a
+  // macro body may spell different types at the same location.
+  struct TypeLocKey {
+    unsigned spellingLoc;
+    unsigned typeLocClass;
+    const void *type;
+    bool forceRewriteMacro;
+
+    bool operator<(const TypeLocKey &O) const {
+      if (spellingLoc != O.spellingLoc) {
+        return spellingLoc < O.spellingLoc;
+      }
+      if (typeLocClass != O.typeLocClass) {
+        return typeLocClass < O.typeLocClass;
+      }
+      if (type != O.type) {
+        return type < O.type;
+      }
+      return forceRewriteMacro < O.forceRewriteMacro;
+    }
+  };
+
+  std::set<TypeLocKey> unmatchedTypeLocs;
+
+  // Objective-C class and protocol names written in @interface,
+  // @implementation, @protocol and category headers, by the declaration
+  // they refer to. Each declaration is looked up once and all of its
+  // locations are renamed by renameObjCRefs.
+  typedef std::map<const NamedDecl *, std::set<SourceLocation> > ObjCRefMap;
+  ObjCRefMap objcRefs;
+
+  // subtrees cut short by an ignored or macro location are not memoized
+  unsigned typeLocBailouts;
+  unsigned typeLocMemoHits;
+  unsigned typeLocMemoLookups;
+
+
   // a quick way to get the whole TypeLocClass tree
   static std::string typeLocClassName(TypeLoc::TypeLocClass C) {
     std::string src;
@@ -72,6 +136,11 @@ void TypeRenameTransform::HandleTranslationUnit(ASTContext &C)
   auto TUD = C.getTranslationUnitDecl();
   collectRenameDecls(TUD, true);
   processDeclContext(TUD, true);
+  renameObjCRefs();
+  flushMacroRenames();
+
+  TransformRegistry::get().countSkipped("TypeRename type locations",
+                                       typeLocMemoHits, typeLocMemoLookups);
 }
 
 void TypeRenameTransform::collectRenameDecls(DeclContext *DC, bool topLevel)
@@ -87,15 +156,39 @@ void TypeRenameTransform::collectRenameDecls(DeclContext *DC, bool topLevel)
   for(auto I = DC->decls_begin(), E = DC->decls_end(); I != E; ++I) {
     auto L = (*I)->getLocation();
     
-    if (auto TD = dyn_cast<TagDecl>(*I)) {
+    if (auto D = dyn_cast<ClassTemplateSpecializationDecl>(*I)) {
+      // the name is part of the type as written, which processDeclContext
+      // renames along with the template arguments; the match is still
+      // recorded for the ctors and dtors of an explicit specialization
+      std::string newName;
+      nameMatches(D, newName);
+    }
+    else if (auto TD = dyn_cast<TagDecl>(*I)) {
       std::string newName;
       if (nameMatches(TD, newName)) {
         renameLocation(L, newName);
       }
     }
+    else if (auto D = dyn_cast<ObjCCategoryDecl>(*I)) {
+      // categories are matched as Class(Category), the class name is
+      // renamed through the class
+      std::string newName;
+      if (nameMatches(D, newName)) {
+        renameLocation(D->getCategoryNameLoc(), newName);
+      }
+    }
+    else if (auto D = dyn_cast<ObjCCategoryImplDecl>(*I)) {
+      std::string newName;
+      if (nameMatches(D, newName)) {
+        renameLocation(D->getCategoryNameLoc(), newName);
+      }
+    }
+    else if (isa<ObjCImplementationDecl>(*I)) {
+      // the class name of an @implementation is an ObjC reference to its
+      // @interface, see processDeclContext
+    }
     else if (auto D = dyn_cast<ObjCContainerDecl>(*I)) {
-      // Objective-C containers (@interface, @implementation incl. categories,
-      // @protocol)
+      // Objective-C containers (@interface, @protocol)
       std::string newName;
       if (nameMatches(D, newName)) {
         renameLocation(L, newName);
@@ -122,7 +215,9 @@ void TypeRenameTransform::collectRenameDecls(DeclContext *DC, bool topLevel)
 
     // descend into the next level (namespace, etc.)    
     if (auto innerDC = dyn_cast<DeclContext>(*I)) {
-      collectRenameDecls(innerDC);
+      if (!isInstantiation(*I)) {
+        collectRenameDecls(innerDC);
+      }
     }
   }
   popIndent();  
@@ -154,29 +249,20 @@ void TypeRenameTransform::processDeclContext(DeclContext *DC, bool topLevel)
       }
     }
     else if (auto D = dyn_cast<ClassTemplateSpecializationDecl>(*I)) {
+      // explicit (partial) specializations and explicit instantiations
       if (auto TSI = D->getTypeAsWritten()) {
         processTypeLoc(TSI->getTypeLoc());
       }
+
+      // an explicit instantiation's bases are the pattern's
+      if (!isInstantiation(D)) {
+        processRecordBases(D);
+      }
     }
     else if (auto TD = dyn_cast<TagDecl>(*I)) {
       if (auto CRD = dyn_cast<CXXRecordDecl>(TD)) {
-        // can't call bases_begin() if there's no definition
-        if (CRD->hasDefinition()) {        
-          for (auto BI = CRD->bases_begin(), BE = CRD->bases_end();
-               BI != BE; ++BI) {
-            if (auto TSI = BI->getTypeSourceInfo()) {
-              processTypeLoc(TSI->getTypeLoc());
-            }
-          }
-          
-          for (auto FI = CRD->friend_begin(), FE = CRD->friend_end();
-               FI != FE; ++FI) {
-            if (auto TSI = (*FI)->getFriendType()) {
-              processTypeLoc(TSI->getTypeLoc());
-            }            
-          }
-        }
-      } // if a CXXRecordDecl
+        processRecordBases(CRD);
+      }
     }
     else if (auto D = dyn_cast<FunctionTemplateDecl>(*I)) {
       processFunctionDecl(D->getTemplatedDecl());
@@ -185,7 +271,9 @@ void TypeRenameTransform::processDeclContext(DeclContext *DC, bool topLevel)
       processDeclContext(D->getTemplatedDecl());
     }    
     else if (auto D = dyn_cast<FunctionDecl>(*I)) {
-      processFunctionDecl(D);
+      if (!isInstantiation(D)) {
+        processFunctionDecl(D);
+      }
     }
     else if (auto D = dyn_cast<VarDecl>(*I)) {
       if (auto TSI = D->getTypeSourceInfo()) {
@@ -235,62 +323,92 @@ void TypeRenameTransform::processDeclContext(DeclContext *DC, bool topLevel)
       }
     }
     
-#define FIX_PROTOCOL(D) do { \
-    std::string newName; \
-    auto PLI = D->protocol_loc_begin(); \
-    auto PLE = D->protocol_loc_end(); \
-    for (auto I = D->protocol_begin(), E = D->protocol_end(); I != E; ++I) { \
-      if (PLI == PLE) { \
-        break; \
-      } \
-      if (nameMatches(*I, newName, true)) { \
-        renameLocation(*PLI, newName); \
-      } \
-      ++PLI; \
-    } \
-  } while(0)
-  
     else if (auto D = dyn_cast<ObjCCategoryDecl>(*I)) {
-      // fix class name
-      std::string newName;
-      if (nameMatches(D->getClassInterface(), newName, true)) {
-        renameLocation(D->getLocation(), newName);
-      }
-            
-      // fix protocols
-      FIX_PROTOCOL(D);
+      // class name and protocols
+      addObjCRef(D->getClassInterface(), D->getLocation());
+      addObjCProtocolRefs(D);
     }
     else if (auto D = dyn_cast<ObjCInterfaceDecl>(*I)) {
-      // fix super class name
-      auto SC = D->getSuperClass();
-      std::string newName;
-      if (nameMatches(SC, newName, true)) {
-        renameLocation(D->getSuperClassLoc(), newName);
+      // super class name and protocols, written once in the definition
+      if (D->isThisDeclarationADefinition()) {
+        addObjCRef(D->getSuperClass(), D->getSuperClassLoc());
+        addObjCProtocolRefs(D);
       }
-     
-      // fix protocols
-      FIX_PROTOCOL(D);      
     }
     else if (auto D = dyn_cast<ObjCProtocolDecl>(*I)) {
-      // fix protocols
-      FIX_PROTOCOL(D);      
+      if (D->isThisDeclarationADefinition()) {
+        addObjCProtocolRefs(D);
+      }
     }
     else if (auto D = dyn_cast<ObjCImplDecl>(*I)) {
-      // fix class name
-      std::string newName;
-      if (nameMatches(D->getClassInterface(), newName, true)) {
-        renameLocation(D->getLocation(), newName);
-      }      
+      // class name
+      addObjCRef(D->getClassInterface(), D->getLocation());
     }
 
     // descend into the next level (namespace, etc.)    
     if (auto innerDC = dyn_cast<DeclContext>(*I)) {
-      processDeclContext(innerDC);
+      if (!isInstantiation(*I)) {
+        processDeclContext(innerDC);
+      }
     }
   }
   popIndent();
 }
 
+void TypeRenameTransform::addObjCRef(const NamedDecl *D, SourceLocation L)
+{
+  if (D && L.isValid()) {
+    objcRefs[D].insert(L);
+  }
+}
+
+template <class T>
+void TypeRenameTransform::addObjCProtocolRefs(const T *D)
+{
+  auto PLI = D->protocol_loc_begin();
+  auto PLE = D->protocol_loc_end();
+  for (auto I = D->protocol_begin(), E = D->protocol_end();
+       I != E && PLI != PLE; ++I, ++PLI) {
+    addObjCRef(*I, *PLI);
+  }
+}
+
+void TypeRenameTransform::renameObjCRefs()
+{
+  for (auto I = objcRefs.begin(), E = objcRefs.end(); I != E; ++I) {
+    std::string newName;
+    if (!nameMatches(I->first, newName, true)) {
+      continue;
+    }
+
+    for (auto LI = I->second.begin(), LE = I->second.end(); LI != LE; ++LI) {
+      renameLocation(*LI, newName);
+    }
+  }
+  objcRefs.clear();
+}
+
+void TypeRenameTransform::processRecordBases(CXXRecordDecl *CRD)
+{
+  // can't call bases_begin() if there's no definition
+  if (!CRD->hasDefinition()) {
+    return;
+  }
+
+  for (auto BI = CRD->bases_begin(), BE = CRD->bases_end(); BI != BE; ++BI) {
+    if (auto TSI = BI->getTypeSourceInfo()) {
+      processTypeLoc(TSI->getTypeLoc());
+    }
+  }
+  
+  for (auto FI = CRD->friend_begin(), FE = CRD->friend_end();
+       FI != FE; ++FI) {
+    if (auto TSI = (*FI)->getFriendType()) {
+      processTypeLoc(TSI->getTypeLoc());
+    }            
+  }
+}
+
 void TypeRenameTransform::processStmt(Stmt *S)
 {
   if (!S) {
@@ -487,14 +605,32 @@ void TypeRenameTransform::processTypeLoc(TypeLoc TL, bool forceRewriteMacro)
   
   // ignore system headers
   if (shouldIgnore(BL)) {
+    typeLocBailouts++;
     return;
   }
   
   // is a result from macro expansion? sorry...
   if (BL.isMacroID() && !forceRewriteMacro) {
     llvm::errs() << "Cannot rename type from macro expansion at: " << loc(BL) << "\n";
+    typeLocBailouts++;
     return;
   }
+
+  TypeLocKey key;
+  key.spellingLoc =
+    sema->getSourceManager().getSpellingLoc(BL).getRawEncoding();
+  key.typeLocClass = TL.getTypeLocClass();
+  key.type = TL.getType().getAsOpaquePtr();
+  key.forceRewriteMacro = forceRewriteMacro;
+
+  typeLocMemoLookups++;
+  if (unmatchedTypeLocs.count(key)) {
+    typeLocMemoHits++;
+    return;
+  }
+
+  unsigned renamesBefore = getRenameCount();
+  unsigned bailoutsBefore = typeLocBailouts;
   
   // TODO: Take care of spelling loc finesses
   // BL = sema->getSourceManager().getSpellingLoc(BL);
@@ -644,6 +780,10 @@ void TypeRenameTransform::processTypeLoc(TypeLoc TL, bool forceRewriteMacro)
   }
   
   processTypeLoc(TL.getNextTypeLoc(), forceRewriteMacro);
+
+  if (getRenameCount() == renamesBefore && typeLocBailouts == bailoutsBefore) {
+    unmatchedTypeLocs.insert(key);
+  }
   popIndent();
 }
 
@@ -0,0 +1,208 @@
+//
+// USRGeneration.cpp
+//
+
+#include "USRGeneration.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <clang/AST/DeclCXX.h>
+#include <clang/AST/DeclObjC.h>
+#include <clang/AST/DeclTemplate.h>
+#include <clang/Basic/SourceManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace clang;
+
+static bool printUSR(const Decl *D, llvm::raw_ostream &OS);
+
+static const char *tagKindCode(const TagDecl *T)
+{
+  // class and struct are kept apart on purpose: TypeRename matches against
+  // "class Foo" and "struct Foo", and a USR must never map two different
+  // match keys to the same cache entry
+  switch (T->getTagKind()) {
+    case TTK_Struct:    return "S";
+    case TTK_Class:     return "C";
+    case TTK_Union:     return "U";
+    case TTK_Enum:      return "E";
+    default:            return "I";
+  }
+}
+
+static bool printContextUSR(const DeclContext *DC, llvm::raw_ostream &OS)
+{
+  if (!DC || isa<TranslationUnitDecl>(DC)) {
+    return true;
+  }
+
+  // extern "C" { ... } does not contribute to the name
+  if (isa<LinkageSpecDecl>(DC)) {
+    return printContextUSR(DC->getParent(), OS);
+  }
+
+  // locals have no identity outside of their function
+  if (DC->isFunctionOrMethod()) {
+    return false;
+  }
+
+  return printUSR(Decl::castFromDeclContext(DC), OS);
+}
+
+static bool printUSR(const Decl *D, llvm::raw_ostream &OS)
+{
+  // Objective-C declarations live at the translation unit level and carry
+  // their own prefix
+  if (auto ID = dyn_cast<ObjCInterfaceDecl>(D)) {
+    OS << "objc(cs)" << ID->getName();
+    return true;
+  }
+  if (auto ID = dyn_cast<ObjCImplementationDecl>(D)) {
+    OS << "objc(cs)" << ID->getName();
+    return true;
+  }
+  if (auto CD = dyn_cast<ObjCCategoryDecl>(D)) {
+    auto CI = CD->getClassInterface();
+    if (!CI) {
+      return false;
+    }
+    OS << "objc(cy)" << CI->getName() << "@" << CD->getName();
+    return true;
+  }
+  if (auto CD = dyn_cast<ObjCCategoryImplDecl>(D)) {
+    auto CI = CD->getClassInterface();
+    if (!CI) {
+      return false;
+    }
+    OS << "objc(cy)" << CI->getName() << "@" << CD->getName();
+    return true;
+  }
+  if (auto PD = dyn_cast<ObjCProtocolDecl>(D)) {
+    OS << "objc(pl)" << PD->getName();
+    return true;
+  }
+
+  if (!printContextUSR(D->getDeclContext(), OS)) {
+    return false;
+  }
+
+  if (auto MD = dyn_cast<ObjCMethodDecl>(D)) {
+    OS << (MD->isInstanceMethod() ? "(im)" : "(cm)")
+       << MD->getSelector().getAsString();
+    return true;
+  }
+  if (auto PD = dyn_cast<ObjCPropertyDecl>(D)) {
+    OS << "(py)" << PD->getName();
+    return true;
+  }
+
+  if (auto ND = dyn_cast<NamespaceDecl>(D)) {
+    if (ND->isAnonymousNamespace()) {
+      OS << "@aN";
+    }
+    else {
+      OS << "@N@" << ND->getName();
+    }
+    return true;
+  }
+
+  if (auto CTD = dyn_cast<ClassTemplateDecl>(D)) {
+    OS << "@ST" << tagKindCode(CTD->getTemplatedDecl()) << "@"
+       << CTD->getName();
+    return true;
+  }
+
+  if (auto CTSD = dyn_cast<ClassTemplateSpecializationDecl>(D)) {
+    // partial and explicit specializations are distinct entities; tell them
+    // apart by their canonical type, e.g. Foo<int *>
+    QualType T(CTSD->getTypeForDecl(), 0);
+    OS << "@" << tagKindCode(CTSD) << "@" << CTSD->getName() << ">"
+       << T.getCanonicalType().getAsString();
+    return true;
+  }
+
+  if (auto TD = dyn_cast<TagDecl>(D)) {
+    if (TD->getIdentifier()) {
+      OS << "@" << tagKindCode(TD) << "@" << TD->getName();
+      return true;
+    }
+
+    // typedef struct { ... } Foo;
+    if (auto TND = TD->getTypedefNameForAnonDecl()) {
+      OS << "@" << tagKindCode(TD) << "@" << TND->getName();
+      return true;
+    }
+
+    return false;
+  }
+
+  if (auto FD = dyn_cast<FunctionDecl>(D)) {
+    // the canonical function type tells overloads apart (and includes
+    // the cv-qualifiers of member functions)
+    OS << (FD->getDescribedFunctionTemplate() ? "@FT@" : "@F@")
+       << FD->getNameAsString() << "#"
+       << FD->getType().getCanonicalType().getAsString();
+    return true;
+  }
+
+  if (auto TD = dyn_cast<TypedefNameDecl>(D)) {
+    OS << "@T@" << TD->getName();
+    return true;
+  }
+
+  if (auto FD = dyn_cast<FieldDecl>(D)) {
+    if (!FD->getIdentifier()) {
+      return false;
+    }
+    OS << "@FI@" << FD->getName();
+    return true;
+  }
+
+  if (auto ID = dyn_cast<ObjCIvarDecl>(D)) {
+    OS << "@" << ID->getName();
+    return true;
+  }
+
+  if (isa<VarDecl>(D) || isa<EnumConstantDecl>(D)) {
+    auto ND = cast<NamedDecl>(D);
+    if (!ND->getIdentifier()) {
+      return false;
+    }
+    OS << "@" << ND->getName();
+    return true;
+  }
+
+  return false;
+}
+
+std::string getUSRForDecl(const Decl *D)
+{
+  if (!D || !D->getLocation().isValid()) {
+    return std::string();
+  }
+
+  std::string usr;
+  llvm::raw_string_ostream OS(usr);
+  OS << "c:";
+
+  // names with internal linkage (static functions, anything inside an
+  // anonymous namespace) are only unique within the file that declares them
+  if (auto ND = dyn_cast<NamedDecl>(D)) {
+    auto L = ND->getLinkage();
+    if (L == InternalLinkage || L == UniqueExternalLinkage) {
+      SourceManager &SM = D->getASTContext().getSourceManager();
+      auto EL = SM.getExpansionLoc(D->getLocation());
+      const FileEntry *FE = SM.getFileEntryForID(SM.getFileID(EL));
+      if (!FE) {
+        return std::string();
+      }
+      OS << FE->getName() << "@";
+    }
+  }
+
+  if (!printUSR(D, OS)) {
+    return std::string();
+  }
+
+  return OS.str();
+}
@@ -0,0 +1,23 @@
+//
+// USRGeneration.h: Unified Symbol Resolution strings for declarations
+//
+
+#ifndef USR_GENERATION_H
+#define USR_GENERATION_H
+
+#include <string>
+
+namespace clang {
+  class Decl;
+}
+
+// Returns a string that identifies D across translation units, or an empty
+// string if D has no stable identity (function locals, anonymous records
+// etc.)
+//
+// The scheme follows libclang's clang_getCursorUSR, which is not available
+// to C++ clients of the Clang version we build against. USRs are only ever
+// compared with each other, so they need not be byte-identical to libclang's.
+std::string getUSRForDecl(const clang::Decl *D);
+
+#endif
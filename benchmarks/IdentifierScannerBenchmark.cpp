@@ -0,0 +1,123 @@
+//
+// IdentifierScannerBenchmark.cpp: IdentifierScanner throughput in GB/s
+//
+// Usage: identifier-scanner-benchmark [file...]
+//
+// Scans the given files (or 64 MB of generated C source) for a set of
+// literals with every kernel the machine supports, and with one
+// std::string::find pass per literal for comparison. The results of all
+// methods are checked against each other.
+//
+
+#include "IdentifierScanner.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+using namespace std;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static string generateSource(size_t size)
+{
+  static const char *const words[] = {
+    "int", "return", "struct", "const", "char", "void", "if", "else",
+    "sqlite3_value", "buffer", "length", "offset", "static", "unsigned",
+    "while", "for", "NULL", "size_t", "memcpy", "pTab", "db", "rc", 0
+  };
+  unsigned numWords = 0;
+  while (words[numWords]) {
+    numWords++;
+  }
+
+  string text;
+  text.reserve(size + 64);
+  srand(1);
+  while (text.size() < size) {
+    text += words[rand() % numWords];
+    text += (rand() % 8) ? " " : ";\n  ";
+  }
+  return text;
+}
+
+static double gbPerSecond(size_t bytes, unsigned rounds, double seconds)
+{
+  return seconds > 0 ? bytes * (double)rounds / seconds / 1e9 : 0;
+}
+
+int main(int argc, char **argv)
+{
+  string text;
+  if (argc > 1) {
+    for (int i = 1; i < argc; ++i) {
+      ifstream in(argv[i]);
+      stringstream buffer;
+      buffer << in.rdbuf();
+      text += buffer.str();
+    }
+  }
+  else {
+    text = generateSource(64 << 20);
+  }
+
+  vector<string> literals;
+  literals.push_back("sqlite3_");
+  literals.push_back("sqlite4_stmt");
+  literals.push_back("Refactorial");
+  literals.push_back("TreeNode");
+
+  const unsigned rounds = 5;
+  cout << "scanning " << text.size() / 1e6 << " MB for " << literals.size()
+       << " literals, " << rounds << " rounds\n";
+
+  vector<bool> expected(literals.size(), false);
+  double start = now();
+  for (unsigned r = 0; r < rounds; ++r) {
+    for (unsigned i = 0; i < literals.size(); ++i) {
+      expected[i] = text.find(literals[i]) != string::npos;
+    }
+  }
+  printf("  %-18s %6.2f GB/s\n", "std::string::find",
+         gbPerSecond(text.size(), rounds, now() - start));
+
+  IdentifierScanner scanner(literals, IdentifierScanner::Substring);
+  const IdentifierScanner::Kernel kernels[] = {
+    IdentifierScanner::ScalarKernel,
+    IdentifierScanner::SSE2Kernel,
+    IdentifierScanner::AVX2Kernel
+  };
+
+  int status = 0;
+  for (unsigned k = 0; k < 3; ++k) {
+    if (kernels[k] > IdentifierScanner::getBestKernel()) {
+      continue;
+    }
+    IdentifierScanner::setKernel(kernels[k]);
+
+    vector<bool> found;
+    start = now();
+    for (unsigned r = 0; r < rounds; ++r) {
+      scanner.scan(text.data(), text.data() + text.size(), found);
+    }
+    printf("  %-18s %6.2f GB/s\n",
+           IdentifierScanner::getKernelName(kernels[k]),
+           gbPerSecond(text.size(), rounds, now() - start));
+
+    if (found != expected) {
+      cerr << "error: " << IdentifierScanner::getKernelName(kernels[k])
+           << " kernel disagrees with std::string::find\n";
+      status = 1;
+    }
+  }
+
+  return status;
+}
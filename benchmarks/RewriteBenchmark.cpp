@@ -0,0 +1,125 @@
+//
+// RewriteBenchmark.cpp: applying many replacements to one large file
+//
+// Usage: rewrite-benchmark [megabytes] [edits]
+//
+// Writes a generated C file (5 MB by default) to a temporary directory and
+// renames identifiers in it (100k edits by default), once through the
+// Rewriter, one ReplaceText per edit, and once with the single-pass
+// applySortedReplacements. Both results are checked against each other.
+//
+
+#include "Refactoring.h"
+
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/DiagnosticOptions.h>
+#include <clang/Basic/FileManager.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Rewrite/Core/Rewriter.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace clang;
+using namespace std;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// statements of the form "  sqlite3_value *v123 = sqlite3_column(p, 123);"
+static string generateSource(size_t size, vector<unsigned> &outOffsets)
+{
+  string text;
+  text.reserve(size + 128);
+  char line[128];
+  for (unsigned i = 0; text.size() < size; ++i) {
+    outOffsets.push_back(text.size() + 2);
+    snprintf(line, sizeof(line), "  sqlite3_value *v%u = ", i);
+    text += line;
+    outOffsets.push_back(text.size());
+    snprintf(line, sizeof(line), "sqlite3_column(p, %u);\n", i);
+    text += line;
+  }
+  return text;
+}
+
+int main(int argc, char **argv)
+{
+  size_t megabytes = argc > 1 ? atoi(argv[1]) : 5;
+  size_t edits = argc > 2 ? atoi(argv[2]) : 100000;
+
+  vector<unsigned> offsets;
+  string text = generateSource(megabytes << 20, offsets);
+  if (edits > offsets.size()) {
+    edits = offsets.size();
+  }
+
+  char dir[] = "/tmp/rewrite-benchmark.XXXXXX";
+  if (!mkdtemp(dir)) {
+    cerr << "error: cannot create a temporary directory\n";
+    return 1;
+  }
+  string path = string(dir) + "/big.c";
+  {
+    ofstream out(path.c_str(), ios::binary);
+    out << text;
+  }
+
+  // every few statements, rename both identifiers from sqlite3_ to sqlite4_
+  Replacements replaces;
+  size_t stride = offsets.size() / edits;
+  for (size_t i = 0; replaces.size() < edits; i += stride) {
+    replaces.push_back(Replacement(path, offsets[i], 8, "sqlite4_"));
+  }
+  cout << "applying " << replaces.size() << " edits to a "
+       << text.size() / 1e6 << " MB file\n";
+
+  DiagnosticOptions *diagOpts = new DiagnosticOptions;
+  IntrusiveRefCntPtr<DiagnosticIDs> diagIDs(new DiagnosticIDs());
+  DiagnosticsEngine diagnostics(diagIDs, diagOpts);
+  FileManager files((FileSystemOptions()));
+  SourceManager sources(diagnostics, files);
+  LangOptions langOpts;
+  Rewriter rewrite(sources, langOpts);
+
+  // load the file before timing
+  const FileEntry *entry = files.getFile(path);
+  FileID id = sources.createFileID(entry, SourceLocation(), SrcMgr::C_User);
+  llvm::StringRef contents = sources.getBufferData(id);
+
+  double start = now();
+  for (size_t i = 0; i < replaces.size(); ++i) {
+    replaces[i].apply(rewrite);
+  }
+  string viaRewriter;
+  llvm::raw_string_ostream stream(viaRewriter);
+  rewrite.getEditBuffer(id).write(stream);
+  stream.flush();
+  double rewriterTime = now() - start;
+  printf("  %-24s %8.3f s\n", "Rewriter", rewriterTime);
+
+  start = now();
+  string singlePass;
+  bool ok = applySortedReplacements(contents, replaces.begin(),
+                                    replaces.end(), singlePass);
+  double singlePassTime = now() - start;
+  printf("  %-24s %8.3f s\n", "applySortedReplacements", singlePassTime);
+
+  unlink(path.c_str());
+  rmdir(dir);
+
+  if (!ok || singlePass != viaRewriter) {
+    cerr << "error: the results differ\n";
+    return 1;
+  }
+  return 0;
+}
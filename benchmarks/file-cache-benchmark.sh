@@ -0,0 +1,104 @@
+#!/bin/sh
+#
+# file-cache-benchmark.sh: system calls and wall time with and without the
+# run-wide file cache
+#
+# Usage: file-cache-benchmark.sh [refactorial] [TUs] [headers] [include dirs]
+#
+# Generates TUs that all include the same headers, found in the last of
+# several -I directories, and runs three rename transforms over them with
+# and without --no-file-cache. The renames match nothing, so both runs see
+# the same tree. System calls are counted with strace -f -c when strace is
+# installed.
+#
+
+REFACTORIAL=${1:-`pwd`/refactorial}
+TUS=${2:-50}
+HEADERS=${3:-40}
+DIRS=${4:-8}
+DIR=`mktemp -d /tmp/file-cache-benchmark.XXXXXX`
+cd $DIR
+
+flags=""
+d=0
+while [ $d -lt $DIRS ]; do
+  mkdir inc$d
+  flags="$flags -Iinc$d"
+  d=`expr $d + 1`
+done
+d=`expr $DIRS - 1`
+
+h=0
+while [ $h -lt $HEADERS ]; do
+  cat > inc$d/h$h.h <<EOT
+#ifndef H${h}_H
+#define H${h}_H
+#include <stddef.h>
+namespace bench {
+  struct S$h { int field$h; size_t size; };
+  inline int f$h(const S$h &s) { return s.field$h; }
+}
+#endif
+EOT
+  h=`expr $h + 1`
+done
+
+echo "[" > compile_commands.json
+t=0
+while [ $t -lt $TUS ]; do
+  : > tu$t.cpp
+  h=0
+  while [ $h -lt $HEADERS ]; do
+    echo "#include \"h$h.h\"" >> tu$t.cpp
+    h=`expr $h + 1`
+  done
+  echo "int use$t() { bench::S0 s = { $t, 0 }; return bench::f0(s); }" >> tu$t.cpp
+  [ $t -gt 0 ] && echo "," >> compile_commands.json
+  echo "{ \"directory\": \"$DIR\", \"command\": \"clang++ -c$flags tu$t.cpp\", \"file\": \"$DIR/tu$t.cpp\" }" >> compile_commands.json
+  t=`expr $t + 1`
+done
+echo "]" >> compile_commands.json
+
+cat > rename.yml <<EOT
+---
+Prefilter: false
+Transforms:
+  TypeRename:
+    Ignore:
+      - /usr/.*
+    Types:
+      - class bench::Missing: Bar
+  FunctionRename:
+    Ignore:
+      - /usr/.*
+    Functions:
+      - bench::missing: bar
+  RecordFieldRename:
+    Ignore:
+      - /usr/.*
+    Fields:
+      - bench::Missing::field: bar
+EOT
+
+run()
+{
+  start=`date +%s.%N`
+  if which strace > /dev/null 2>&1; then
+    strace -f -c -o strace-$1.log $REFACTORIAL $2 < rename.yml 2> refactorial-$1.log
+  else
+    $REFACTORIAL $2 < rename.yml 2> refactorial-$1.log
+  fi
+  end=`date +%s.%N`
+  echo "$start $end" | awk -v name=$1 '{ printf "%-10s wall time: %.2f s\n", name, $2 - $1 }'
+  if [ -f strace-$1.log ]; then
+    awk -v name=$1 '
+      $NF == "total" { total = $3 }
+      $NF ~ /^(open|openat|stat|lstat|newfstatat|fstat|read|mmap)$/ { file += $4 }
+      END { printf "%-10s syscalls: %d, file related: %d\n", name, total, file }' strace-$1.log
+  fi
+}
+
+echo "$TUS TUs, $HEADERS headers behind $DIRS include directories, in $DIR"
+run uncached --no-file-cache
+run cached ""
+grep "^FileCache:" refactorial-cached.log
@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# schedule-benchmark.sh: wall time with and without header-sharing-aware
+# translation unit scheduling
+#
+# Usage: schedule-benchmark.sh [refactorial] [TUs] [groups] [headers]
+#
+# Generates groups of headers and TUs that each include the headers of one
+# group. The compilation database lists the TUs round-robin over the
+# groups, the worst order for any cache. The same rename (which matches
+# nothing) is run with Schedule: false and Schedule: true, each with and
+# without the run-wide file cache.
+#
+
+REFACTORIAL=${1:-`pwd`/refactorial}
+TUS=${2:-120}
+GROUPS=${3:-6}
+HEADERS=${4:-30}
+DIR=`mktemp -d /tmp/schedule-benchmark.XXXXXX`
+cd $DIR
+
+g=0
+while [ $g -lt $GROUPS ]; do
+  mkdir group$g
+  h=0
+  while [ $h -lt $HEADERS ]; do
+    cat > group$g/h$h.h <<EOT
+#ifndef G${g}_H${h}_H
+#define G${g}_H${h}_H
+namespace group$g {
+  struct S$h { int a; long b; double c; };
+  template <class T> struct Box$h { T value; S$h s; };
+  inline int f$h(const Box$h<S$h> &b) { return b.value.a + b.s.a; }
+}
+#endif
+EOT
+    h=`expr $h + 1`
+  done
+  g=`expr $g + 1`
+done
+
+echo "[" > compile_commands.json
+t=0
+while [ $t -lt $TUS ]; do
+  g=`expr $t % $GROUPS`
+  : > tu$t.cpp
+  h=0
+  while [ $h -lt $HEADERS ]; do
+    echo "#include \"group$g/h$h.h\"" >> tu$t.cpp
+    h=`expr $h + 1`
+  done
+  echo "int use$t() { group$g::Box0<group$g::S0> b; return group$g::f0(b); }" >> tu$t.cpp
+  [ $t -gt 0 ] && echo "," >> compile_commands.json
+  echo "{ \"directory\": \"$DIR\", \"command\": \"clang++ -c tu$t.cpp\", \"file\": \"$DIR/tu$t.cpp\" }" >> compile_commands.json
+  t=`expr $t + 1`
+done
+echo "]" >> compile_commands.json
+
+for schedule in false true; do
+  cat > rename-$schedule.yml <<EOT
+---
+Prefilter: false
+Schedule: $schedule
+Transforms:
+  TypeRename:
+    Ignore:
+      - /usr/.*
+    Types:
+      - class Missing: Bar
+EOT
+done
+
+run()
+{
+  start=`date +%s.%N`
+  $REFACTORIAL $3 < rename-$2.yml 2> refactorial-$1.log
+  end=`date +%s.%N`
+  echo "$start $end" | awk -v name=$1 '{ printf "%-28s wall time: %.2f s\n", name, $2 - $1 }'
+}
+
+echo "$TUS TUs over $GROUPS header groups of $HEADERS headers, in $DIR"
+run "database order, no cache" false --no-file-cache
+run "scheduled, no cache" true --no-file-cache
+run "database order, file cache" false ""
+run "scheduled, file cache" true ""
@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# template-rename-benchmark.sh: TypeRename wall time on template-heavy code
+#
+# Usage: template-rename-benchmark.sh [refactorial] [TUs] [depth]
+#
+# Generates a header of nested class templates with explicit
+# specializations and instantiations, and TUs that instantiate them at
+# every depth, then times one TypeRename run over all of them. The
+# TypeRename memo statistics printed for each TU are summed up at the end.
+#
+
+REFACTORIAL=${1:-`pwd`/refactorial}
+TUS=${2:-50}
+DEPTH=${3:-8}
+DIR=`mktemp -d /tmp/template-rename-benchmark.XXXXXX`
+cd $DIR
+
+cat > templates.h <<EOT
+namespace bench {
+  class Foo { public: int x; };
+  template <class T> class Box { public: T value; };
+  template <> class Box<Foo> : public Foo { public: Box() {} };
+  template <class T, class U> class Pair { public: Box<T> a; Box<U> b; };
+EOT
+i=1
+while [ $i -le $DEPTH ]; do
+  p=`expr $i - 1`
+  cat >> templates.h <<EOT
+  template <class T> class Level$i {
+  public:
+    Pair<Level$p<T>, Box<T> > inner;
+    template <class U> Level$i<U> rebind() const { return Level$i<U>(); }
+  };
+EOT
+  i=`expr $i + 1`
+done
+sed -i 's/Level0<T>/Box<T>/' templates.h
+echo "  template class Level$DEPTH<Foo>;" >> templates.h
+echo "}" >> templates.h
+
+echo "[" > compile_commands.json
+t=0
+while [ $t -lt $TUS ]; do
+  echo "#include \"templates.h\"" > tu$t.cpp
+  i=1
+  while [ $i -le $DEPTH ]; do
+    cat >> tu$t.cpp <<EOT
+int use${t}_$i() {
+  bench::Level$i<bench::Foo> a;
+  bench::Level$i<bench::Box<bench::Foo> > b = a.rebind<bench::Box<bench::Foo> >();
+  return sizeof(a) + sizeof(b);
+}
+EOT
+    i=`expr $i + 1`
+  done
+  [ $t -gt 0 ] && echo "," >> compile_commands.json
+  echo "{ \"directory\": \"$DIR\", \"command\": \"clang++ -c tu$t.cpp\", \"file\": \"$DIR/tu$t.cpp\" }" >> compile_commands.json
+  t=`expr $t + 1`
+done
+echo "]" >> compile_commands.json
+
+cat > rename.yml <<EOT
+---
+Prefilter: false
+Transforms:
+  TypeRename:
+    Ignore:
+      - /usr/.*
+    Types:
+      - class bench::Foo: Bar
+EOT
+
+echo "$TUS TUs, template depth $DEPTH, in $DIR"
+start=`date +%s.%N`
+$REFACTORIAL < rename.yml 2> refactorial.log
+end=`date +%s.%N`
+echo "$start $end" | awk '{ printf "wall time: %.2f s\n", $2 - $1 }'
+awk '/^Skipped [0-9]+ of [0-9]+ TypeRename type locations/ { hits += $2; lookups += $4 }
+     END { if (lookups) printf "type memo: %d of %d type locations skipped (%d%%)\n", hits, lookups, hits * 100 / lookups }' refactorial.log
@@ -0,0 +1,19 @@
+#ifndef HASH_UTIL
+#define HASH_UTIL
+
+#include <stdint.h>
+#include <llvm/ADT/StringRef.h>
+
+// 64-bit FNV-1a. Unlike llvm::hash_value this is stable across runs and
+// builds, so the results can be written to disk and compared later.
+inline uint64_t hashString(llvm::StringRef S,
+                           uint64_t H = 14695981039346656037ULL)
+{
+  for (llvm::StringRef::iterator I = S.begin(), E = S.end(); I != E; ++I) {
+    H ^= (unsigned char)*I;
+    H *= 1099511628211ULL;
+  }
+  return H;
+}
+
+#endif //HASH_UTIL
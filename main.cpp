@@ -10,26 +10,145 @@
 #include <clang/Tooling/CompilationDatabase.h>
 #include <clang/Tooling/Tooling.h>
 #include "Refactoring.h"
+#include "FileCache.h"
+#include "hash-util.h"
 
 #include <iostream>
 #include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
 
+#include <stdlib.h>
 #include <unistd.h>
 
 using namespace clang;
 using namespace std;
 
 #include "Transforms/Transforms.h"
+#include "Transforms/RenameMatchCache.h"
+#include "Transforms/RenameRules.h"
+#include "Transforms/SymbolIndex.h"
+#include "Transforms/TUPrefilter.h"
+#include "Transforms/TUTimings.h"
+
+//translation units timed in worker processes, reported by the supervisor
+static void addWorkerTimings(CheckpointLog &checkpoint)
+{
+	auto timings = checkpoint.takeTimings();
+	for(auto iter = timings.begin(); iter != timings.end(); ++iter)
+		TUTimings::get().addFile(iter->first, iter->second.first, iter->second.second);
+}
 
 int main(int argc, char **argv)
 {	
 	string errorMessage("Could not load compilation database");
 
+	//with --pipeline, each section works on the files as rewritten by the
+	//previous sections in memory, and the files are written once at the end
+	bool pipeline = false;
+	//with --checkpoint, translation units run in worker processes and their
+	//replacements are logged; --resume skips those an earlier run completed
+	string checkpointPath;
+	bool resume = false;
+	//per translation unit budgets, enforced by running it in a worker process
+	double timeBudget = 0;
+	double memoryBudget = 0;
+	//every run logs how to undo its edits; --undo restores the files from
+	//such a log without parsing anything
+	string undoLogPath = "refactorial.undo";
+	string undoPath;
+	//with --verify, the translation units that include a rewritten file are
+	//parsed again at the end, to check that they still compile
+	bool verify = false;
+	bool usage = false;
+	for(int i = 1; i < argc; i++)
+	{
+		if(string(argv[i]) == "--pipeline")
+			pipeline = true;
+		else if(string(argv[i]) == "--no-file-cache")
+			FileCache::get().setEnabled(false);
+		else if(string(argv[i]) == "--checkpoint" && i + 1 < argc)
+			checkpointPath = argv[++i];
+		else if(string(argv[i]) == "--resume")
+			resume = true;
+		else if(string(argv[i]) == "--time-budget" && i + 1 < argc)
+			timeBudget = atof(argv[++i]);
+		else if(string(argv[i]) == "--memory-budget" && i + 1 < argc)
+			memoryBudget = atof(argv[++i]);
+		else if(string(argv[i]) == "--undo-log" && i + 1 < argc)
+			undoLogPath = argv[++i];
+		else if(string(argv[i]) == "--undo" && i + 1 < argc)
+			undoPath = argv[++i];
+		else if(string(argv[i]) == "--verify")
+			verify = true;
+		else
+			usage = true;
+	}
+	if(usage || (resume && checkpointPath.empty()))
+	{
+		llvm::errs() << "Usage: " << argv[0] << " [--pipeline] [--no-file-cache] [--checkpoint <log> [--resume]] [--time-budget <seconds>] [--memory-budget <MB>] [--undo-log <log>] [--verify] < config.yml\n";
+		llvm::errs() << "       " << argv[0] << " --undo <log>\n";
+		return 1;
+	}
+	if(!undoPath.empty())
+		return UndoLog::undo(undoPath) ? 0 : 1;
+
+	FileOverlay overlay;
+	TransformRegistry::get().builtinIncludes = TransformRegistry::findBuiltinIncludes();
+
 	YAML::Node compileCommands = YAML::LoadFile("compile_commands.json");
 	
-	vector<YAML::Node> config = YAML::LoadAll(cin);
+	string configText((istreambuf_iterator<char>(cin)), istreambuf_iterator<char>());
+	vector<YAML::Node> config = YAML::LoadAll(configText);
+
+	//budgets need worker processes, which report back through a log
+	bool temporaryCheckpoint = false;
+	if(checkpointPath.empty() && (timeBudget > 0 || memoryBudget > 0))
+	{
+		char tempPath[] = "/tmp/refactorial-checkpoint.XXXXXX";
+		int fd = mkstemp(tempPath);
+		if(fd != -1)
+		{
+			close(fd);
+			checkpointPath = tempPath;
+			temporaryCheckpoint = true;
+		}
+	}
+
+	//a log is only resumed by a run with the same config and mode
+	CheckpointLog checkpoint;
+	if(!checkpointPath.empty())
+	{
+		uint64_t configHash = hashString(configText, hashString(pipeline ? "pipeline" : "sections"));
+		//what workers, including those of a resumed run, learnt about the run
+		checkpoint.setStateHandler(&TransformRegistry::takeState);
+		if(!checkpoint.open(checkpointPath, configHash, resume))
+		{
+			llvm::errs() << "Could not open checkpoint log " << checkpointPath << "\n";
+			return 1;
+		}
+		TransformRegistry::get().checkpoint = &checkpoint;
+	}
+
+	//a resumed run adds to the log of the run it completes
+	UndoLog undoLog;
+	if(!undoLog.open(undoLogPath, resume))
+	{
+		llvm::errs() << "Could not open undo log " << undoLogPath << "\n";
+		return 1;
+	}
+
+	set<string> allInputFiles;
 	for(auto configSectionIter = config.begin(); configSectionIter != config.end(); ++configSectionIter)
 	{
+		unsigned section = configSectionIter - config.begin();
+		if(checkpoint.isApplied(section))
+		{
+			llvm::errs() << "Checkpoint: section " << section + 1 << " was applied by an earlier run\n";
+			TransformRegistry::get().beforeRewrite = false;
+			continue;
+		}
 		TransformRegistry::get().config = YAML::Node();
 		//figure out which files we need to work on
 		YAML::Node& configSection = *configSectionIter;
@@ -45,6 +164,7 @@ int main(int argc, char **argv)
 				inputFiles.push_back((*iter)["file"].as<string>());
 			}
 		}
+		allInputFiles.insert(inputFiles.begin(), inputFiles.end());
 		if(!configSection["Transforms"])
 		{
 			llvm::errs() << "No transforms specified in this configuration section:\n";
@@ -53,18 +173,197 @@ int main(int argc, char **argv)
 		
 		//load up the compilation database
 		llvm::OwningPtr<tooling::CompilationDatabase> Compilations(tooling::CompilationDatabase::loadFromDirectory(".", errorMessage));
-		RefactoringTool rt(*Compilations.take(), inputFiles);
+		RefactoringTool rt(*Compilations, inputFiles);
+		if(pipeline)
+			rt.setOverlay(&overlay);
+		rt.setUndoLog(&undoLog);
+		if(checkpoint.isOpen())
+		{
+			rt.setCheckpoint(&checkpoint);
+			rt.setBudgets(timeBudget, (uint64_t)(memoryBudget * 1024 * 1024));
+		}
 		
 		TransformRegistry::get().config = configSection["Transforms"];
 		TransformRegistry::get().replacements = &rt.getReplacements();
+
+		//durations of earlier runs, to start with the expensive translation units
+		if(configSection["Timings"])
+			TUTimings::get().load(configSection["Timings"].as<string>());
+
+		//bring the symbol index up to date before any transform runs
+		bool useIndex = false;
+		string indexPath;
+		if(configSection["Index"] && !overlay.empty())
+			llvm::errs() << "Index: not used, earlier sections rewrote files in memory\n";
+		else if(configSection["Index"])
+		{
+			indexPath = configSection["Index"].as<string>();
+			SymbolIndex &index = SymbolIndex::get();
+			index.load(indexPath);
+			vector<string> staleFiles = index.staleTranslationUnits(inputFiles);
+			if(!staleFiles.empty())
+			{
+				llvm::errs() << "Indexing " << staleFiles.size() << " of " << inputFiles.size() << " translation units\n";
+				tooling::ClangTool indexTool(*Compilations, staleFiles);
+				TUTimings::get().setTransform("SymbolIndex");
+				indexTool.run(new TransformFactory(TransformRegistry::get()["SymbolIndexTransform"]));
+				TUTimings::get().printReport(llvm::errs());
+				index.save(indexPath);
+			}
+			useIndex = true;
+		}
+		
+		//without an index, a rename can still skip the translation units that
+		//never spell a name its rules could match
+		bool usePrefilter = !configSection["Prefilter"] || configSection["Prefilter"].as<bool>();
+		TUPrefilter prefilter(*Compilations);
+		prefilter.setOverlay(&overlay);
+
+		//visit the translation units that share headers back to back, using
+		//the include lists of the index or else a scan of the #includes
+		bool useSchedule = !configSection["Schedule"] || configSection["Schedule"].as<bool>();
+		if(useSchedule && inputFiles.size() > 2)
+		{
+			for(auto iter = inputFiles.begin(); iter != inputFiles.end(); ++iter)
+			{
+				vector<string> includes;
+				if(!useIndex || !SymbolIndex::get().includedFiles(*iter, includes))
+					prefilter.includeClosure(*iter, includes);
+				rt.setIncludes(*iter, includes);
+			}
+		}
 		
 		//finally, run
 		for(auto iter = configSection["Transforms"].begin(); iter != configSection["Transforms"].end(); iter++)
 		{
-			
-			llvm::errs() << iter->first.as<string>() +"Transform" << "\n";
-			rt.run(new TransformFactory(TransformRegistry::get()[iter->first.as<string>() + "Transform"]));
+			string transformName = iter->first.as<string>();
+			llvm::errs() << transformName + "Transform" << "\n";
+			TransformFactory *factory = new TransformFactory(TransformRegistry::get()[transformName + "Transform"]);
+
+			//report on the previous transform, then predict this one
+			addWorkerTimings(checkpoint);
+			TUTimings::get().printReport(llvm::errs());
+			TUTimings::get().setTransform(transformName);
+			checkpoint.setStep(section, transformName);
+			rt.clearCosts();
+			for(auto fileIter = inputFiles.begin(); fileIter != inputFiles.end(); ++fileIter)
+			{
+				double seconds;
+				if(TUTimings::get().predict(*fileIter, seconds))
+					rt.setCost(*fileIter, seconds);
+			}
+
+			//a rename only needs the translation units that refer to a matching symbol
+			string renameKeyName;
+			SymbolIndex::SymbolKind kind;
+			RenameRules rules;
+			if((useIndex || usePrefilter)
+			   && RenameRules::getRenameKeyName(transformName, renameKeyName)
+			   && rules.load(configSection["Transforms"], transformName, renameKeyName, "Ignore", false))
+			{
+				if(useIndex && SymbolIndex::getSymbolKind(transformName, kind))
+				{
+					unsigned occurrences = 0;
+					vector<string> files = SymbolIndex::get().translationUnitsMatching(rules, kind, inputFiles, &occurrences);
+					llvm::errs() << "Index: " << occurrences << " matching occurrences in "
+					             << files.size() << " of " << inputFiles.size() << " translation units\n";
+					rt.run(factory, files);
+					continue;
+				}
+
+				if(usePrefilter && prefilter.setRules(rules, transformName))
+				{
+					vector<string> files = prefilter.filter(inputFiles);
+					llvm::errs() << "Prefilter: skipped " << inputFiles.size() - files.size()
+					             << " of " << inputFiles.size() << " translation units\n";
+					rt.run(factory, files);
+					continue;
+				}
+			}
+
+			rt.run(factory);
+		}
+		addWorkerTimings(checkpoint);
+		TUTimings::get().printReport(llvm::errs());
+		TUTimings::get().setTransform("");
+		TUTimings::get().save();
+
+		//all transforms of a section edit the files as they were before the
+		//section, and their replacements are applied together
+		rt.applyReplacements();
+		//the index describes the files as they were before the rewrite
+		SymbolIndex::get().invalidate(rt.getRewrittenFiles());
+		if(useIndex && !rt.getRewrittenFiles().empty())
+			SymbolIndex::get().save(indexPath);
+		if(!rt.getRewrittenFiles().empty())
+			TransformRegistry::get().beforeRewrite = false;
+		if(checkpoint.isOpen() && !pipeline)
+			checkpoint.markApplied(section);
+	}
+
+	if(temporaryCheckpoint)
+		unlink(checkpointPath.c_str());
+
+	//translation units that crashed or went over budget were left out
+	const vector<CheckpointLog::Failure> &failures = checkpoint.getFailures();
+	if(!failures.empty())
+	{
+		llvm::errs() << failures.size() << " translation units were skipped:\n";
+		for(auto iter = failures.begin(); iter != failures.end(); ++iter)
+			llvm::errs() << "  " << iter->SourcePath << " (" << iter->Transform << ", section "
+			             << iter->Section + 1 << "): " << iter->Reason << "\n";
+	}
+
+	if(pipeline && !overlay.save())
+	{
+		llvm::errs() << "Could not save rewritten files.\n";
+		return 1;
+	}
+
+	//instead of a full build, parse only the translation units whose
+	//include closure has a rewritten file
+	bool verified = true;
+	if(verify && !undoLog.getEdits().empty())
+	{
+		llvm::OwningPtr<tooling::CompilationDatabase> Compilations(tooling::CompilationDatabase::loadFromDirectory(".", errorMessage));
+		TUPrefilter prefilter(*Compilations);
+		map<string, bool> edited;
+		vector<string> affected;
+		map<string, vector<string> > includes;
+		for(auto iter = allInputFiles.begin(); iter != allInputFiles.end(); ++iter)
+		{
+			vector<string> closure;
+			prefilter.includeClosure(*iter, closure);
+			bool touched = false;
+			for(auto fileIter = closure.begin(); fileIter != closure.end(); ++fileIter)
+			{
+				auto editedIter = edited.find(*fileIter);
+				if(editedIter == edited.end())
+					editedIter = edited.insert(make_pair(*fileIter, undoLog.isEdited(*fileIter))).first;
+				touched = touched || editedIter->second;
+			}
+			if(touched)
+			{
+				affected.push_back(*iter);
+				includes[*iter].swap(closure);
+			}
+		}
+		llvm::errs() << "Verify: " << affected.size() << " of " << allInputFiles.size() << " translation units include a rewritten file\n";
+		if(!affected.empty())
+		{
+			RefactoringTool verifier(*Compilations, affected);
+			for(auto iter = affected.begin(); iter != affected.end(); ++iter)
+				verifier.setIncludes(*iter, includes[*iter]);
+			long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+			TransformRegistry &registry = TransformRegistry::get();
+			verified = verifier.verify(undoLog.getEdits(), registry.parsedSources, registry.failedSources,
+			                           registry.builtinIncludes, jobs > 0 ? jobs : 1);
 		}
 	}
-	return 0;
+
+	FileCache::get().printStats(llvm::errs());
+	TransformRegistry::get().printStats(llvm::errs());
+	RenameMatchCache::printStats(llvm::errs());
+	RenameMatchCache::saveAll();
+	return failures.empty() && verified ? 0 : 1;
 }
@@ -9,3 +9,6 @@ Transforms:
   Accessors:
     - Foo::x
 EOF
+
+# the rewritten code must still build
+make
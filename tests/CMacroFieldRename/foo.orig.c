@@ -0,0 +1,14 @@
+#include "foo.h"
+#include <stdio.h>
+
+static int sum(const struct Point *p)
+{
+  return POINT_SUM(p);
+}
+
+int main()
+{
+  struct Point p = { 1, 2 };
+  printf("%d\n", sum(&p));
+  return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef FOO_H
+#define FOO_H
+
+/* the accessors come before any other token of the translation unit */
+#define POINT_Y(p) ((p)->y)
+#define POINT_SUM(p) ((p)->x + POINT_Y(p))
+
+struct Point {
+  int x;
+  int y;
+};
+
+#endif
@@ -0,0 +1,18 @@
+#!/bin/sh
+cp foo.orig.h foo.h
+cp foo.orig.c foo.c
+cmake -DCMAKE_EXPORT_COMPILE_COMMANDS:STRING=ON .
+make
+
+mkdir -p ../../Build
+cd ../../Build/
+cmake ../
+make
+cd -
+
+../../Build/refactorial < test.yml
+touch foo.h foo.c
+# the field is only reached through a macro defined before the struct
+grep -q "(p)->yPos" foo.h || exit 1
+make
+test "`./foo`" = "3"
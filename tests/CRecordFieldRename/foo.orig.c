@@ -0,0 +1,30 @@
+#include "foo.h"
+
+static struct Shape square = {
+  .name = "square",
+  .origin = { .x = 1, .y = 2 },
+  .numPoints = 4
+};
+
+static struct Shape shapes[] = {
+  [0] = { .name = "dot", .origin.x = 3, .numPoints = 1 },
+  [1] = { "line", { 0, 0 }, 2 }
+};
+
+static int unrelated(int a, int b)
+{
+  return a * b;
+}
+
+static int hasPoints(const struct Shape *s)
+{
+  return HAS_POINTS(s);
+}
+
+int main()
+{
+  size_t offsets = offsetof(struct Shape, numPoints) +
+                   offsetof(struct Shape, origin.y);
+  return (int)offsets + square.origin.y + shapes[1].numPoints +
+         hasPoints(&shapes[0]) + unrelated(1, 2);
+}
@@ -0,0 +1,15 @@
+#include <stddef.h>
+
+struct Point {
+  int x;
+  int y;
+};
+
+struct Shape {
+  const char *name;
+  struct Point origin;
+  int numPoints;
+};
+
+#define SHAPE_POINTS(s) ((s)->numPoints)
+#define HAS_POINTS(s) (SHAPE_POINTS(s) > 0)
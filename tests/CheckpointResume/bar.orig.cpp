@@ -0,0 +1,8 @@
+#include "foo.h"
+
+namespace A {
+  int sum(const Foo &a, const Foo &b)
+  {
+    return a.get() + b.get();
+  }
+}
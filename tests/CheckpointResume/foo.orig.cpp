@@ -0,0 +1,7 @@
+#include "foo.h"
+
+int main()
+{
+  A::Foo a(1), b(2);
+  return A::sum(a, b) == 3 ? 0 : 1;
+}
@@ -0,0 +1,11 @@
+namespace A {
+  class Foo {
+  public:
+    Foo(int v) : value(v) {}
+    int get() const { return value; }
+  private:
+    int value;
+  };
+
+  int sum(const Foo &a, const Foo &b);
+}
@@ -0,0 +1,28 @@
+#!/bin/sh
+cp foo.orig.h foo.h
+cp foo.orig.cpp foo.cpp
+cp bar.orig.cpp bar.cpp
+cmake -DCMAKE_EXPORT_COMPILE_COMMANDS:STRING=ON .
+make
+
+mkdir -p ../../Build
+cd ../../Build/
+cmake ../
+make
+cd -
+
+rm -f refactorial.checkpoint
+../../Build/refactorial --checkpoint refactorial.checkpoint < test.yml
+test `grep -c "^T" refactorial.checkpoint` -eq 2 || exit 1
+
+# as if the run had stopped before writing the files: the resumed run takes
+# the replacements from the log instead of parsing again
+cp foo.orig.h foo.h
+cp foo.orig.cpp foo.cpp
+cp bar.orig.cpp bar.cpp
+grep -v "^A" refactorial.checkpoint > refactorial.checkpoint.tmp
+mv refactorial.checkpoint.tmp refactorial.checkpoint
+../../Build/refactorial --checkpoint refactorial.checkpoint --resume < test.yml 2> refactorial.log
+grep "2 of 2 translation units completed by an earlier run" refactorial.log || exit 1
+touch foo.h foo.cpp bar.cpp
+make
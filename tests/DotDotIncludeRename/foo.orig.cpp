@@ -0,0 +1,7 @@
+#include "sub/../foo.h"
+
+int main()
+{
+  A::Foo f;
+  return f.get();
+}
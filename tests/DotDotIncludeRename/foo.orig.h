@@ -0,0 +1,6 @@
+namespace A {
+  class Foo {
+  public:
+    int get() const { return 2; }
+  };
+}
@@ -0,0 +1,19 @@
+#!/bin/sh
+mkdir -p sub
+cp foo.orig.h foo.h
+cp foo.orig.cpp foo.cpp
+cmake -DCMAKE_EXPORT_COMPILE_COMMANDS:STRING=ON .
+make
+
+mkdir -p ../../Build
+cd ../../Build/
+cmake ../
+make
+cd -
+
+../../Build/refactorial < test.yml || exit 1
+grep -q "class Bar" foo.h || exit 1
+grep -q "getValue" foo.h || exit 1
+grep -q "getValue" foo.cpp || exit 1
+touch foo.h foo.cpp
+make
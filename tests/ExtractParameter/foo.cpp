@@ -8,4 +8,5 @@ int main(void)
 {
 	Foo foo;
 	foo.do_foo();
+	foo.do_baz(3);
 }
@@ -8,4 +8,9 @@ public:
 		int bar = 1;
 			return bar;
 	}
+	int do_baz(int a)
+	{
+		int scale = 2;
+		return a * scale;
+	}
 };
@@ -0,0 +1,15 @@
+#include "foo.h"
+
+int main()
+{
+  A::Foo *a1 = NEW_FOO();
+  A::Foo *a2 = NEW_FOO();
+  A::Foo *a3 = NEW_FOO();
+  DECLARE_FOO(d1);
+  DECLARE_FOO(d2);
+  int r = a1->x + a2->x + a3->x + d1.x + d2.x;
+  delete a1;
+  delete a2;
+  delete a3;
+  return r;
+}
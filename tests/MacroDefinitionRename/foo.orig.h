@@ -0,0 +1,12 @@
+
+namespace A {
+  class Foo {
+  public:
+    int x;
+  };
+};
+
+// renamed once in the definition, however often it is expanded
+#define NEW_FOO() (new A::Foo())
+#define DECLARE_FOO(name) A::Foo name
+
@@ -0,0 +1,10 @@
+
+namespace A {
+  class Foo {
+  public:
+    int value;
+    int get() const { return value; }
+  };
+
+  int twice(const Foo &f);
+};
@@ -0,0 +1,24 @@
+#!/bin/sh
+cp foo.orig.h foo.h
+cp foo.orig.cpp foo.cpp
+cmake -DCMAKE_EXPORT_COMPILE_COMMANDS:STRING=ON .
+make
+
+mkdir -p ../../Build
+cd ../../Build/
+cmake ../
+make
+cd -
+
+../../Build/refactorial < test.yml 2> refactorial.log
+cat refactorial.log
+
+# three transforms, one apply phase
+APPLIED=`grep -c '^Applied ' refactorial.log`
+if [ "$APPLIED" != "1" ]; then
+  echo "expected 1 apply phase, got $APPLIED"
+  exit 1
+fi
+
+touch foo.h foo.cpp
+make
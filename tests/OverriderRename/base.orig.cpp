@@ -0,0 +1,11 @@
+#include "mid.h"
+
+int Base::f() const
+{
+	return 1;
+}
+
+int Mid::f() const
+{
+	return Base::f() + 1;
+}
@@ -0,0 +1,11 @@
+#ifndef BASE_H
+#define BASE_H
+
+class Base
+{
+public:
+	virtual ~Base() {}
+	virtual int f() const;
+};
+
+#endif
@@ -0,0 +1,18 @@
+// Base is only seen through mid.h, and Leaf does not name it
+#include "leaf.h"
+
+#include <iostream>
+
+int Leaf::f() const
+{
+	return Mid::f() + 1;
+}
+
+int main(void)
+{
+	Leaf leaf;
+	const Mid &mid = leaf;
+	const Base *base = &leaf;
+	std::cout << leaf.f() << " " << mid.f() << " " << base->f() << std::endl;
+	return 0;
+}
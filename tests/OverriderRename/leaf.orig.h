@@ -0,0 +1,12 @@
+#ifndef LEAF_H
+#define LEAF_H
+
+#include "mid.h"
+
+class Leaf : public Mid
+{
+public:
+	virtual int f() const;
+};
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef MID_H
+#define MID_H
+
+#include "base.h"
+
+class Mid : public Base
+{
+public:
+	virtual int f() const;
+};
+
+#endif
@@ -0,0 +1,36 @@
+#!/bin/sh
+restore() {
+  for f in base.h mid.h leaf.h base.cpp leaf.cpp; do
+    cp `echo $f | sed 's/\./.orig./'` $f
+  done
+}
+
+restore
+cmake -DCMAKE_EXPORT_COMPILE_COMMANDS:STRING=ON .
+make
+
+mkdir -p ../../Build
+cd ../../Build/
+cmake ../
+make
+cd -
+
+# Mid::f and Leaf::f override Base::f, Leaf::f from a translation unit that
+# only reaches Base through the headers
+check() {
+  if grep -nw f base.h mid.h leaf.h base.cpp leaf.cpp; then
+    echo "an overrider of Base::f was not renamed ($1)"
+    exit 1
+  fi
+  touch base.h mid.h leaf.h base.cpp leaf.cpp
+  make || exit 1
+  [ "`./foo`" = "3 3 3" ] || exit 1
+}
+
+../../Build/refactorial < test.yml || exit 1
+check "without index"
+
+restore
+rm -f refactorial.idx
+../../Build/refactorial < test-index.yml || exit 1
+check "with index"
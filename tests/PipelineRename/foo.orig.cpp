@@ -0,0 +1,13 @@
+#include "foo.h"
+
+int A::twice(const A::Foo &f)
+{
+  return f.get() * 2;
+}
+
+int main()
+{
+  A::Foo f;
+  f.value = 1;
+  return A::twice(f) + f.get();
+}
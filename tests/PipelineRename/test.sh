@@ -0,0 +1,31 @@
+#!/bin/sh
+cp foo.orig.h foo.h
+cp foo.orig.cpp foo.cpp
+cmake -DCMAKE_EXPORT_COMPILE_COMMANDS:STRING=ON .
+make
+
+mkdir -p ../../Build
+cd ../../Build/
+cmake ../
+make
+cd -
+
+../../Build/refactorial --pipeline --verify < test.yml || exit 1
+touch foo.h foo.cpp
+make
+
+# the files go back to what they were before all three sections
+../../Build/refactorial --undo refactorial.undo || exit 1
+cmp foo.orig.h foo.h || exit 1
+cmp foo.orig.cpp foo.cpp || exit 1
+
+# a method body renamed in one section and moved by the next
+cp foo.orig.h foo.h
+cp foo.orig.cpp foo.cpp
+../../Build/refactorial --pipeline --verify < test-move.yml || exit 1
+grep -q "count + count" foo.cpp || exit 1
+touch foo.h foo.cpp
+make
+../../Build/refactorial --undo refactorial.undo || exit 1
+cmp foo.orig.h foo.h || exit 1
+cmp foo.orig.cpp foo.cpp || exit 1
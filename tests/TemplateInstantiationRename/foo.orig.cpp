@@ -0,0 +1,18 @@
+#include <vector>
+#include "foo.h"
+#include "many.h"
+
+using namespace A;
+using namespace std;
+
+int main()
+{
+  Box<Foo> a;
+  Box<Foo *> p;
+  Pair<Foo, Box<Foo> > pair;
+  vector<Box<vector<Foo *> > > v;
+  Box<Box<Foo> > b = Box<Box<Foo> >();
+  Box<int> i;
+  Box<Foo> c = i.as<Foo>();
+  return manyInstantiations() + a.value.x + c.value.x;
+}
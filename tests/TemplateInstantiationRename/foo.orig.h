@@ -0,0 +1,46 @@
+
+namespace A {
+  class Foo {
+  public:
+    int x;
+  };
+
+  template <class T> class Box {
+  public:
+    Box() {}
+    Box(const T& v) : value(v) {}
+    ~Box() {}
+
+    template <class U> Box<U> as() const {
+      Box<U> b;
+      return b;
+    }
+
+    T value;
+  };
+
+  // explicit specialization: its name, base and ctor are all written here
+  template <> class Box<Foo> : public Foo {
+  public:
+    Box() {}
+    ~Box() {}
+    Foo value;
+  };
+
+  // partial specialization
+  template <class T> class Box<T *> {
+  public:
+    Box() : value(0) {}
+    T *value;
+  };
+
+  template <class T1, class T2> class Pair {
+  public:
+    Box<T1> first;
+    Box<Box<T2> > second;
+  };
+};
+
+// explicit instantiations: only the written type is renamed
+template class A::Box<A::Box<A::Foo> >;
+template class A::Pair<A::Foo, A::Box<A::Foo *> >;
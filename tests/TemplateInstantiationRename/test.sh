@@ -0,0 +1,34 @@
+#!/bin/sh
+cp foo.orig.h foo.h
+cp foo.orig.cpp foo.cpp
+
+# many.h: a few hundred functions instantiating the same nested templates,
+# so every pattern is used far more often than it is written
+N=${N:-300}
+echo "#include <vector>" > many.h
+i=0
+while [ $i -lt $N ]; do
+  cat >> many.h <<EOT
+inline int many$i() {
+  A::Pair<A::Foo, A::Box<A::Foo *> > p$i;
+  std::vector<A::Box<std::vector<A::Foo> > > v$i;
+  A::Box<A::Box<A::Foo> > b$i = A::Box<A::Box<A::Foo> >();
+  return p$i.first.value.x + (int)v$i.size() + b$i.value.value.x;
+}
+EOT
+  i=`expr $i + 1`
+done
+echo "inline int manyInstantiations() { return many0(); }" >> many.h
+
+cmake -DCMAKE_EXPORT_COMPILE_COMMANDS:STRING=ON .
+make
+
+mkdir -p ../../Build
+cd ../../Build/
+cmake ../
+make
+cd -
+
+../../Build/refactorial < test.yml
+touch foo.h foo.cpp many.h
+make